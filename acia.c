@@ -0,0 +1,117 @@
+/*6502 emul - 6551 ACIA serial port*/
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mmio.h"
+#include "acia.h"
+
+// Send the transmit FIFO to the host in one write()
+void acia_flush(Acia *acia) {
+    unsigned int done = 0;
+    while (done < acia->tx_len) {
+        ssize_t n = write(acia->out_fd, acia->tx + done, acia->tx_len - done);
+        acia->tx_syscalls++;
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    acia->tx_len = 0;
+}
+
+// Refill the receive FIFO once it is empty. A guest polling the status
+// register with no input pending only reaches the host every
+// ACIA_POLL_INTERVAL reads.
+static void acia_receive(Acia *acia) {
+    if (acia->rx_head < acia->rx_len || acia->rx_eof) {
+        return;
+    }
+    if (acia->poll_countdown > 0) {
+        acia->poll_countdown--;
+        return;
+    }
+    // The guest is waiting for input: show what it printed so far
+    if (acia->tx_len > 0) {
+        acia_flush(acia);
+    }
+    struct pollfd pfd = { acia->in_fd, POLLIN, 0 };
+    acia->rx_syscalls++;
+    if (poll(&pfd, 1, 0) <= 0) {
+        acia->poll_countdown = ACIA_POLL_INTERVAL;
+        return;
+    }
+    ssize_t n = read(acia->in_fd, acia->rx, ACIA_FIFO_SIZE);
+    acia->rx_syscalls++;
+    if (n <= 0) {
+        acia->rx_eof = 1;
+        return;
+    }
+    acia->rx_head = 0;
+    acia->rx_len = n;
+}
+
+static unsigned char acia_read(void *dev, unsigned short reg) {
+    Acia *acia = dev;
+    switch (reg) {
+        case ACIA_DATA:
+            acia_receive(acia);
+            if (acia->rx_head == acia->rx_len) {
+                return 0;
+            }
+            acia->rx_bytes++;
+            return acia->rx[acia->rx_head++];
+        case ACIA_STATUS:
+            acia_receive(acia);
+            // Transmit never blocks: a full FIFO is flushed on the spot
+            return ACIA_STATUS_TDRE | (acia->rx_head < acia->rx_len ? ACIA_STATUS_RDRF : 0);
+        case ACIA_COMMAND:
+            return acia->command;
+        default:
+            return acia->control;
+    }
+}
+
+static void acia_write(void *dev, unsigned short reg, unsigned char value) {
+    Acia *acia = dev;
+    switch (reg) {
+        case ACIA_DATA:
+            acia->tx[acia->tx_len++] = value;
+            acia->tx_bytes++;
+            if (acia->tx_len == ACIA_FIFO_SIZE || (acia->out_tty && value == '\n')) {
+                acia_flush(acia);
+            }
+            break;
+        case ACIA_STATUS: // Programmed reset
+            acia->command &= 0xE0;
+            break;
+        case ACIA_COMMAND:
+            acia->command = value;
+            break;
+        default:
+            acia->control = value;
+            break;
+    }
+}
+
+// Create an ACIA at base talking to the host through in_fd/out_fd
+Acia *acia_create(unsigned short base, int in_fd, int out_fd) {
+    Acia *acia = calloc(1, sizeof(Acia));
+    if (acia == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    acia->base = base;
+    acia->in_fd = in_fd;
+    acia->out_fd = out_fd;
+    acia->out_tty = isatty(out_fd);
+    mmio_map(base, 4, acia_read, acia_write, acia);
+    return acia;
+}
+
+// Flush pending output and free the ACIA (the caller unmaps it)
+void acia_destroy(Acia *acia) {
+    acia_flush(acia);
+    free(acia);
+}
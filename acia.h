@@ -0,0 +1,45 @@
+/*6502 emul - 6551 ACIA serial port*/
+#ifndef ACIA_H
+#define ACIA_H
+// Registers, relative to the base address
+#define ACIA_DATA    0 // read: receive, write: transmit
+#define ACIA_STATUS  1 // read: status, write: programmed reset
+#define ACIA_COMMAND 2
+#define ACIA_CONTROL 3
+
+// Status register bits
+#define ACIA_STATUS_RDRF 0x08 // receive data register full
+#define ACIA_STATUS_TDRE 0x10 // transmit data register empty
+
+#define ACIA_DEFAULT_BASE 0x8800
+#define ACIA_FIFO_SIZE 4096
+// Status reads between host polls once the receive FIFO ran dry
+#define ACIA_POLL_INTERVAL 1024
+
+typedef struct {
+    unsigned short base;
+    int in_fd;
+    int out_fd;
+    int out_tty;        // flush transmit FIFO on newline
+    unsigned char command;
+    unsigned char control;
+    // Receive FIFO: bytes rx[rx_head..rx_len) are still unread
+    unsigned char rx[ACIA_FIFO_SIZE];
+    unsigned int rx_head;
+    unsigned int rx_len;
+    int rx_eof;
+    unsigned int poll_countdown;
+    // Transmit FIFO
+    unsigned char tx[ACIA_FIFO_SIZE];
+    unsigned int tx_len;
+    // Counters
+    unsigned long rx_bytes;
+    unsigned long tx_bytes;
+    unsigned long rx_syscalls;
+    unsigned long tx_syscalls;
+} Acia;
+
+Acia *acia_create(unsigned short base, int in_fd, int out_fd);
+void acia_flush(Acia *acia);
+void acia_destroy(Acia *acia);
+#endif
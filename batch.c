@@ -0,0 +1,520 @@
+/*6502 emul - lockstep batches of machines running one program*/
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "batch.h"
+
+// Lane kernels, applied to n lanes (a multiple of BATCH_VECTOR) where
+// mask is 0xFF:
+// blend: dst = src
+// add:   dst += src
+// cmpeq: bit 0 of p = (a == src), as CMP does
+typedef struct {
+    const char *name;
+    void (*blend)(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int n);
+    void (*add)(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int n);
+    void (*cmpeq)(unsigned char *p, const unsigned char *a, const unsigned char *src, const unsigned char *mask, int n);
+} LaneOps;
+
+static void blend_scalar(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = (dst[i] & ~mask[i]) | (src[i] & mask[i]);
+    }
+}
+
+static void add_scalar(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] += src[i] & mask[i];
+    }
+}
+
+static void cmpeq_scalar(unsigned char *p, const unsigned char *a, const unsigned char *src, const unsigned char *mask, int n) {
+    for (int i = 0; i < n; i++) {
+        unsigned char bit = mask[i] & 0x01;
+        p[i] = (p[i] & ~bit) | (a[i] == src[i] ? bit : 0);
+    }
+}
+
+static const LaneOps ops_scalar = { "scalar", blend_scalar, add_scalar, cmpeq_scalar };
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void blend_sse2(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __m128i m = _mm_load_si128((const __m128i *)(mask + i));
+        __m128i d = _mm_load_si128((const __m128i *)(dst + i));
+        __m128i s = _mm_load_si128((const __m128i *)(src + i));
+        _mm_store_si128((__m128i *)(dst + i), _mm_or_si128(_mm_andnot_si128(m, d), _mm_and_si128(m, s)));
+    }
+}
+
+__attribute__((target("sse2")))
+static void add_sse2(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int n) {
+    for (int i = 0; i < n; i += 16) {
+        __m128i m = _mm_load_si128((const __m128i *)(mask + i));
+        __m128i d = _mm_load_si128((const __m128i *)(dst + i));
+        __m128i s = _mm_load_si128((const __m128i *)(src + i));
+        _mm_store_si128((__m128i *)(dst + i), _mm_add_epi8(d, _mm_and_si128(m, s)));
+    }
+}
+
+__attribute__((target("sse2")))
+static void cmpeq_sse2(unsigned char *p, const unsigned char *a, const unsigned char *src, const unsigned char *mask, int n) {
+    __m128i one = _mm_set1_epi8(0x01);
+    for (int i = 0; i < n; i += 16) {
+        __m128i bit = _mm_and_si128(_mm_load_si128((const __m128i *)(mask + i)), one);
+        __m128i eq = _mm_cmpeq_epi8(_mm_load_si128((const __m128i *)(a + i)), _mm_load_si128((const __m128i *)(src + i)));
+        __m128i old = _mm_andnot_si128(bit, _mm_load_si128((const __m128i *)(p + i)));
+        _mm_store_si128((__m128i *)(p + i), _mm_or_si128(old, _mm_and_si128(eq, bit)));
+    }
+}
+
+static const LaneOps ops_sse2 = { "sse2", blend_sse2, add_sse2, cmpeq_sse2 };
+
+__attribute__((target("avx2")))
+static void blend_avx2(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int n) {
+    for (int i = 0; i < n; i += 32) {
+        __m256i m = _mm256_load_si256((const __m256i *)(mask + i));
+        __m256i d = _mm256_load_si256((const __m256i *)(dst + i));
+        __m256i s = _mm256_load_si256((const __m256i *)(src + i));
+        _mm256_store_si256((__m256i *)(dst + i), _mm256_blendv_epi8(d, s, m));
+    }
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(unsigned char *dst, const unsigned char *src, const unsigned char *mask, int n) {
+    for (int i = 0; i < n; i += 32) {
+        __m256i m = _mm256_load_si256((const __m256i *)(mask + i));
+        __m256i d = _mm256_load_si256((const __m256i *)(dst + i));
+        __m256i s = _mm256_load_si256((const __m256i *)(src + i));
+        _mm256_store_si256((__m256i *)(dst + i), _mm256_add_epi8(d, _mm256_and_si256(m, s)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void cmpeq_avx2(unsigned char *p, const unsigned char *a, const unsigned char *src, const unsigned char *mask, int n) {
+    __m256i one = _mm256_set1_epi8(0x01);
+    for (int i = 0; i < n; i += 32) {
+        __m256i bit = _mm256_and_si256(_mm256_load_si256((const __m256i *)(mask + i)), one);
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)(a + i)),
+                                       _mm256_load_si256((const __m256i *)(src + i)));
+        __m256i old = _mm256_andnot_si256(bit, _mm256_load_si256((const __m256i *)(p + i)));
+        _mm256_store_si256((__m256i *)(p + i), _mm256_or_si256(old, _mm256_and_si256(eq, bit)));
+    }
+}
+
+static const LaneOps ops_avx2 = { "avx2", blend_avx2, add_avx2, cmpeq_avx2 };
+#endif
+
+static const LaneOps *ops;
+
+static const LaneOps *lane_ops(void) {
+    if (ops == NULL) {
+        ops = &ops_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            ops = &ops_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            ops = &ops_sse2;
+        }
+#endif
+    }
+    return ops;
+}
+
+const char *batch_isa(void) {
+    return lane_ops()->name;
+}
+
+// Length of the instructions with a lockstep form, 0 for the others
+static const unsigned char lockstep_length[256] = {
+    [0xA9] = 2, [0xA2] = 2, [0xA0] = 2, [0x69] = 2, [0xC9] = 2, // immediate
+    [0xE8] = 1, [0xC8] = 1, [0xAA] = 1, [0x8A] = 1, [0xA8] = 1, [0x98] = 1, [0x9A] = 1, [0xBA] = 1,
+    [0xD0] = 2, [0xF0] = 2, [0x90] = 2, [0xB0] = 2, // branches
+    [0x4C] = 3, // JMP
+    [0xAD] = 3, [0xAE] = 3, [0xAC] = 3, [0xA6] = 2, // loads
+    [0x8D] = 3, [0x9E] = 3, [0x9D] = 3, // stores
+    [0xE6] = 3, // INC zp (operand fetched twice)
+};
+
+static int is_immediate(unsigned char opcode) {
+    return opcode == 0xA9 || opcode == 0xA2 || opcode == 0xA0 || opcode == 0x69 || opcode == 0xC9;
+}
+
+Batch *batch_create(int lanes, const unsigned char *image, unsigned short start) {
+    if (lanes < 1 || lanes > BATCH_MAX_LANES) {
+        return NULL;
+    }
+    Batch *b = aligned_alloc(32, (sizeof(Batch) + 31) & ~31);
+    if (b == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    memset(b, 0, sizeof(*b));
+    b->lanes = lanes;
+    b->width = (lanes + BATCH_VECTOR - 1) / BATCH_VECTOR * BATCH_VECTOR;
+    for (int i = 0; i < lanes; i++) {
+        cpu_init(&b->cpu[i]);
+        b->cpu[i].mem = malloc(MEMORY_SIZE);
+        if (b->cpu[i].mem == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        memcpy(b->cpu[i].mem, image, MEMORY_SIZE);
+        b->cpu[i].pc = start;
+    }
+    lane_ops();
+    return b;
+}
+
+void batch_free(Batch *b) {
+    for (int i = 0; i < b->lanes; i++) {
+        free(b->cpu[i].mem);
+    }
+    free(b);
+}
+
+// Credit the lanes of the group with the steps run since it formed
+static void settle(Batch *b) {
+    for (int i = 0; i < b->lanes; i++) {
+        if (b->active[i]) {
+            b->lane_retired[i] += b->steps - b->group_start;
+        }
+    }
+    b->group_start = b->steps;
+}
+
+// Form the group from the running lanes at the PC of the lane having a
+// turn, else with the lowest PC; returns 0 when no lane is left
+static int schedule(Batch *b) {
+    int pc = MEMORY_SIZE;
+    if (b->turn > 0 && b->running[b->turn_lane]) {
+        pc = b->lane_pc[b->turn_lane];
+    } else {
+        b->turn = 0;
+        for (int i = 0; i < b->lanes; i++) {
+            if (b->running[i] && b->lane_pc[i] < pc) {
+                pc = b->lane_pc[i];
+            }
+        }
+    }
+    settle(b);
+    b->active_count = 0;
+    b->waiting = 0;
+    b->wait_min = MEMORY_SIZE;
+    memset(b->active, 0, b->width);
+    if (pc == MEMORY_SIZE) {
+        return 0;
+    }
+    for (int i = 0; i < b->lanes; i++) {
+        if (!b->running[i]) {
+            continue;
+        }
+        if (b->lane_pc[i] == pc) {
+            b->active[i] = 0xFF;
+            b->leader = i;
+            b->active_count++;
+        } else {
+            b->waiting++;
+            if (b->lane_pc[i] > pc && b->lane_pc[i] < b->wait_min) {
+                b->wait_min = b->lane_pc[i];
+            }
+        }
+    }
+    b->pc = pc;
+    return 1;
+}
+
+// Leave the group's PC with its lanes
+static void park(Batch *b) {
+    for (int i = 0; i < b->lanes; i++) {
+        if (b->active[i]) {
+            b->lane_pc[i] = b->pc;
+        }
+    }
+}
+
+// One instruction for every lane of the group through the interpreter
+static void scalar_step(Batch *b) {
+    for (int i = 0; i < b->lanes; i++) {
+        if (!b->active[i]) {
+            continue;
+        }
+        CPU6502 *cpu = &b->cpu[i];
+        const unsigned char *code = cpu->mem + b->pc;
+        // Stores into code make the lanes' code diverge
+        if (code[0] == 0x8D || code[0] == 0x9E || code[0] == 0x9D) {
+            b->code_dirty[code[1] | (code[2] << 8)] = 1;
+        } else if (code[0] == 0xE6) {
+            b->code_dirty[code[2]] = 1;
+        }
+        cpu->a = b->a[i];
+        cpu->x = b->x[i];
+        cpu->y = b->y[i];
+        cpu->p = b->p[i];
+        cpu->sp = b->sp[i];
+        cpu->pc = b->pc;
+        execute_instruction(cpu);
+        b->a[i] = cpu->a;
+        b->x[i] = cpu->x;
+        b->y[i] = cpu->y;
+        b->p[i] = cpu->p;
+        b->sp[i] = cpu->sp;
+        b->lane_pc[i] = cpu->pc;
+        if (cpu->stop != CPU_RUNNING) {
+            b->running[i] = 0;
+        }
+    }
+    b->steps++;
+    b->lane_steps += b->active_count;
+    b->scalar_steps += b->active_count;
+}
+
+// Conditional branch on bit of P: taken when the bit equals when.
+// Returns 1 when the group split and was formed again.
+static int branch(Batch *b, unsigned char bit, int when) {
+    unsigned short next = b->pc + 2;
+    unsigned short target = next + b->operand[b->leader];
+    int taken = 0;
+    for (int i = 0; i < b->lanes; i++) {
+        if (b->active[i] && ((b->p[i] & bit) != 0) == when) {
+            taken++;
+        }
+    }
+    if (taken == 0 || taken == b->active_count) {
+        b->pc = taken ? target : next;
+        return 0;
+    }
+    // Diverged: every lane keeps its own PC until the group meets again
+    for (int i = 0; i < b->lanes; i++) {
+        if (b->active[i]) {
+            b->lane_pc[i] = ((b->p[i] & bit) != 0) == when ? target : next;
+        }
+    }
+    b->splits++;
+    schedule(b);
+    return 1;
+}
+
+static void load(Batch *b, unsigned char *reg, unsigned short address) {
+    for (int i = 0; i < b->lanes; i++) {
+        if (b->active[i]) {
+            reg[i] = b->cpu[i].mem[address];
+        }
+    }
+}
+
+static void store(Batch *b, const unsigned char *reg, unsigned short address) {
+    for (int i = 0; i < b->lanes; i++) {
+        if (b->active[i]) {
+            b->cpu[i].mem[address] = reg ? reg[i] : 0;
+        }
+    }
+    b->code_dirty[address] = 1;
+}
+
+// Decode the instruction at the group's PC once and apply it to every
+// lane of the group
+static void step(Batch *b) {
+    const LaneOps *v = ops;
+    const unsigned char *code = b->cpu[b->leader].mem + b->pc;
+    unsigned char opcode = code[0];
+    int len = lockstep_length[opcode];
+    if (len == 0 || b->pc + len > MEMORY_SIZE) {
+        scalar_step(b);
+        schedule(b);
+        return;
+    }
+    // Lanes only disagree on code they stored into
+    memset(b->operand, code[1], b->width);
+    int dirty = 0;
+    for (int i = 0; i < len; i++) {
+        dirty |= b->code_dirty[b->pc + i];
+    }
+    if (dirty) {
+        int uniform = 1;
+        for (int i = 0; i < b->lanes; i++) {
+            if (!b->active[i]) {
+                continue;
+            }
+            const unsigned char *lane = b->cpu[i].mem + b->pc;
+            if (lane[0] != opcode || (len == 3 && lane[2] != code[2])) {
+                uniform = 0;
+                break;
+            }
+            if (len > 1 && lane[1] != code[1]) {
+                if (!is_immediate(opcode)) {
+                    uniform = 0;
+                    break;
+                }
+                b->operand[i] = lane[1]; // per-lane immediate
+            }
+        }
+        if (!uniform) {
+            scalar_step(b);
+            schedule(b);
+            return;
+        }
+    }
+    unsigned short address = code[1] | (len == 3 ? code[2] << 8 : 0);
+    unsigned char one[BATCH_MAX_LANES] __attribute__((aligned(32)));
+    b->steps++;
+    b->lane_steps += b->active_count;
+    switch (opcode) {
+        case 0xA9: // LDA #
+            v->blend(b->a, b->operand, b->active, b->width);
+            break;
+        case 0xA2: // LDX #
+            v->blend(b->x, b->operand, b->active, b->width);
+            break;
+        case 0xA0: // LDY #
+            v->blend(b->y, b->operand, b->active, b->width);
+            break;
+        case 0x69: // ADC #
+            v->add(b->a, b->operand, b->active, b->width);
+            break;
+        case 0xC9: // CMP #
+            v->cmpeq(b->p, b->a, b->operand, b->active, b->width);
+            break;
+        case 0xE8: // INX
+            memset(one, 1, b->width);
+            v->add(b->x, one, b->active, b->width);
+            break;
+        case 0xC8: // INY
+            memset(one, 1, b->width);
+            v->add(b->y, one, b->active, b->width);
+            break;
+        case 0xAA: // TAX
+            v->blend(b->x, b->a, b->active, b->width);
+            break;
+        case 0x8A: // TXA
+            v->blend(b->a, b->x, b->active, b->width);
+            break;
+        case 0xA8: // TAY
+            v->blend(b->y, b->a, b->active, b->width);
+            break;
+        case 0x98: // TYA
+            v->blend(b->a, b->y, b->active, b->width);
+            break;
+        case 0x9A: // TXS
+            v->blend(b->sp, b->x, b->active, b->width);
+            break;
+        case 0xBA: // TSX
+            v->blend(b->x, b->sp, b->active, b->width);
+            break;
+        case 0xD0: // BNE (taken on equal, see execute_instruction)
+            if (branch(b, 0x01, 1)) {
+                return;
+            }
+            goto moved;
+        case 0xF0: // BEQ
+            if (branch(b, 0x01, 0)) {
+                return;
+            }
+            goto moved;
+        case 0x90: // BCC
+            if (branch(b, 0x02, 0)) {
+                return;
+            }
+            goto moved;
+        case 0xB0: // BCS
+            if (branch(b, 0x02, 1)) {
+                return;
+            }
+            goto moved;
+        case 0x4C: // JMP
+            b->pc = address;
+            goto moved;
+        case 0xAD: // LDA abs
+            load(b, b->a, address);
+            break;
+        case 0xAE: // LDY abs
+        case 0xAC:
+            load(b, b->y, address);
+            break;
+        case 0xA6: // LDA zp
+            load(b, b->a, address);
+            break;
+        case 0x8D: // STA abs
+            store(b, b->a, address);
+            break;
+        case 0x9E: // STX abs
+            store(b, b->x, address);
+            break;
+        case 0x9D: // STZ abs
+            store(b, NULL, address);
+            break;
+        case 0xE6: // INC zp: reads the first operand, writes the second
+            for (int i = 0; i < b->lanes; i++) {
+                if (b->active[i]) {
+                    b->cpu[i].mem[code[2]] = b->cpu[i].mem[code[1]] + 1;
+                }
+            }
+            b->code_dirty[code[2]] = 1;
+            break;
+    }
+    b->pc += len;
+moved:
+    // The group reached (or passed) a waiting lane
+    if (b->pc >= b->wait_min) {
+        park(b);
+        schedule(b);
+    }
+}
+
+// Give the next waiting lane after the last one that had a turn
+// BATCH_FAIRNESS steps
+static void give_turn(Batch *b) {
+    int lane = b->turn_lane;
+    do {
+        lane = (lane + 1) % b->lanes;
+    } while (!b->running[lane] || b->active[lane]);
+    b->turn_lane = lane;
+    b->turn = BATCH_FAIRNESS;
+    b->turns++;
+    b->age = 0;
+    park(b);
+    schedule(b);
+}
+
+void batch_run(Batch *b, unsigned long max_steps) {
+    lane_ops();
+    for (int i = 0; i < b->lanes; i++) {
+        CPU6502 *cpu = &b->cpu[i];
+        b->a[i] = cpu->a;
+        b->x[i] = cpu->x;
+        b->y[i] = cpu->y;
+        b->p[i] = cpu->p;
+        b->sp[i] = cpu->sp;
+        b->lane_pc[i] = cpu->pc;
+        b->running[i] = cpu->stop == CPU_RUNNING;
+    }
+    if (schedule(b)) {
+        for (unsigned long n = 0; n < max_steps && b->active_count > 0; n++) {
+            step(b);
+            if (b->turn > 0) {
+                // Turn over: lowest PC first again
+                if (--b->turn == 0) {
+                    park(b);
+                    schedule(b);
+                }
+            } else if (b->waiting && ++b->age >= BATCH_FAIRNESS) {
+                give_turn(b);
+            }
+        }
+        park(b);
+        settle(b);
+    }
+    for (int i = 0; i < b->lanes; i++) {
+        CPU6502 *cpu = &b->cpu[i];
+        cpu->a = b->a[i];
+        cpu->x = b->x[i];
+        cpu->y = b->y[i];
+        cpu->p = b->p[i];
+        cpu->sp = b->sp[i];
+        cpu->pc = b->lane_pc[i];
+    }
+}
@@ -0,0 +1,71 @@
+/*6502 emul - lockstep batches of machines running one program*/
+#ifndef BATCH_H
+#define BATCH_H
+#include "cpu6502.h"
+
+#define BATCH_MAX_LANES 256
+// Lanes handled per vector step; register arrays are padded to it
+#define BATCH_VECTOR 32
+// Steps the group runs while other lanes wait before one of them gets a
+// turn, and the length of the turn
+#define BATCH_FAIRNESS 4096
+
+// N machines (lanes) loaded with the same image. Lanes whose PCs agree
+// form the lockstep group: the instruction is decoded once and applied
+// to the A/X/Y/P arrays of every lane in the group with vector ops.
+// When a branch splits the group, the lanes with the lowest PC run
+// first and the others join again when the group reaches their PC. So
+// that a group looping below them cannot starve them, once lanes have
+// waited BATCH_FAIRNESS steps the next waiting lane (round robin) gets
+// a turn of as many steps, its group following it until the turn ends.
+// Instructions without a vector form (JSR, RTS, host calls, indexed
+// modes...) and code whose bytes differ between lanes go through
+// execute_instruction one lane at a time. Lanes have no MMIO devices,
+// and memory written by host calls is assumed never to be executed.
+typedef struct {
+    int lanes;
+    int width; // lanes rounded up to BATCH_VECTOR
+    // Registers, one byte per lane
+    unsigned char a[BATCH_MAX_LANES] __attribute__((aligned(32)));
+    unsigned char x[BATCH_MAX_LANES] __attribute__((aligned(32)));
+    unsigned char y[BATCH_MAX_LANES] __attribute__((aligned(32)));
+    unsigned char p[BATCH_MAX_LANES] __attribute__((aligned(32)));
+    unsigned char sp[BATCH_MAX_LANES] __attribute__((aligned(32)));
+    // 0xFF for lanes in the lockstep group
+    unsigned char active[BATCH_MAX_LANES] __attribute__((aligned(32)));
+    unsigned char operand[BATCH_MAX_LANES] __attribute__((aligned(32)));
+    unsigned char running[BATCH_MAX_LANES];
+    unsigned short lane_pc[BATCH_MAX_LANES]; // PC of lanes outside the group
+    // Group
+    unsigned short pc;
+    int leader; // a lane of the group, whose memory the code is read from
+    int active_count;
+    int wait_min; // lowest PC of a waiting lane above the group's, MEMORY_SIZE if none
+    int waiting;  // running lanes outside the group
+    unsigned long age;  // steps run since a waiting lane last got a turn
+    unsigned long turn; // steps left in the turn of turn_lane, 0 if none
+    int turn_lane;
+    unsigned long group_start; // steps when the group was formed
+    // Bytes stored to since the start: code there may differ between lanes
+    unsigned char code_dirty[MEMORY_SIZE];
+    // Stack, stop code, memory and console of each lane; registers are
+    // copied in and out by batch_run
+    CPU6502 cpu[BATCH_MAX_LANES];
+    // Counters
+    unsigned long steps;       // instructions decoded for the group
+    unsigned long lane_steps;  // instructions executed, summed over lanes
+    unsigned long scalar_steps; // lane instructions run by execute_instruction
+    unsigned long splits;
+    unsigned long turns;       // turns given to starved lanes
+    unsigned long lane_retired[BATCH_MAX_LANES]; // instructions each lane executed
+} Batch;
+
+// Lanes start at start with a private copy of image
+Batch *batch_create(int lanes, const unsigned char *image, unsigned short start);
+// Run until every lane stopped or the group decoded max_steps
+// instructions; registers of each lane are in cpu[lane] on return
+void batch_run(Batch *b, unsigned long max_steps);
+void batch_free(Batch *b);
+// Vector instruction set in use: "avx2", "sse2" or "scalar"
+const char *batch_isa(void);
+#endif
@@ -0,0 +1,1371 @@
+/*6502 emul - benchmarks*/
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "cpu6502.h"
+#include "hostcall.h"
+#include "fileio.h"
+#include "mmio.h"
+#include "acia.h"
+#include "filter.h"
+#include "loader.h"
+#include "savestate.h"
+#include "checkpoint.h"
+#include "farm.h"
+#include "batch.h"
+#include "fuzz.h"
+#include "coverage.h"
+#include "replay.h"
+#include "timetravel.h"
+#include "trace.h"
+#include "breakpoint.h"
+#include "memview.h"
+#include "difftest.h"
+#include "serve.h"
+#include "bench.h"
+
+// Monotonic time in seconds
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fresh machine: cleared memory, reset CPU, built-in host calls
+static void bench_reset(CPU6502 *cpu) {
+    memset(memory, 0, MEMORY_SIZE);
+    mmio_reset();
+    cpu_init(cpu);
+    hostcall_init();
+    fileio_init();
+}
+
+// Run until PC reaches halt_pc (the guest spins there with JMP *).
+// Returns the number of instructions executed.
+static unsigned long run_until(CPU6502 *cpu, unsigned short halt_pc) {
+    unsigned long count = 0;
+    while (cpu->pc != halt_pc && cpu->stop == CPU_RUNNING) {
+        execute_instruction(cpu);
+        count++;
+    }
+    return count;
+}
+
+// Temp file of size pseudo-random bytes; returns its sum modulo 256
+static unsigned char make_data_file(char *path, size_t size) {
+    unsigned char *data = malloc(size);
+    unsigned char sum = 0;
+    int fd = mkstemp(path);
+    if (data == NULL || fd < 0) {
+        printf("Cannot create %s\n", path);
+        exit(1);
+    }
+    srand(6502);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = rand();
+        sum += data[i];
+    }
+    if (write(fd, data, size) != (ssize_t)size) {
+        printf("Short write to %s\n", path);
+        exit(1);
+    }
+    close(fd);
+    free(data);
+    return sum;
+}
+
+// Checksum guest: opens the file named at $0200, reads it in 4 KB
+// chunks into $1000-$1FFF with FREAD and adds every byte into $F2.
+// ADC only has an immediate form, so each byte is patched into the
+// ADC operand. CMP sets P bit 0 on equality and BNE branches on it.
+static const unsigned char checksum_prog[] = {
+    0xA9, 0x80,             // 0400 LDA #$80
+    0xA2, 0x02,             // 0402 LDX #$02
+    0x20, 0x2A, 0x00,       // 0404 JSR FOPEN (block at $0280)
+    0x8D, 0x90, 0x02,       // 0407 STA $0290 (read block handle)
+    0x8D, 0xA0, 0x02,       // 040A STA $02A0 (close block handle)
+    0xA9, 0x00,             // 040D readloop: LDA #$00
+    0x8D, 0x93, 0x02,       // 040F STA $0293 (length = $1000)
+    0xA9, 0x10,             // 0412 LDA #$10
+    0x8D, 0x94, 0x02,       // 0414 STA $0294
+    0xA9, 0x90,             // 0417 LDA #$90
+    0xA2, 0x02,             // 0419 LDX #$02
+    0x20, 0x2B, 0x00,       // 041B JSR FREAD (block at $0290)
+    0xAD, 0x94, 0x02,       // 041E LDA $0294 (bytes read, high)
+    0xC9, 0x00,             // 0421 CMP #$00
+    0xD0, 0x32,             // 0423 BNE done (end of file)
+    0xA9, 0x10,             // 0425 LDA #$10
+    0x8D, 0xF1, 0x00,       // 0427 STA $00F1 (pointer = $1000)
+    0xA9, 0x00,             // 042A LDA #$00
+    0x8D, 0xF0, 0x00,       // 042C STA $00F0
+    0xA2, 0x00,             // 042F pageloop: LDX #$00
+    0xA1, 0xF0,             // 0431 byteloop: LDA ($F0),X
+    0x8D, 0x3A, 0x04,       // 0433 STA $043A (ADC operand)
+    0xAD, 0xF2, 0x00,       // 0436 LDA $00F2
+    0x69, 0x00,             // 0439 ADC #byte
+    0x8D, 0xF2, 0x00,       // 043B STA $00F2
+    0xE8,                   // 043E INX
+    0x8A,                   // 043F TXA
+    0xC9, 0x00,             // 0440 CMP #$00
+    0xD0, 0x03,             // 0442 BNE +3 (page done)
+    0x4C, 0x31, 0x04,       // 0444 JMP byteloop
+    0xE6, 0xF1, 0xF1,       // 0447 INC $F1 (operand fetched twice)
+    0xAD, 0xF1, 0x00,       // 044A LDA $00F1
+    0xC9, 0x20,             // 044D CMP #$20
+    0xD0, 0x03,             // 044F BNE +3 (chunk done)
+    0x4C, 0x2F, 0x04,       // 0451 JMP pageloop
+    0x4C, 0x0D, 0x04,       // 0454 JMP readloop
+    0xA9, 0xA0,             // 0457 done: LDA #$A0
+    0xA2, 0x02,             // 0459 LDX #$02
+    0x20, 0x2E, 0x00,       // 045B JSR FCLOSE (block at $02A0)
+    0xAD, 0xF2, 0x00,       // 045E LDA $00F2
+    0x4C, 0x61, 0x04,       // 0461 JMP $0461 (halt)
+};
+#define CHECKSUM_HALT 0x0461
+
+// Checksum a multi-MB file from guest code through the file host calls
+static void bench_fileio(void) {
+    const size_t size = 4 * 1024 * 1024; // multiple of the 4 KB chunk
+    char path[] = "/tmp/emul6502-benchXXXXXX";
+    unsigned char expected = make_data_file(path, size);
+
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], checksum_prog, sizeof(checksum_prog));
+    strcpy((char *)&memory[0x200], path);
+    memory[0x280] = 0x00; // OPEN block: path $0200, mode read
+    memory[0x281] = 0x02;
+    memory[0x282] = 0x00;
+    memory[0x291] = 0x00; // READ block: buffer $1000
+    memory[0x292] = 0x10;
+    cpu.pc = 0x400;
+
+    double start = now();
+    unsigned long count = run_until(&cpu, CHECKSUM_HALT);
+    double elapsed = now() - start;
+    unlink(path);
+
+    if (cpu.a != expected) {
+        printf("fileio: checksum mismatch (guest $%02X, host $%02X)\n", cpu.a, expected);
+        exit(1);
+    }
+    printf("fileio: %zu bytes in %.3f s, %.2f MB/s, %lu instructions (%.1f MIPS)\n",
+           size, elapsed, size / elapsed / 1e6, count, count / elapsed / 1e6);
+}
+
+// Echo guest polling a 6551 ACIA at $8800: wait for RDRF, copy the
+// received byte to the transmit register, repeat
+static const unsigned char acia_echo_prog[] = {
+    0xAD, 0x01, 0x88,       // 0400 poll: LDA $8801 (status)
+    0xC9, 0x18,             // 0403 CMP #$18 (RDRF | TDRE)
+    0xD0, 0x03,             // 0405 BNE +3 (byte waiting)
+    0x4C, 0x00, 0x04,       // 0407 JMP poll
+    0xAD, 0x00, 0x88,       // 040A LDA $8800 (receive)
+    0x8D, 0x00, 0x88,       // 040D STA $8800 (transmit)
+    0x4C, 0x00, 0x04,       // 0410 JMP poll
+};
+
+// Sustained serial throughput: a file is pushed through the ACIA
+// receive FIFO, echoed by the guest and written to /dev/null
+static void bench_acia(void) {
+    const size_t size = 4 * 1024 * 1024;
+    char path[] = "/tmp/emul6502-benchXXXXXX";
+    make_data_file(path, size);
+    int in_fd = open(path, O_RDONLY);
+    int out_fd = open("/dev/null", O_WRONLY);
+    unlink(path);
+    if (in_fd < 0 || out_fd < 0) {
+        printf("acia: cannot open input/output\n");
+        exit(1);
+    }
+
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    Acia *acia = acia_create(ACIA_DEFAULT_BASE, in_fd, out_fd);
+    memcpy(&memory[0x400], acia_echo_prog, sizeof(acia_echo_prog));
+    cpu.pc = 0x400;
+
+    double start = now();
+    unsigned long count = 0;
+    while (acia->tx_bytes < size) {
+        execute_instruction(&cpu);
+        count++;
+    }
+    acia_flush(acia);
+    double elapsed = now() - start;
+
+    printf("acia: %zu bytes in %.3f s, %.2f MB/s, %lu instructions (%.1f MIPS), %lu rx + %lu tx syscalls\n",
+           size, elapsed, size / elapsed / 1e6, count, count / elapsed / 1e6,
+           acia->rx_syscalls, acia->tx_syscalls);
+    acia_destroy(acia);
+    mmio_reset();
+    close(in_fd);
+    close(out_fd);
+}
+
+// Echo guest on the console host calls: GETCHAR, exit at end of input
+// (carry set), PUTCHAR, repeat
+static const unsigned char echo_prog[] = {
+    0x20, 0x26, 0x00,       // 0400 loop: JSR GETCHAR
+    0xB0, 0x06,             // 0403 BCS +6 (end of input)
+    0x20, 0x25, 0x00,       // 0405 JSR PUTCHAR
+    0x4C, 0x00, 0x04,       // 0408 JMP loop
+    0xA9, 0x00,             // 040B LDA #$00
+    0x20, 0x2F, 0x00,       // 040D JSR EXIT
+};
+
+// One --serve session echoing many times SESSION_INPUT_SIZE bytes: the
+// server runs in a child, the client sends and reads back at once
+static void bench_serve(void) {
+    const size_t size = 256 * 1024;
+    char path[64];
+    struct sockaddr_un addr;
+    snprintf(path, sizeof(path), "/tmp/emul6502-bench-%d.sock", (int)getpid());
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], echo_prog, sizeof(echo_prog));
+    cpu.pc = 0x400;
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, 1);
+        _exit(serve(path, &cpu));
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    double start = now();
+    while (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (now() - start > 5) {
+            printf("serve: cannot connect to %s\n", path);
+            kill(pid, SIGTERM);
+            waitpid(pid, NULL, 0);
+            exit(1);
+        }
+        usleep(1000);
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    unsigned char *sent = malloc(size);
+    unsigned char *echoed = malloc(size);
+    if (sent == NULL || echoed == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < size; i++) {
+        sent[i] = i * 7 + (i >> 8);
+    }
+    size_t out = 0;
+    size_t in = 0;
+    start = now();
+    // A session that stops reading shows up as no progress for a second
+    double progress = start;
+    while (in < size && now() - progress < 1) {
+        struct pollfd p = { fd, out < size ? POLLIN | POLLOUT : POLLIN, 0 };
+        poll(&p, 1, 100);
+        if (p.revents & POLLOUT) {
+            ssize_t n = send(fd, sent + out, size - out, MSG_NOSIGNAL);
+            if (n > 0) {
+                out += n;
+                progress = now();
+            }
+        }
+        if (p.revents & POLLIN) {
+            ssize_t n = recv(fd, echoed + in, size - in, 0);
+            if (n <= 0) {
+                break;
+            }
+            in += n;
+            progress = now();
+        }
+    }
+    double elapsed = now() - start;
+    close(fd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(path);
+
+    if (in < size || memcmp(sent, echoed, size) != 0) {
+        printf("serve: FAILED, %zu of %zu bytes sent, %zu echoed%s\n", out, size, in,
+               in == size ? " but different" : "");
+        exit(1);
+    } else {
+        printf("serve: %zu bytes echoed through one session (%zu input buffers) in %.3f s, %.2f MB/s\n", size,
+               size / SESSION_INPUT_SIZE, elapsed, size / elapsed / 1e6);
+    }
+    free(sent);
+    free(echoed);
+}
+
+// Copy filter: GETCHAR until end of input (carry set), PUTCHAR each byte
+static const unsigned char copy_prog[] = {
+    0x20, 0x26, 0x00,       // 0400 loop: JSR GETCHAR
+    0xB0, 0x06,             // 0403 BCS done (end of input)
+    0x20, 0x25, 0x00,       // 0405 JSR PUTCHAR
+    0x4C, 0x00, 0x04,       // 0408 JMP loop
+    0xA9, 0x00,             // 040B done: LDA #$00
+    0x20, 0x2F, 0x00,       // 040D JSR EXIT
+};
+
+// Filter mode I/O overhead: a file piped through the copy guest into
+// /dev/null with the large-buffer filter console
+static void bench_filter(void) {
+    const size_t size = 16 * 1024 * 1024;
+    char path[] = "/tmp/emul6502-benchXXXXXX";
+    make_data_file(path, size);
+    int in_fd = open(path, O_RDONLY);
+    int out_fd = open("/dev/null", O_WRONLY);
+    unlink(path);
+    if (in_fd < 0 || out_fd < 0) {
+        printf("filter: cannot open input/output\n");
+        exit(1);
+    }
+
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    cpu.console = filter_open(in_fd, out_fd);
+    memcpy(&memory[0x400], copy_prog, sizeof(copy_prog));
+    cpu.pc = 0x400;
+
+    double start = now();
+    unsigned long count = run_until(&cpu, 0); // runs until JSR EXIT
+    filter_close(cpu.console);
+    double elapsed = now() - start;
+
+    if (cpu.stop != CPU_HALTED) {
+        printf("filter: guest did not exit\n");
+        exit(1);
+    }
+    printf("filter: %zu bytes in %.3f s, %.2f MB/s, %lu instructions (%.1f MIPS)\n",
+           size, elapsed, size / elapsed / 1e6, count, count / elapsed / 1e6);
+    close(in_fd);
+    close(out_fd);
+}
+
+// Write a 64 KB image as raw, Intel HEX or S-record text
+static void write_image(const char *path, int format, const unsigned char *image) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("Cannot create %s\n", path);
+        exit(1);
+    }
+    if (format == LOAD_RAW) {
+        fwrite(image, 1, MEMORY_SIZE, f);
+    }
+    for (unsigned int address = 0; format != LOAD_RAW && address < MEMORY_SIZE; address += 32) {
+        unsigned int sum;
+        if (format == LOAD_IHEX) {
+            sum = 32 + (address >> 8) + (address & 0xFF);
+            fprintf(f, ":20%04X00", address);
+        } else {
+            sum = 35 + (address >> 8) + (address & 0xFF);
+            fprintf(f, "S123%04X", address);
+        }
+        for (int i = 0; i < 32; i++) {
+            fprintf(f, "%02X", image[address + i]);
+            sum += image[address + i];
+        }
+        fprintf(f, "%02X\n", format == LOAD_IHEX ? (-sum) & 0xFF : ~sum & 0xFF);
+    }
+    if (format == LOAD_IHEX) {
+        fprintf(f, ":00000001FF\n");
+    }
+    fclose(f);
+}
+
+// Time to load a full 64 KB image in each format
+static void bench_loader(void) {
+    static const struct { int format; const char *name; } formats[] = {
+        { LOAD_RAW, "raw" }, { LOAD_IHEX, "ihex" }, { LOAD_SREC, "srec" },
+    };
+    const int runs = 200;
+    unsigned char *image = malloc(MEMORY_SIZE);
+    srand(6502);
+    for (int i = 0; i < MEMORY_SIZE; i++) {
+        image[i] = rand();
+    }
+    for (int f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        char path[] = "/tmp/emul6502-benchXXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            printf("loader: cannot create %s\n", path);
+            exit(1);
+        }
+        close(fd);
+        write_image(path, formats[f].format, image);
+        unsigned short start;
+        double best = 1e9;
+        for (int i = 0; i < runs; i++) {
+            memset(memory, 0, MEMORY_SIZE);
+            double t = now();
+            if (load_program(path, memory, formats[f].format, 0, &start) < 0) {
+                exit(1);
+            }
+            t = now() - t;
+            if (t < best) {
+                best = t;
+            }
+        }
+        unlink(path);
+        if (memcmp(memory, image, MEMORY_SIZE) != 0) {
+            printf("loader: %s image loaded incorrectly\n", formats[f].name);
+            exit(1);
+        }
+        printf("loader: 64 KB %s image in %.1f us (best of %d)\n", formats[f].name, best * 1e6, runs);
+    }
+    free(image);
+}
+
+// ROM-like guest: about 5M instructions of start-up work, then prints
+// READY and waits for a line of input
+static const unsigned char slow_boot_prog[] = {
+    0xA9, 0x00,             // 0400 LDA #$00
+    0x8D, 0xF1, 0x00,       // 0402 STA $00F1
+    0xA9, 0x00,             // 0405 outer: LDA #$00
+    0x8D, 0xF0, 0x00,       // 0407 STA $00F0
+    0xA2, 0x00,             // 040A middle: LDX #$00
+    0xE8,                   // 040C inner: INX
+    0x8A,                   // 040D TXA
+    0xC9, 0x00,             // 040E CMP #$00
+    0xD0, 0x03,             // 0410 BNE +3
+    0x4C, 0x0C, 0x04,       // 0412 JMP inner
+    0xE6, 0xF0, 0xF0,       // 0415 INC $F0
+    0xAD, 0xF0, 0x00,       // 0418 LDA $00F0
+    0xC9, 0x00,             // 041B CMP #$00
+    0xD0, 0x03,             // 041D BNE +3
+    0x4C, 0x0A, 0x04,       // 041F JMP middle
+    0xE6, 0xF1, 0xF1,       // 0422 INC $F1
+    0xAD, 0xF1, 0x00,       // 0425 LDA $00F1
+    0xC9, 0x10,             // 0428 CMP #$10
+    0xD0, 0x03,             // 042A BNE +3
+    0x4C, 0x05, 0x04,       // 042C JMP outer
+    0xA9, 0x00,             // 042F prompt: LDA #$00
+    0xA2, 0x03,             // 0431 LDX #$03
+    0x20, 0x27, 0x00,       // 0433 JSR PUTS ("READY" at $0300)
+    0xA9, 0x00,             // 0436 LDA #$00
+    0xA2, 0x02,             // 0438 LDX #$02
+    0xA0, 0x40,             // 043A LDY #$40
+    0x20, 0x29, 0x00,       // 043C JSR GETS (line at $0200)
+    0x4C, 0x2F, 0x04,       // 043F JMP prompt
+};
+
+// Time to first prompt: cold start against resuming a savestate taken
+// at the prompt
+static void bench_boot(void) {
+    const int runs = 20;
+    char path[] = "/tmp/emul6502-benchXXXXXX";
+    int fd = mkstemp(path);
+    int null_fd = open("/dev/null", O_RDWR);
+    if (fd < 0 || null_fd < 0) {
+        printf("boot: cannot create %s\n", path);
+        exit(1);
+    }
+    close(fd);
+    Console *quiet = filter_open(null_fd, null_fd);
+
+    CPU6502 cpu;
+    double cold = 1e9;
+    unsigned long count = 0;
+    for (int i = 0; i < runs; i++) {
+        double t = now();
+        bench_reset(&cpu);
+        memcpy(&memory[0x400], slow_boot_prog, sizeof(slow_boot_prog));
+        strcpy((char *)&memory[0x300], "READY\r\n");
+        cpu.pc = 0x400;
+        cpu.console = savestate_ready_console(quiet);
+        count = run_until(&cpu, 0);
+        t = now() - t;
+        free(cpu.console);
+        if (t < cold) {
+            cold = t;
+        }
+    }
+    if (cpu.stop != CPU_WAIT_IO || savestate_save(path, &cpu, NULL) < 0) {
+        printf("boot: guest never reached its prompt\n");
+        exit(1);
+    }
+
+    double warm = 1e9;
+    for (int i = 0; i < runs; i++) {
+        double t = now();
+        cpu_init(&cpu);
+        if (savestate_boot(path, &cpu, NULL) < 0) {
+            exit(1);
+        }
+        cpu.console = savestate_ready_console(quiet);
+        run_until(&cpu, 0);
+        t = now() - t;
+        free(cpu.console);
+        munmap(cpu.mem - SAVESTATE_HEADER_SIZE, SAVESTATE_HEADER_SIZE + MEMORY_SIZE);
+        if (t < warm) {
+            warm = t;
+        }
+    }
+    unlink(path);
+    filter_close(quiet);
+    close(null_fd);
+    printf("boot: first prompt after %lu instructions: cold %.3f ms, from savestate %.3f ms (best of %d)\n",
+           count, cold * 1e3, warm * 1e3, runs);
+}
+
+// Savestate size and latency for one machine state
+static void savestate_report(const char *label, CPU6502 *cpu) {
+    const int runs = 100;
+    char path[] = "/tmp/emul6502-benchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("savestate: cannot create %s\n", path);
+        exit(1);
+    }
+    close(fd);
+    unsigned char *saved = malloc(MEMORY_SIZE);
+    memcpy(saved, cpu->mem, MEMORY_SIZE);
+
+    double full_save = 0, compact_save = 0, pause = 0, async_total = 0, load = 0;
+    long size = 0;
+    for (int i = 0; i < runs; i++) {
+        double t = now();
+        savestate_save(path, cpu, NULL);
+        full_save += now() - t;
+        t = now();
+        size = savestate_save_compact(path, cpu, NULL);
+        compact_save += now() - t;
+        t = now();
+        SavestateJob *job = savestate_save_async(path, cpu, NULL);
+        pause += now() - t;
+        savestate_wait(job);
+        async_total += now() - t;
+        t = now();
+        if (savestate_boot(path, cpu, NULL) < 0) {
+            exit(1);
+        }
+        load += now() - t;
+    }
+    unlink(path);
+    if (memcmp(saved, cpu->mem, MEMORY_SIZE) != 0) {
+        printf("savestate: %s state did not survive a save/load\n", label);
+        exit(1);
+    }
+    free(saved);
+    printf("savestate %s: %d bytes full, %ld bytes compact; save %.1f us full, %.1f us compact; "
+           "async pause %.1f us (done after %.1f us); compact load %.1f us\n",
+           label, SAVESTATE_HEADER_SIZE + MEMORY_SIZE, size, full_save / runs * 1e6, compact_save / runs * 1e6,
+           pause / runs * 1e6, async_total / runs * 1e6, load / runs * 1e6);
+}
+
+// Checkpoint size and save/load latency: a machine at its prompt
+// (mostly empty memory) and one with 32 KB of text and random data
+static void bench_savestate(void) {
+    static const char text[] = "10 PRINT \"HELLO, WORLD\" : GOTO 10\r\n";
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], slow_boot_prog, sizeof(slow_boot_prog));
+    strcpy((char *)&memory[0x300], "READY\r\n");
+    cpu.pc = 0x400;
+    run_until(&cpu, 0x433); // at JSR PUTS
+    savestate_report("prompt", &cpu);
+
+    srand(6502);
+    for (int i = 0x1000; i < 0x7000; i++) {
+        memory[i] = text[i % (sizeof(text) - 1)];
+    }
+    for (int i = 0x7000; i < 0x9000; i++) {
+        memory[i] = rand();
+    }
+    savestate_report("busy", &cpu);
+}
+
+// Checksum guest under the main loop's checkpoint polling; returns
+// the run time in seconds
+static double checkpoint_run(const char *data_path, Checkpoint *cp, unsigned long *count) {
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], checksum_prog, sizeof(checksum_prog));
+    strcpy((char *)&memory[0x200], data_path);
+    memory[0x281] = 0x02; // OPEN block: path $0200, mode read
+    memory[0x292] = 0x10; // READ block: buffer $1000
+    cpu.pc = 0x400;
+    unsigned int slice = CHECKPOINT_SLICE;
+    double start = now();
+    *count = 0;
+    while (cpu.pc != CHECKSUM_HALT && cpu.stop == CPU_RUNNING) {
+        execute_instruction(&cpu);
+        (*count)++;
+        if (--slice == 0) {
+            slice = CHECKPOINT_SLICE;
+            if (cp) {
+                checkpoint_poll(cp, &cpu, NULL);
+            }
+        }
+    }
+    return now() - start;
+}
+
+// Run loop slowdown and pause per checkpoint with a checkpoint due
+// every millisecond, against the same run without checkpoints
+static void bench_checkpoint(void) {
+    char data_path[] = "/tmp/emul6502-benchXXXXXX";
+    char path[] = "/tmp/emul6502-checkpointXXXXXX";
+    make_data_file(data_path, 2 * 1024 * 1024);
+    close(mkstemp(path));
+    unsigned long count;
+    double plain = checkpoint_run(data_path, NULL, &count);
+    Checkpoint *cp = checkpoint_open(path, 0.001);
+    double with = checkpoint_run(data_path, cp, &count);
+    unsigned long taken = cp->taken, skipped = cp->skipped;
+    double pause_avg = taken ? cp->pause_sum / taken : 0, pause_max = cp->pause_max;
+    checkpoint_close(cp, NULL);
+
+    // The last checkpoint must resume
+    CPU6502 resumed;
+    cpu_init(&resumed);
+    if (taken && savestate_boot(path, &resumed, NULL) < 0) {
+        printf("checkpoint: cannot resume from %s\n", path);
+        exit(1);
+    }
+    unlink(data_path);
+    unlink(path);
+    printf("checkpoint: %lu instructions, %.1f MIPS plain, %.1f MIPS checkpointing; "
+           "%lu taken, %lu skipped (writer busy); pause avg %.1f us, max %.1f us\n",
+           count, count / plain / 1e6, count / with / 1e6, taken, skipped, pause_avg * 1e6, pause_max * 1e6);
+}
+
+// Farm throughput: 2000 copy-guest jobs of 4 KB input each, from one
+// thread up to one per core
+static void bench_farm(void) {
+    const int jobs = 2000;
+    const size_t size = 4096;
+    unsigned char *input = malloc(size);
+    srand(6502);
+    for (size_t i = 0; i < size; i++) {
+        input[i] = rand();
+    }
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], copy_prog, sizeof(copy_prog));
+    Farm *farm = farm_create();
+    int image = farm_add_image(farm, "copy", memory, 0x400);
+    for (int i = 0; i < jobs; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "%d", i);
+        farm_add_job(farm, name, image, input, size, FARM_DEFAULT_BUDGET);
+    }
+    int cores = farm_threads();
+    double single = 0;
+    for (int threads = 1;; threads *= 2) {
+        if (threads > cores) {
+            threads = cores;
+        }
+        double elapsed = farm_run(farm, threads);
+        for (int i = 0; i < jobs; i++) {
+            FarmJob *job = &farm->jobs[i];
+            if (job->stop != CPU_HALTED || job->output_len != size || memcmp(job->output, input, size) != 0) {
+                printf("farm: job %d went wrong\n", i);
+                exit(1);
+            }
+        }
+        if (threads == 1) {
+            single = elapsed;
+        }
+        printf("farm: %d jobs on %d threads in %.3f s, %.0f jobs/s, speedup %.2fx\n", jobs, threads, elapsed,
+               jobs / elapsed, single / elapsed);
+        if (threads == cores) {
+            break;
+        }
+    }
+    farm_free(farm);
+    free(input);
+}
+
+// Memory walker: adds up $1000-$4FFF (16 KB) twice through LDA ($F0),X
+// and exits with the sum, so every job works on its own 16 KB of data
+static const unsigned char memsum_prog[] = {
+    0xA0, 0x00,             // 0400 LDY #$00 (pass)
+    0xA9, 0x10,             // 0402 pass: LDA #$10
+    0x8D, 0xF1, 0x00,       // 0404 STA $00F1 (pointer = $1000)
+    0xA9, 0x00,             // 0407 LDA #$00
+    0x8D, 0xF0, 0x00,       // 0409 STA $00F0
+    0xA2, 0x00,             // 040C page: LDX #$00
+    0xA1, 0xF0,             // 040E byte: LDA ($F0),X
+    0x8D, 0x17, 0x04,       // 0410 STA $0417 (ADC operand)
+    0xAD, 0xF2, 0x00,       // 0413 LDA $00F2
+    0x69, 0x00,             // 0416 ADC #byte
+    0x8D, 0xF2, 0x00,       // 0418 STA $00F2
+    0xE8,                   // 041B INX
+    0x8A,                   // 041C TXA
+    0xC9, 0x00,             // 041D CMP #$00
+    0xD0, 0x03,             // 041F BNE +3 (page done)
+    0x4C, 0x0E, 0x04,       // 0421 JMP byte
+    0xE6, 0xF1, 0xF1,       // 0424 INC $F1 (operand fetched twice)
+    0xAD, 0xF1, 0x00,       // 0427 LDA $00F1
+    0xC9, 0x50,             // 042A CMP #$50
+    0xD0, 0x03,             // 042C BNE +3 (all pages done)
+    0x4C, 0x0C, 0x04,       // 042E JMP page
+    0xC8,                   // 0431 INY
+    0x98,                   // 0432 TYA
+    0xC9, 0x02,             // 0433 CMP #$02
+    0xD0, 0x03,             // 0435 BNE +3 (both passes done)
+    0x4C, 0x02, 0x04,       // 0437 JMP pass
+    0xAD, 0xF2, 0x00,       // 043A LDA $00F2
+    0x20, 0x2F, 0x00,       // 043D JSR EXIT
+};
+
+// One thread running 64 memory walkers one after another (width 1)
+// against several in flight with short slices and prefetching
+static void bench_interleave(void) {
+    static const int widths[] = { 1, 2, 4, 8, 16 };
+    static const unsigned long slices[] = { 64, 1024, 16384 };
+    const int jobs = 64;
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], memsum_prog, sizeof(memsum_prog));
+    srand(6502);
+    unsigned char sum = 0;
+    for (int i = 0x1000; i < 0x5000; i++) {
+        memory[i] = rand();
+        sum += memory[i] * 2;
+    }
+    Farm *farm = farm_create();
+    int image = farm_add_image(farm, "memsum", memory, 0x400);
+    for (int i = 0; i < jobs; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "%d", i);
+        farm_add_job(farm, name, image, NULL, 0, FARM_DEFAULT_BUDGET);
+    }
+    for (int w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        for (int s = 0; s < sizeof(slices) / sizeof(slices[0]); s++) {
+            if (widths[w] == 1 && s > 0) {
+                break; // the slice does not matter with one job in flight
+            }
+            farm->width = widths[w];
+            farm->slice = slices[s];
+            double elapsed = farm_run(farm, 1);
+            unsigned long count = 0;
+            for (int i = 0; i < jobs; i++) {
+                if (farm->jobs[i].stop != CPU_HALTED || farm->jobs[i].exit_code != sum) {
+                    printf("interleave: job %d went wrong\n", i);
+                    exit(1);
+                }
+                count += farm->jobs[i].instructions;
+            }
+            if (widths[w] == 1) {
+                printf("interleave: width  1 (one after another): %.1f MIPS\n", count / elapsed / 1e6);
+            } else {
+                printf("interleave: width %2d, slice %5lu: %.1f MIPS\n", widths[w], slices[s], count / elapsed / 1e6);
+            }
+        }
+    }
+    farm_free(farm);
+}
+
+// Parameter sweep guest: 16 passes of X = 1..256 with some register
+// work, remembering X when it equals the lane's parameter at $0301.
+// The parameter is patched into a CMP operand, so lanes run slightly
+// different code, and the STX only runs on the lanes that match.
+// Exits with the parameter.
+static const unsigned char sweep_prog[] = {
+    0xA2, 0x00,             // 0400 LDX #$00
+    0xA0, 0x00,             // 0402 LDY #$00
+    0xE8,                   // 0404 loop: INX
+    0x8A,                   // 0405 TXA
+    0x69, 0x07,             // 0406 ADC #$07
+    0x8D, 0x00, 0x03,       // 0408 STA $0300
+    0xAD, 0x01, 0x03,       // 040B LDA $0301 (parameter)
+    0x8D, 0x13, 0x04,       // 040E STA $0413 (CMP operand)
+    0x8A,                   // 0411 TXA
+    0xC9, 0x00,             // 0412 CMP #parameter
+    0xF0, 0x03,             // 0414 BEQ +3 (taken when not equal)
+    0x9E, 0x02, 0x03,       // 0416 STX $0302
+    0x8A,                   // 0419 TXA
+    0xC9, 0x00,             // 041A CMP #$00
+    0xD0, 0x03,             // 041C BNE +3 (X wrapped)
+    0x4C, 0x04, 0x04,       // 041E JMP loop
+    0xC8,                   // 0421 INY
+    0x98,                   // 0422 TYA
+    0xC9, 0x10,             // 0423 CMP #$10
+    0xD0, 0x03,             // 0425 BNE +3 (16 passes done)
+    0x4C, 0x04, 0x04,       // 0427 JMP loop
+    0xAD, 0x02, 0x03,       // 042A LDA $0302
+    0x20, 0x2F, 0x00,       // 042D JSR EXIT
+};
+
+// Lockstep batch against the same lanes run one after the other by
+// the interpreter
+static void bench_batch(void) {
+    static const int sizes[] = { 8, 32, 256 };
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], sweep_prog, sizeof(sweep_prog));
+    static unsigned char image[MEMORY_SIZE];
+    for (int n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++) {
+        int lanes = sizes[n];
+        unsigned long count = 0;
+        double start = now();
+        for (int i = 0; i < lanes; i++) {
+            memcpy(image, memory, MEMORY_SIZE);
+            image[0x301] = i * 7;
+            cpu_init(&cpu);
+            cpu.mem = image;
+            cpu.pc = 0x400;
+            while (cpu.stop == CPU_RUNNING) {
+                execute_instruction(&cpu);
+                count++;
+            }
+        }
+        double scalar = now() - start;
+
+        Batch *b = batch_create(lanes, memory, 0x400);
+        for (int i = 0; i < lanes; i++) {
+            b->cpu[i].mem[0x301] = i * 7;
+        }
+        start = now();
+        batch_run(b, ~0UL);
+        double batched = now() - start;
+        for (int i = 0; i < lanes; i++) {
+            if (b->cpu[i].stop != CPU_HALTED || b->cpu[i].a != (unsigned char)(i * 7)) {
+                printf("batch: lane %d stopped (%d) at $%04X with A = $%02X\n", i, b->cpu[i].stop, b->cpu[i].pc, b->cpu[i].a);
+                exit(1);
+            }
+        }
+        if (b->lane_steps != count) {
+            printf("batch: %lu lane instructions, interpreter ran %lu\n", b->lane_steps, count);
+            exit(1);
+        }
+        printf("batch %s, %d lanes: %.1f MIPS scalar, %.1f MIPS lockstep (%.2fx); "
+               "%.1f lanes per step, %lu splits, %.1f%% lane instructions interpreted\n",
+               batch_isa(), lanes, count / scalar / 1e6, count / batched / 1e6, scalar / batched,
+               (double)b->lane_steps / b->steps, b->splits, 100.0 * b->scalar_steps / b->lane_steps);
+        batch_free(b);
+    }
+}
+
+// Parser guest for the fuzzing benchmarks: counts the 'A's of its
+// input and exits with the count
+static const unsigned char count_prog[] = {
+    0x20, 0x26, 0x00,       // 0400 loop: JSR GETCHAR
+    0xB0, 0x0A,             // 0403 BCS done (end of input)
+    0xC9, 0x41,             // 0405 CMP #'A'
+    0xF0, 0x03,             // 0407 BEQ next (taken when not equal)
+    0xE6, 0xF0, 0xF0,       // 0409 INC $F0 (operand fetched twice)
+    0x4C, 0x00, 0x04,       // 040C next: JMP loop
+    0xAD, 0xF0, 0x00,       // 040F done: LDA $00F0
+    0x20, 0x2F, 0x00,       // 0412 JSR EXIT
+};
+
+// Inputs per second for a fresh process per input (what AFL does
+// without a fork server), a fork of the loaded machine per input (fork
+// server) and an in-process reset per input (persistent mode)
+static void bench_fuzz(void) {
+    const int runs = 200, persistent_runs = 200000;
+    unsigned char input[64];
+    char prog_path[] = "/tmp/emul6502-fuzzXXXXXX";
+    char input_path[] = "/tmp/emul6502-inputXXXXXX";
+    int prog_fd = mkstemp(prog_path);
+    int input_fd = mkstemp(input_path);
+    int null_fd = open("/dev/null", O_WRONLY);
+    srand(6502);
+    for (int i = 0; i < sizeof(input); i++) {
+        input[i] = 'A' + rand() % 4;
+    }
+    if (prog_fd < 0 || input_fd < 0 || null_fd < 0 ||
+        write(prog_fd, count_prog, sizeof(count_prog)) != sizeof(count_prog) ||
+        write(input_fd, input, sizeof(input)) != sizeof(input)) {
+        printf("fuzz: cannot create the program and input files\n");
+        exit(1);
+    }
+    close(prog_fd);
+
+    double start = now();
+    for (int i = 0; i < runs; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            lseek(input_fd, 0, SEEK_SET);
+            dup2(input_fd, 0);
+            dup2(null_fd, 1);
+            execl("/proc/self/exe", "main", "--filter", "--at", "400", prog_path, (char *)NULL);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    double spawn = (now() - start) / runs;
+    unlink(prog_path);
+    unlink(input_path);
+    close(input_fd);
+    close(null_fd);
+
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], count_prog, sizeof(count_prog));
+    cpu.pc = 0x400;
+    static FuzzTarget target;
+    fuzz_init(&target, &cpu, FUZZ_DEFAULT_BUDGET);
+    start = now();
+    for (int i = 0; i < runs; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            fuzz_run(&target, input, sizeof(input));
+            _exit(cpu.a);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    double forked = (now() - start) / runs;
+
+    int expected = -1;
+    start = now();
+    for (int i = 0; i < persistent_runs; i++) {
+        fuzz_run(&target, input, sizeof(input));
+        if (expected < 0) {
+            expected = cpu.a;
+        } else if (cpu.a != expected || cpu.stop != CPU_HALTED) {
+            printf("fuzz: run %d did not repeat the first one\n", i);
+            exit(1);
+        }
+        fuzz_reset(&target);
+    }
+    double persistent = (now() - start) / persistent_runs;
+    printf("fuzz: %.0f execs/s new process, %.0f execs/s fork server, %.0f execs/s persistent "
+           "(%.1f pages reset per input)\n",
+           1 / spawn, 1 / forked, 1 / persistent, (double)target.pages_reset / persistent_runs);
+}
+
+// Crashes (opcode $FF) on input starting with "FUZZ", one byte
+// compared per branch, so coverage feedback can find it byte by byte
+static const unsigned char magic_prog[] = {
+    0x20, 0x26, 0x00,       // 0400 JSR GETCHAR
+    0xB0, 0x20,             // 0403 BCS done
+    0xC9, 0x46,             // 0405 CMP #'F'
+    0xF0, 0x1C,             // 0407 BEQ done (taken when not equal)
+    0x20, 0x26, 0x00,       // 0409 JSR GETCHAR
+    0xB0, 0x17,             // 040C BCS done
+    0xC9, 0x55,             // 040E CMP #'U'
+    0xF0, 0x13,             // 0410 BEQ done
+    0x20, 0x26, 0x00,       // 0412 JSR GETCHAR
+    0xB0, 0x0E,             // 0415 BCS done
+    0xC9, 0x5A,             // 0417 CMP #'Z'
+    0xF0, 0x0A,             // 0419 BEQ done
+    0x20, 0x26, 0x00,       // 041B JSR GETCHAR
+    0xB0, 0x05,             // 041E BCS done
+    0xC9, 0x5A,             // 0420 CMP #'Z'
+    0xF0, 0x01,             // 0422 BEQ done
+    0xFF,                   // 0424 crash
+    0xA9, 0x00,             // 0425 done: LDA #$00
+    0x20, 0x2F, 0x00,       // 0427 JSR EXIT
+};
+
+// Cost of the edge map on a branchy loop, then the built-in fuzzer
+// against magic_prog until it finds the crash
+static void bench_coverage(void) {
+    static unsigned char map[COVERAGE_MAP_SIZE];
+    double mips[2];
+    for (int with = 0; with < 2; with++) {
+        CPU6502 cpu;
+        bench_reset(&cpu);
+        memcpy(&memory[0x400], memsum_prog, sizeof(memsum_prog));
+        cpu.pc = 0x400;
+        cpu.coverage = with ? map : NULL;
+        double start = now();
+        unsigned long count = run_until(&cpu, 0);
+        mips[with] = count / (now() - start) / 1e6;
+    }
+    printf("coverage: %.1f MIPS without the edge map, %.1f MIPS with it\n", mips[0], mips[1]);
+
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], magic_prog, sizeof(magic_prog));
+    cpu.pc = 0x400;
+    static FuzzTarget target;
+    fuzz_init(&target, &cpu, FUZZ_DEFAULT_BUDGET);
+    FuzzCampaign campaign = { NULL, NULL, 5000000, 1, 0 };
+    fuzz_campaign(&target, &campaign);
+    if (campaign.crashes == 0) {
+        printf("coverage: no crash in %lu runs\n", campaign.runs);
+        exit(1);
+    }
+    printf("coverage: fuzzer found the crash after %lu runs in %.2f s, %.0f execs/s, %lu edges (%.1f new edges/s), "
+           "corpus %d\n",
+           campaign.runs, campaign.elapsed, campaign.runs / campaign.elapsed, campaign.edges,
+           campaign.edges / campaign.elapsed, campaign.corpus);
+}
+
+// The copy guest on 4 MB of input: live, recording every input, then
+// replaying the log with no input attached
+static void bench_replay(void) {
+    static const char *modes[] = { "live", "record", "replay" };
+    const size_t size = 4 * 1024 * 1024;
+    char path[] = "/tmp/emul6502-benchXXXXXX";
+    char log_path[] = "/tmp/emul6502-logXXXXXX";
+    make_data_file(path, size);
+    close(mkstemp(log_path));
+    double base = 0;
+    for (int mode = 0; mode < 3; mode++) {
+        int in_fd = open(mode == 2 ? "/dev/null" : path, O_RDONLY);
+        int out_fd = open("/dev/null", O_WRONLY);
+        CPU6502 cpu;
+        bench_reset(&cpu);
+        Console *filter = filter_open(in_fd, out_fd);
+        Replay *replay = NULL;
+        if (mode == 1) {
+            replay = replay_record(log_path);
+        } else if (mode == 2) {
+            replay = replay_open(log_path);
+        }
+        cpu.console = replay ? replay_console(replay, filter) : filter;
+        memcpy(&memory[0x400], copy_prog, sizeof(copy_prog));
+        cpu.pc = 0x400;
+
+        double start = now();
+        unsigned long count = run_until(&cpu, 0);
+        if (replay) {
+            replay_close(replay, NULL);
+        }
+        filter_close(filter);
+        double elapsed = now() - start;
+        close(in_fd);
+        close(out_fd);
+        if (cpu.stop != CPU_HALTED) {
+            printf("replay: guest did not exit\n");
+            exit(1);
+        }
+        if (mode == 0) {
+            base = elapsed;
+        }
+        struct stat st;
+        stat(log_path, &st);
+        printf("replay: %-6s %zu bytes in %.3f s, %.1f MIPS (%+.0f%%)", modes[mode], size, elapsed,
+               count / elapsed / 1e6, (elapsed / base - 1) * 100);
+        if (mode == 1) {
+            printf(", log %ld bytes", (long)st.st_size);
+        }
+        printf("\n");
+    }
+    unlink(path);
+    unlink(log_path);
+}
+
+// Endless writer: stores a counter to every byte of $1000-$4FFF in
+// turn, moving the STA operand forward itself; the values differ from
+// one sweep to the next
+static const unsigned char scribble_prog[] = {
+    0xAD, 0xF0, 0x00,       // 0400 loop: LDA $00F0 (counter)
+    0x8D, 0x00, 0x10,       // 0403 STA $1000
+    0xE6, 0xF0, 0xF0,       // 0406 INC $F0
+    0xAD, 0x04, 0x04,       // 0409 LDA $0404 (operand low byte)
+    0x69, 0x01,             // 040C ADC #$01
+    0x8D, 0x04, 0x04,       // 040E STA $0404
+    0xC9, 0x00,             // 0411 CMP #$00
+    0xD0, 0x03,             // 0413 BNE +3 (low byte wrapped)
+    0x4C, 0x00, 0x04,       // 0415 JMP loop
+    0xAD, 0x05, 0x04,       // 0418 LDA $0405 (operand high byte)
+    0x69, 0x01,             // 041B ADC #$01
+    0xC9, 0x50,             // 041D CMP #$50
+    0xD0, 0x03,             // 041F BNE +3 (past $4FFF)
+    0x4C, 0x29, 0x04,       // 0421 JMP high
+    0xE6, 0xF0, 0xF0,       // 0424 INC $F0 (shift the next sweep)
+    0xA9, 0x10,             // 0427 LDA #$10
+    0x8D, 0x05, 0x04,       // 0429 high: STA $0405
+    0x4C, 0x00, 0x04,       // 042C JMP loop
+};
+
+// Cost of recording history on a guest that dirties 16 KB over and
+// over, then how long going back takes
+static void bench_history(void) {
+    const unsigned long total = 100000000;
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], scribble_prog, sizeof(scribble_prog));
+    cpu.pc = 0x400;
+    double start = now();
+    for (unsigned long i = 0; i < total; i++) {
+        execute_instruction(&cpu);
+    }
+    double plain = now() - start;
+
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], scribble_prog, sizeof(scribble_prog));
+    cpu.pc = 0x400;
+    TimeTravel *tt = timetravel_open(&cpu, TIMETRAVEL_DEFAULT_BUDGET);
+    start = now();
+    timetravel_run(tt, total);
+    double recorded = now() - start;
+    printf("history: %.1f MIPS plain, %.1f MIPS recording (%+.1f%%): %d snapshots %lu apart, %zu KB of pages\n",
+           total / plain / 1e6, total / recorded / 1e6, (recorded / plain - 1) * 100, tt->snapshots, tt->interval,
+           tt->bytes / 1024);
+
+    static const unsigned long steps[] = { 1, 1000, 1000000, 50000000 };
+    for (int i = 0; i < 4; i++) {
+        start = now();
+        timetravel_step_back(tt, steps[i]);
+        double elapsed = now() - start;
+        printf("history: step back %lu in %.2f ms\n", steps[i], elapsed * 1e3);
+        timetravel_goto(tt, total);
+    }
+    start = now();
+    long found = timetravel_last_write(tt, 0x1234);
+    printf("history: last store to $1234 (%lu instructions back) found in %.2f ms\n", total - found,
+           (now() - start) * 1e3);
+    timetravel_close(tt, NULL);
+}
+
+// Plain run against a streamed trace and a flight recorder of the last
+// million instructions, then seeks into the streamed trace
+static void bench_trace(void) {
+    static const unsigned long rings[] = { 0, 1024 * 1024 };
+    const unsigned long total = 50000000;
+    CPU6502 cpu;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], scribble_prog, sizeof(scribble_prog));
+    cpu.pc = 0x400;
+    double start = now();
+    for (unsigned long i = 0; i < total; i++) {
+        execute_instruction(&cpu);
+    }
+    double plain = now() - start;
+    printf("trace: %.1f MIPS plain\n", total / plain / 1e6);
+    for (int i = 1; i >= 0; i--) {
+        bench_reset(&cpu);
+        memcpy(&memory[0x400], scribble_prog, sizeof(scribble_prog));
+        cpu.pc = 0x400;
+        Trace *t = trace_open("/tmp/bench.trc", rings[i]);
+        if (t == NULL) {
+            return;
+        }
+        start = now();
+        for (unsigned long n = 0; n < total; n++) {
+            trace_step(t, &cpu);
+            execute_instruction(&cpu);
+        }
+        unsigned long waits = t->waits;
+        trace_close(t, NULL);
+        double traced = now() - start;
+        struct stat st;
+        stat("/tmp/bench.trc", &st);
+        unsigned long records = rings[i] ? rings[i] : total;
+        printf("trace: %.1f MIPS %s (%.2fx slower), %lld KB written (%.2f bytes per instruction), "
+               "run loop waited %lu times\n", total / traced / 1e6, rings[i] ? "flight recorder" : "streaming",
+               traced / plain, (long long)st.st_size >> 10, (double)st.st_size / records, waits);
+    }
+
+    TraceReader *r = trace_reader_open("/tmp/bench.trc");
+    if (r == NULL) {
+        return;
+    }
+    TraceRecord rec;
+    unsigned long long count;
+    const int seeks = 1000;
+    srand(1);
+    start = now();
+    for (int i = 0; i < seeks; i++) {
+        trace_reader_seek(r, (unsigned long long)rand() * rand() % total);
+        trace_reader_next(r, &rec, &count);
+    }
+    printf("trace: seek to a random instruction in %.0f us\n", (now() - start) / seeks * 1e6);
+    start = now();
+    trace_reader_seek(r, total / 2);
+    unsigned long found = 0;
+    while (found < 1000 && trace_reader_find(r, 0x400, &rec, &count) > 0) {
+        found++;
+    }
+    printf("trace: %lu instructions at $0400 from the middle in %.1f ms\n", found, (now() - start) * 1e3);
+    trace_reader_close(r);
+    unlink("/tmp/bench.trc");
+}
+
+// Throughput with conditions that are anchored away from the hot code,
+// anchored in it, watched through stores and evaluated every instruction
+static void bench_breakpoint(void) {
+    static const char *const conditions[][2] = {
+        { "none", NULL },
+        { "anchored elsewhere", "PC == $3000 && A == $41" },
+        { "anchored in the loop", "PC == $0400 && mem[$F0] == $FF && A == 1" },
+        { "store watch", "mem[$00F0] == $FF" },
+        { "every instruction", "A == $41 && X == 1" },
+    };
+    const unsigned long total = 50000000;
+    CPU6502 cpu;
+    static Breakpoints b;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], scribble_prog, sizeof(scribble_prog));
+    cpu.pc = 0x400;
+    double start = now();
+    for (unsigned long i = 0; i < total; i++) {
+        execute_instruction(&cpu);
+    }
+    double plain = now() - start;
+    printf("breakpoint: %.1f MIPS plain\n", total / plain / 1e6);
+    for (int i = 0; i < sizeof(conditions) / sizeof(conditions[0]); i++) {
+        char error[128];
+        bench_reset(&cpu);
+        memcpy(&memory[0x400], scribble_prog, sizeof(scribble_prog));
+        cpu.pc = 0x400;
+        breakpoints_init(&b);
+        if (conditions[i][1] && breakpoint_add(&b, conditions[i][1], BREAK_WHEN, &cpu, error, sizeof(error)) < 0) {
+            printf("breakpoint: %s\n", error);
+            return;
+        }
+        // Resume after every hit until all the instructions have run
+        unsigned long left = total;
+        int resume = 0;
+        start = now();
+        while (left > 0) {
+            resume = breakpoints_run(&b, &cpu, NULL, left, resume) == BREAK_HIT;
+            left -= b.ran;
+        }
+        double elapsed = now() - start;
+        Breakpoint *bp = &b.list[0];
+        printf("breakpoint: %.1f MIPS %s (%+.1f%%)", total / elapsed / 1e6, conditions[i][0], (elapsed / plain - 1) * 100);
+        if (conditions[i][1]) {
+            printf(", %lu evaluations (%.0f ns each), %lu hits", bp->evaluations,
+                   bp->timed ? bp->seconds / bp->timed * 1e9 : 0, bp->hits);
+        }
+        if (conditions[i][1] && bp->hits) {
+            double each = bp->timed ? bp->seconds / bp->timed : 0;
+            printf(", %.0f ns of evaluation per hit", each * bp->evaluations / bp->hits * 1e9);
+        }
+        printf("\n");
+    }
+}
+
+// Full 64 KB hex dump (printf per byte as dump_memory did, against one
+// buffered write) and snapshot diffs with a few changed lines
+static void bench_memview(void) {
+    static unsigned char before[MEMORY_SIZE];
+    static unsigned char after[MEMORY_SIZE];
+    unsigned long long changed[MEMVIEW_LINES / 64];
+    const int diffs = 10000;
+    FILE *out = fopen("/dev/null", "w");
+    if (out == NULL) {
+        perror("/dev/null");
+        return;
+    }
+    for (unsigned int i = 0; i < MEMORY_SIZE; i++) {
+        before[i] = after[i] = i * 7 + (i >> 8);
+    }
+    after[0x0200] ^= 1;
+    after[0x4321] ^= 0x80;
+    after[0xFFFF] = 0;
+    double start = now();
+    for (unsigned int i = 0; i < MEMORY_SIZE; i++) {
+        if ((i % 16) == 0) {
+            fprintf(out, "%04X: ", i);
+        }
+        fprintf(out, "%02X ", before[i]);
+        if ((i % 16) == 15) {
+            fprintf(out, "\n");
+        }
+    }
+    fflush(out);
+    double per_byte = now() - start;
+    start = now();
+    memview_dump(out, before, 0, MEMORY_SIZE - 1);
+    fflush(out);
+    double buffered = now() - start;
+    printf("memview: 64 KB dump %.2f ms with printf per byte, %.2f ms buffered (%.0fx)\n", per_byte * 1e3,
+           buffered * 1e3, per_byte / buffered);
+    int count = 0;
+    start = now();
+    for (int i = 0; i < diffs; i++) {
+        count = memview_changed(before, after, changed);
+    }
+    double compare = (now() - start) / diffs;
+    start = now();
+    for (int i = 0; i < diffs / 10; i++) {
+        memview_diff(out, before, after);
+    }
+    double diff = (now() - start) / (diffs / 10);
+    printf("memview: 64 KB compare %.1f us (%.1f GB/s), diff of %d lines %.1f us\n", compare * 1e6,
+           MEMORY_SIZE / compare / 1e9, count, diff * 1e6);
+    fclose(out);
+}
+
+// Side-by-side runs of the reference and batch engines: a long program
+// against the reference alone, and random programs per second
+static void bench_difftest(void) {
+    const unsigned long total = 10000000;
+    const int programs = 2000;
+    CPU6502 cpu;
+    DiffResult result;
+    FILE *out = fopen("/dev/null", "w");
+    if (out == NULL) {
+        perror("/dev/null");
+        return;
+    }
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], scribble_prog, sizeof(scribble_prog));
+    cpu.pc = 0x400;
+    double start = now();
+    for (unsigned long i = 0; i < total; i++) {
+        execute_instruction(&cpu);
+    }
+    double plain = now() - start;
+    bench_reset(&cpu);
+    memcpy(&memory[0x400], scribble_prog, sizeof(scribble_prog));
+    cpu.pc = 0x400;
+    unsigned long intervals[] = { 1000, DIFFTEST_DEFAULT_INTERVAL, 100000 };
+    for (int i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+        start = now();
+        difftest_run("batch", &cpu, NULL, 0, intervals[i], total, out, &result);
+        double elapsed = now() - start;
+        printf("difftest: every %lu, %.1f M instructions/s per engine (reference alone %.1f), %lu checks\n",
+               intervals[i], total / elapsed / 1e6, total / plain / 1e6, result.checks);
+    }
+    start = now();
+    difftest_random("batch", 1, programs, DIFFTEST_DEFAULT_INTERVAL, out);
+    double elapsed = now() - start;
+    printf("difftest: %.0f random programs/s\n", programs / elapsed);
+    fclose(out);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+    { "fileio", bench_fileio },
+    { "acia", bench_acia },
+    { "serve", bench_serve },
+    { "filter", bench_filter },
+    { "loader", bench_loader },
+    { "boot", bench_boot },
+    { "savestate", bench_savestate },
+    { "checkpoint", bench_checkpoint },
+    { "farm", bench_farm },
+    { "batch", bench_batch },
+    { "interleave", bench_interleave },
+    { "fuzz", bench_fuzz },
+    { "coverage", bench_coverage },
+    { "replay", bench_replay },
+    { "history", bench_history },
+    { "trace", bench_trace },
+    { "breakpoint", bench_breakpoint },
+    { "memview", bench_memview },
+    { "difftest", bench_difftest },
+};
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+int bench_main(int argc, char **argv) {
+    for (int i = 0; i < BENCHMARK_COUNT; i++) {
+        int selected = (argc == 0);
+        for (int j = 0; j < argc; j++) {
+            if (strcmp(argv[j], benchmarks[i].name) == 0) {
+                selected = 1;
+            }
+        }
+        if (selected) {
+            benchmarks[i].run();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+/*6502 emul - benchmarks*/
+#ifndef BENCH_H
+#define BENCH_H
+// ./main --bench [name ...] runs the named benchmarks (all when empty)
+int bench_main(int argc, char **argv);
+#endif
@@ -0,0 +1,865 @@
+/*6502 emul - breakpoints, compiled conditions and watch expressions*/
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hostcall.h"
+#include "breakpoint.h"
+
+// Bytecode: operands follow the opcode, little endian
+enum {
+    OP_END,
+    OP_CONST,  // 4-byte value
+    OP_REG,    // register number
+    OP_MEM,    // replace the top with the byte at that address
+    OP_MEMC,   // 2-byte address
+    OP_NOT,
+    OP_NEG,
+    OP_INV,
+    OP_MUL,
+    OP_ADD,
+    OP_SUB,
+    OP_AND,
+    OP_XOR,
+    OP_OR,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_JFALSE, // 1-byte target: jump keeping a 0 on top, else pop
+    OP_JTRUE,  // 1-byte target: jump leaving 1 on top, else pop
+    OP_BOOL,
+};
+
+enum { REG_A, REG_X, REG_Y, REG_SP, REG_P, REG_PC, REG_DEPTH };
+static const char *const reg_names[] = { "a", "x", "y", "sp", "p", "pc", "depth" };
+
+static double monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Compiler: recursive descent, one function per precedence level
+
+typedef struct {
+    const char *s;
+    BreakCondition *cond;
+    int depth; // values on the stack when the code so far runs
+    int regs;  // reads a register
+    int alternatives; // || at the top level
+    int simple;       // the terms so far are comparisons (BreakTest)
+    const char *error;
+} Parser;
+
+static void emit(Parser *p, unsigned char byte) {
+    if (p->cond->len == BREAK_CODE_SIZE) {
+        p->error = "expression too long";
+        return;
+    }
+    p->cond->code[p->cond->len++] = byte;
+}
+
+static void push(Parser *p) {
+    if (++p->depth > BREAK_STACK_SIZE) {
+        p->error = "expression too deep";
+    }
+}
+
+static void emit_const(Parser *p, int value) {
+    emit(p, OP_CONST);
+    for (int i = 0; i < 4; i++) {
+        emit(p, value >> (8 * i));
+    }
+    push(p);
+}
+
+// Value of the code from start on when it is a single constant
+static int constant(Parser *p, unsigned int start, int *value) {
+    const unsigned char *code = p->cond->code + start;
+    if (p->cond->len != start + 5 || code[0] != OP_CONST) {
+        return 0;
+    }
+    *value = code[1] | code[2] << 8 | code[3] << 16 | (unsigned int)code[4] << 24;
+    return 1;
+}
+
+// Replace the code from start on with a constant
+static void fold(Parser *p, unsigned int start, int value, int values) {
+    p->cond->len = start;
+    p->depth -= values;
+    emit_const(p, value);
+}
+
+static int apply(unsigned char op, int a, int b) {
+    switch (op) {
+        case OP_MUL:
+            return a * b;
+        case OP_ADD:
+            return a + b;
+        case OP_SUB:
+            return a - b;
+        case OP_AND:
+            return a & b;
+        case OP_XOR:
+            return a ^ b;
+        case OP_OR:
+            return a | b;
+        case OP_EQ:
+            return a == b;
+        case OP_NE:
+            return a != b;
+        case OP_LT:
+            return a < b;
+        case OP_LE:
+            return a <= b;
+        case OP_GT:
+            return a > b;
+        default:
+            return a >= b;
+    }
+}
+
+static void skip_space(Parser *p) {
+    while (isspace((unsigned char)*p->s)) {
+        p->s++;
+    }
+}
+
+// Consume op if it comes next (and is not the start of a longer one)
+static int accept(Parser *p, const char *op) {
+    size_t n = strlen(op);
+    skip_space(p);
+    if (strncmp(p->s, op, n) != 0) {
+        return 0;
+    }
+    if (n == 1 && ((strchr("&|", op[0]) && p->s[1] == op[0]) || (strchr("<>!=", op[0]) && p->s[1] == '='))) {
+        return 0;
+    }
+    p->s += n;
+    return 1;
+}
+
+static void parse_or(Parser *p);
+
+static void parse_primary(Parser *p) {
+    skip_space(p);
+    if (accept(p, "(")) {
+        parse_or(p);
+        if (!accept(p, ")")) {
+            p->error = "missing )";
+        }
+        return;
+    }
+    if (*p->s == '$' || isdigit((unsigned char)*p->s)) {
+        char *end;
+        long value;
+        if (*p->s == '$') {
+            value = strtol(p->s + 1, &end, 16);
+        } else {
+            value = strtol(p->s, &end, p->s[0] == '0' && tolower((unsigned char)p->s[1]) == 'x' ? 16 : 10);
+        }
+        if (end == p->s + 1 && *p->s == '$') {
+            p->error = "bad number";
+            return;
+        }
+        p->s = end;
+        emit_const(p, value);
+        return;
+    }
+    char name[8];
+    size_t n = 0;
+    while (isalpha((unsigned char)p->s[n]) && n < sizeof(name) - 1) {
+        name[n] = tolower((unsigned char)p->s[n]);
+        n++;
+    }
+    name[n] = 0;
+    if (n == 0 || isalnum((unsigned char)p->s[n])) {
+        p->error = "expected a number, register or mem[...]";
+        return;
+    }
+    p->s += n;
+    if (strcmp(name, "mem") == 0) {
+        if (!accept(p, "[")) {
+            p->error = "missing [ after mem";
+            return;
+        }
+        unsigned int start = p->cond->len;
+        parse_or(p);
+        if (!accept(p, "]")) {
+            p->error = "missing ]";
+            return;
+        }
+        BreakCondition *c = p->cond;
+        if (c->len == start + 5 && c->code[start] == OP_CONST) {
+            // Constant address: one instruction, and the condition only
+            // depends on that byte
+            unsigned short address = c->code[start + 1] | c->code[start + 2] << 8;
+            c->len = start;
+            emit(p, OP_MEMC);
+            emit(p, address);
+            emit(p, address >> 8);
+            if (c->refs < BREAK_REFS) {
+                c->ref[c->refs] = address;
+            }
+            c->refs++;
+        } else {
+            emit(p, OP_MEM);
+            c->every = 1;
+        }
+        return;
+    }
+    for (int r = 0; r < sizeof(reg_names) / sizeof(reg_names[0]); r++) {
+        if (strcmp(name, reg_names[r]) == 0) {
+            emit(p, OP_REG);
+            emit(p, r);
+            push(p);
+            p->regs = 1;
+            return;
+        }
+    }
+    p->error = "unknown name";
+}
+
+static void parse_unary(Parser *p) {
+    unsigned int start = p->cond->len;
+    unsigned char op;
+    int value;
+    if (accept(p, "!")) {
+        op = OP_NOT;
+    } else if (accept(p, "-")) {
+        op = OP_NEG;
+    } else if (accept(p, "~")) {
+        op = OP_INV;
+    } else {
+        parse_primary(p);
+        return;
+    }
+    parse_unary(p);
+    if (constant(p, start, &value)) {
+        fold(p, start, op == OP_NOT ? !value : op == OP_NEG ? -value : ~value, 1);
+    } else {
+        emit(p, op);
+    }
+}
+
+// Binary operators of one level: ops[i] compiles to codes[i]. Constant
+// operands are folded, so mem[$200 + 1] still has a constant address.
+static void parse_binary(Parser *p, void (*operand)(Parser *), const char *const *ops, const unsigned char *codes) {
+    unsigned int start = p->cond->len;
+    operand(p);
+    while (p->error == NULL) {
+        int i = 0;
+        while (ops[i] && !accept(p, ops[i])) {
+            i++;
+        }
+        if (ops[i] == NULL) {
+            return;
+        }
+        unsigned int right = p->cond->len;
+        int a;
+        int b;
+        operand(p);
+        if (constant(p, right, &b)) {
+            unsigned int end = p->cond->len;
+            p->cond->len = right;
+            if (constant(p, start, &a)) {
+                fold(p, start, apply(codes[i], a, b), 2);
+                continue;
+            }
+            p->cond->len = end;
+        }
+        emit(p, codes[i]);
+        p->depth--;
+    }
+}
+
+static void parse_mul(Parser *p) {
+    static const char *const ops[] = { "*", NULL };
+    static const unsigned char codes[] = { OP_MUL };
+    parse_binary(p, parse_unary, ops, codes);
+}
+
+static void parse_add(Parser *p) {
+    static const char *const ops[] = { "+", "-", NULL };
+    static const unsigned char codes[] = { OP_ADD, OP_SUB };
+    parse_binary(p, parse_mul, ops, codes);
+}
+
+static void parse_relational(Parser *p) {
+    static const char *const ops[] = { "<=", ">=", "<", ">", NULL };
+    static const unsigned char codes[] = { OP_LE, OP_GE, OP_LT, OP_GT };
+    parse_binary(p, parse_add, ops, codes);
+}
+
+static void parse_equality(Parser *p) {
+    static const char *const ops[] = { "==", "!=", NULL };
+    static const unsigned char codes[] = { OP_EQ, OP_NE };
+    parse_binary(p, parse_relational, ops, codes);
+}
+
+static void parse_bitand(Parser *p) {
+    static const char *const ops[] = { "&", NULL };
+    static const unsigned char codes[] = { OP_AND };
+    parse_binary(p, parse_equality, ops, codes);
+}
+
+static void parse_xor(Parser *p) {
+    static const char *const ops[] = { "^", NULL };
+    static const unsigned char codes[] = { OP_XOR };
+    parse_binary(p, parse_bitand, ops, codes);
+}
+
+static void parse_bitor(Parser *p) {
+    static const char *const ops[] = { "|", NULL };
+    static const unsigned char codes[] = { OP_OR };
+    parse_binary(p, parse_xor, ops, codes);
+}
+
+// PC == constant (either way round) compiled at code[start..]
+static long pc_test(const BreakCondition *c, unsigned int start) {
+    const unsigned char *code = c->code + start;
+    if (c->len != start + 8 || code[7] != OP_EQ) {
+        return -1;
+    }
+    if (code[0] == OP_REG && code[1] == REG_PC && code[2] == OP_CONST) {
+        return (code[3] | code[4] << 8 | code[5] << 16 | code[6] << 24) & 0x1FFFF;
+    }
+    if (code[0] == OP_CONST && code[5] == OP_REG && code[6] == REG_PC) {
+        return (code[1] | code[2] << 8 | code[3] << 16 | code[4] << 24) & 0x1FFFF;
+    }
+    return -1;
+}
+
+// The term compiled at code[start..] as a BreakTest: a register or
+// mem[constant] compared with a constant, either way round
+static int simple_test(const BreakCondition *c, unsigned int start, BreakTest *t) {
+    // Comparisons with the operands swapped: a < b is b > a
+    static const unsigned char swapped[] = { [OP_EQ] = OP_EQ, [OP_NE] = OP_NE, [OP_LT] = OP_GT,
+                                              [OP_LE] = OP_GE, [OP_GT] = OP_LT, [OP_GE] = OP_LE };
+    const unsigned char *code = c->code + start;
+    unsigned int n = c->len - start;
+    unsigned char op = code[n - 1];
+    unsigned int load = 0; // offset of the register or memory operand
+    if (n < 8 || op < OP_EQ || op > OP_GE) {
+        return 0;
+    }
+    if (code[0] == OP_CONST) {
+        load = 5;
+        op = swapped[op];
+    } else if (code[n - 6] != OP_CONST) {
+        return 0;
+    }
+    const unsigned char *value = code[0] == OP_CONST ? code + 1 : code + n - 5;
+    if (code[load] == OP_REG && n == 8) {
+        t->source = code[load + 1];
+    } else if (code[load] == OP_MEMC && n == 9) {
+        t->source = BREAK_SOURCE_MEM;
+        t->address = code[load + 1] | code[load + 2] << 8;
+    } else {
+        return 0;
+    }
+    t->op = op;
+    t->value = value[0] | value[1] << 8 | value[2] << 16 | (unsigned int)value[3] << 24;
+    return 1;
+}
+
+// Note whether the term at code[start..] keeps the condition simple
+static void add_test(Parser *p, unsigned int start) {
+    BreakCondition *c = p->cond;
+    if (p->simple && c->tests < BREAK_TESTS && simple_test(c, start, &c->test[c->tests])) {
+        c->tests++;
+    } else {
+        p->simple = 0;
+    }
+}
+
+static void parse_top_and(Parser *p);
+
+// && and || with short-circuit jumps. Terms joined by a top-level &&
+// are checked for PC == constant to anchor the condition.
+static void parse_logical(Parser *p, const char *op, unsigned char jump, void (*operand)(Parser *), int top) {
+    unsigned int start = p->cond->len;
+    operand(p);
+    if (top) {
+        long pc = pc_test(p->cond, start);
+        if (pc >= 0 && pc < MEMORY_SIZE) {
+            p->cond->anchor = pc;
+        }
+        add_test(p, start);
+    }
+    while (p->error == NULL && accept(p, op)) {
+        if (operand == parse_top_and) {
+            p->alternatives = 1;
+        }
+        emit(p, jump);
+        unsigned int target = p->cond->len;
+        emit(p, 0);
+        p->depth--;
+        start = p->cond->len;
+        operand(p);
+        if (top) {
+            long pc = pc_test(p->cond, start);
+            if (pc >= 0 && pc < MEMORY_SIZE && p->cond->anchor < 0) {
+                p->cond->anchor = pc;
+            }
+            add_test(p, start);
+        }
+        emit(p, OP_BOOL);
+        p->cond->code[target] = p->cond->len;
+    }
+}
+
+static void parse_and(Parser *p) {
+    parse_logical(p, "&&", OP_JFALSE, parse_bitor, 0);
+}
+
+static void parse_or(Parser *p) {
+    parse_logical(p, "||", OP_JTRUE, parse_and, 0);
+}
+
+static void parse_top_and(Parser *p) {
+    parse_logical(p, "&&", OP_JFALSE, parse_bitor, 1);
+}
+
+int breakpoint_compile(const char *text, BreakCondition *cond, char *error, size_t size) {
+    Parser p = { text, cond, 0, 0, 0, 1, NULL };
+    memset(cond, 0, sizeof(*cond));
+    cond->anchor = -1;
+    parse_logical(&p, "||", OP_JTRUE, parse_top_and, 0);
+    if (p.error == NULL) {
+        skip_space(&p);
+        if (*p.s) {
+            p.error = "unexpected text";
+        }
+    }
+    emit(&p, OP_END);
+    if (p.error) {
+        snprintf(error, size, "%s at '%.20s'", p.error, p.s);
+        return -1;
+    }
+    // An || above the && terms: the PC test does not hold on every path
+    if (p.alternatives) {
+        cond->anchor = -1;
+    }
+    if (p.alternatives || !p.simple) {
+        cond->tests = 0;
+    }
+    if (cond->refs > BREAK_REFS || p.regs) {
+        cond->every = 1;
+    }
+    return 0;
+}
+
+static int read_register(const CPU6502 *cpu, int r) {
+    switch (r) {
+        case REG_A:
+            return cpu->a;
+        case REG_X:
+            return cpu->x;
+        case REG_Y:
+            return cpu->y;
+        case REG_SP:
+            return cpu->sp;
+        case REG_P:
+            return cpu->p;
+        case REG_PC:
+            return cpu->pc;
+        default:
+            return STACK_SIZE - 1 - cpu->stack_pointer;
+    }
+}
+
+int breakpoint_eval(const BreakCondition *cond, const CPU6502 *cpu) {
+    if (cond->tests) {
+        for (int i = 0; i < cond->tests; i++) {
+            const BreakTest *t = &cond->test[i];
+            int value = t->source == BREAK_SOURCE_MEM ? cpu->mem[t->address] : read_register(cpu, t->source);
+            if (!apply(t->op, value, t->value)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    const unsigned char *code = cond->code;
+    const unsigned char *mem = cpu->mem;
+    int stack[BREAK_STACK_SIZE + 1];
+    int top = 0; // stack[0] is never used
+    unsigned int i = 0;
+    for (;;) {
+        switch (code[i++]) {
+            case OP_END:
+                return stack[top];
+            case OP_CONST:
+                stack[++top] = code[i] | code[i + 1] << 8 | code[i + 2] << 16 | (unsigned int)code[i + 3] << 24;
+                i += 4;
+                break;
+            case OP_REG:
+                stack[++top] = read_register(cpu, code[i++]);
+                break;
+            case OP_MEM:
+                stack[top] = mem[(unsigned short)stack[top]];
+                break;
+            case OP_MEMC:
+                stack[++top] = mem[code[i] | code[i + 1] << 8];
+                i += 2;
+                break;
+            case OP_NOT:
+                stack[top] = !stack[top];
+                break;
+            case OP_NEG:
+                stack[top] = -stack[top];
+                break;
+            case OP_INV:
+                stack[top] = ~stack[top];
+                break;
+#define BINARY(op, expr)                               \
+            case op:                                   \
+                top--;                                 \
+                stack[top] = (expr);                   \
+                break;
+            BINARY(OP_MUL, stack[top] * stack[top + 1])
+            BINARY(OP_ADD, stack[top] + stack[top + 1])
+            BINARY(OP_SUB, stack[top] - stack[top + 1])
+            BINARY(OP_AND, stack[top] & stack[top + 1])
+            BINARY(OP_XOR, stack[top] ^ stack[top + 1])
+            BINARY(OP_OR, stack[top] | stack[top + 1])
+            BINARY(OP_EQ, stack[top] == stack[top + 1])
+            BINARY(OP_NE, stack[top] != stack[top + 1])
+            BINARY(OP_LT, stack[top] < stack[top + 1])
+            BINARY(OP_LE, stack[top] <= stack[top + 1])
+            BINARY(OP_GT, stack[top] > stack[top + 1])
+            BINARY(OP_GE, stack[top] >= stack[top + 1])
+#undef BINARY
+            case OP_JFALSE:
+                if (stack[top] == 0) {
+                    i = code[i];
+                } else {
+                    top--;
+                    i++;
+                }
+                break;
+            case OP_JTRUE:
+                if (stack[top] != 0) {
+                    stack[top] = 1;
+                    i = code[i];
+                } else {
+                    top--;
+                    i++;
+                }
+                break;
+            case OP_BOOL:
+                stack[top] = stack[top] != 0;
+                break;
+        }
+    }
+}
+
+// Breakpoints
+
+static int is_set(const unsigned long long *bits, unsigned short address) {
+    return bits[address >> 6] >> (address & 63) & 1;
+}
+
+// Bitmaps and counts from the plain breakpoints and the list
+static void rebuild(Breakpoints *b) {
+    memcpy(b->breaks, b->plain, sizeof(b->breaks));
+    memset(b->watched, 0, sizeof(b->watched));
+    b->anchored_count = 0;
+    b->unanchored_count = 0;
+    b->every = 0;
+    for (int i = 0; i < BREAK_MAX; i++) {
+        Breakpoint *bp = &b->list[i];
+        if (bp->number == 0) {
+            continue;
+        }
+        if (bp->cond.anchor >= 0) {
+            b->breaks[bp->cond.anchor >> 6] |= 1ULL << (bp->cond.anchor & 63);
+            b->anchored[b->anchored_count++] = bp;
+            continue;
+        }
+        b->unanchored[b->unanchored_count++] = bp;
+        if (bp->cond.every) {
+            b->every++;
+        }
+        for (int r = 0; r < bp->cond.refs && r < BREAK_REFS; r++) {
+            b->watched[bp->cond.ref[r] >> 3] |= 1 << (bp->cond.ref[r] & 7);
+        }
+    }
+    for (int w = 0; w < BREAK_WORDS; w++) {
+        if (b->breaks[w]) {
+            b->summary[w >> 6] |= 1ULL << (w & 63);
+        } else {
+            b->summary[w >> 6] &= ~(1ULL << (w & 63));
+        }
+    }
+}
+
+void breakpoints_init(Breakpoints *b) {
+    memset(b, 0, sizeof(*b));
+    b->next_number = 1;
+}
+
+void breakpoint_set(Breakpoints *b, unsigned short address, int on) {
+    unsigned int w = address >> 6;
+    if (on) {
+        b->plain[w] |= 1ULL << (address & 63);
+        b->breaks[w] |= 1ULL << (address & 63);
+        b->summary[w >> 6] |= 1ULL << (w & 63);
+    } else {
+        b->plain[w] &= ~(1ULL << (address & 63));
+        rebuild(b);
+    }
+}
+
+int breakpoint_add(Breakpoints *b, const char *text, int kind, const CPU6502 *cpu, char *error, size_t size) {
+    Breakpoint *bp = NULL;
+    for (int i = 0; i < BREAK_MAX && bp == NULL; i++) {
+        if (b->list[i].number == 0) {
+            bp = &b->list[i];
+        }
+    }
+    if (bp == NULL) {
+        snprintf(error, size, "too many breakpoints");
+        return -1;
+    }
+    memset(bp, 0, sizeof(*bp));
+    if (breakpoint_compile(text, &bp->cond, error, size) < 0) {
+        return -1;
+    }
+    snprintf(bp->text, sizeof(bp->text), "%s", text);
+    bp->kind = kind;
+    bp->value = breakpoint_eval(&bp->cond, cpu);
+    bp->number = b->next_number++;
+    rebuild(b);
+    return bp->number;
+}
+
+int breakpoint_delete(Breakpoints *b, int number) {
+    for (int i = 0; i < BREAK_MAX; i++) {
+        if (number > 0 && b->list[i].number == number) {
+            b->list[i].number = 0;
+            rebuild(b);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Evaluate, timing one evaluation in 256 over a batch of repeats (an
+// evaluation has no side effects)
+static int evaluate(Breakpoint *bp, const CPU6502 *cpu) {
+    if ((bp->evaluations++ & 255) != 0) {
+        return breakpoint_eval(&bp->cond, cpu);
+    }
+    volatile int value;
+    double start = monotonic();
+    for (int i = 0; i < 16; i++) {
+        value = breakpoint_eval(&bp->cond, cpu);
+    }
+    bp->seconds += monotonic() - start;
+    bp->timed += 16;
+    return value;
+}
+
+static int fires(Breakpoint *bp, const CPU6502 *cpu) {
+    int value = evaluate(bp, cpu);
+    if (bp->kind == BREAK_WATCH) {
+        if (value == bp->value) {
+            return 0;
+        }
+        bp->old_value = bp->value;
+        bp->value = value;
+    } else if (value == 0) {
+        return 0;
+    }
+    bp->hits++;
+    return 1;
+}
+
+// At an address in the breaks bitmap: a plain breakpoint, or a
+// condition anchored there that holds
+static int check_address(Breakpoints *b, const CPU6502 *cpu) {
+    if (is_set(b->plain, cpu->pc)) {
+        b->hit = NULL;
+        return 1;
+    }
+    for (int i = 0; i < b->anchored_count; i++) {
+        Breakpoint *bp = b->anchored[i];
+        if (bp->cond.anchor == cpu->pc && fires(bp, cpu)) {
+            b->hit = bp;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_unanchored(Breakpoints *b, const CPU6502 *cpu) {
+    for (int i = 0; i < b->unanchored_count; i++) {
+        if (fires(b->unanchored[i], cpu)) {
+            b->hit = b->unanchored[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether the instruction at PC may change a byte the unanchored
+// conditions read. The decode follows execute_instruction.
+static int may_change_watched(Breakpoints *b, const CPU6502 *cpu) {
+    const unsigned char *mem = cpu->mem;
+    unsigned short pc = cpu->pc;
+    unsigned short operand = mem[(unsigned short)(pc + 1)] | (mem[(unsigned short)(pc + 2)] << 8);
+    if (b->every) {
+        return 1;
+    }
+    switch (mem[pc]) {
+        case 0x8D: // STA $xxxx
+        case 0x9E: // STX $xxxx
+        case 0x9D: // STZ $xxxx
+            break;
+        case 0xE6: // INC $xx (writes to its second operand byte)
+            operand >>= 8;
+            break;
+        case 0x20: // JSR: host calls write memory
+            return hostcall_is_trap(operand);
+        default:
+            return 0;
+    }
+    return b->watched[operand >> 3] >> (operand & 7) & 1;
+}
+
+// First address with a breakpoint at or after address, MEMORY_SIZE if none
+static unsigned int next_break(Breakpoints *b, unsigned int address) {
+    if (address >= MEMORY_SIZE) {
+        return MEMORY_SIZE;
+    }
+    unsigned int w = address >> 6;
+    unsigned long long bits = b->breaks[w] & (~0ULL << (address & 63));
+    if (bits) {
+        return w * 64 + __builtin_ctzll(bits);
+    }
+    for (w++; w < BREAK_WORDS; w = (w | 63) + 1) {
+        unsigned long long words = b->summary[w >> 6] & (~0ULL << (w & 63));
+        if (words) {
+            w = (w & ~63u) + __builtin_ctzll(words);
+            return w * 64 + __builtin_ctzll(b->breaks[w]);
+        }
+    }
+    return MEMORY_SIZE;
+}
+
+// Last address with a breakpoint at or before address, -1 if none
+static int prev_break(Breakpoints *b, unsigned int address) {
+    int w = address >> 6;
+    unsigned long long bits = b->breaks[w] & (~0ULL >> (63 - (address & 63)));
+    if (bits) {
+        return w * 64 + 63 - __builtin_clzll(bits);
+    }
+    for (w--; w >= 0; w = (w & ~63) - 1) {
+        unsigned long long words = b->summary[w >> 6] & (~0ULL >> (63 - (w & 63)));
+        if (words) {
+            w = (w & ~63) + 63 - __builtin_clzll(words);
+            return w * 64 + 63 - __builtin_clzll(b->breaks[w]);
+        }
+    }
+    return -1;
+}
+
+static void step(CPU6502 *cpu, TimeTravel *history) {
+    if (history) {
+        timetravel_run(history, 1);
+    } else {
+        execute_instruction(cpu);
+    }
+}
+
+int breakpoints_run(Breakpoints *b, CPU6502 *cpu, TimeTravel *history, unsigned long n, int resume) {
+    // The breakpoint-free range last searched for (none yet)
+    unsigned int lo = 0;
+    unsigned int span = 0;
+    unsigned long asked = n;
+    b->hit = NULL;
+    while (n > 0 && cpu->stop == CPU_RUNNING) {
+        int at_break = is_set(b->breaks, cpu->pc);
+        if (at_break && !resume && check_address(b, cpu)) {
+            b->ran = asked - n;
+            return BREAK_HIT;
+        }
+        resume = 0;
+        if (b->unanchored_count) {
+            // One at a time, evaluating after the instructions that may
+            // change what the conditions read, until the next breakpoint
+            do {
+                int check = may_change_watched(b, cpu);
+                step(cpu, history);
+                n--;
+                if (check && cpu->stop == CPU_RUNNING && check_unanchored(b, cpu)) {
+                    b->ran = asked - n;
+                    return BREAK_HIT;
+                }
+            } while (n > 0 && cpu->stop == CPU_RUNNING && !is_set(b->breaks, cpu->pc));
+            continue;
+        }
+        if (at_break) {
+            // Did not stop here: step off it
+            step(cpu, history);
+            n--;
+            if ((unsigned int)cpu->pc - lo >= span) {
+                continue;
+            }
+        } else if ((unsigned int)cpu->pc - lo >= span) {
+            // Jumped out of the range: search the bitmap again
+            lo = prev_break(b, cpu->pc) + 1;
+            span = next_break(b, cpu->pc) - lo;
+        }
+        // Run while the PC stays in the breakpoint-free range
+        if (history) {
+            while (n > 0 && (unsigned int)cpu->pc - lo < span && cpu->stop == CPU_RUNNING) {
+                timetravel_run(history, 1);
+                n--;
+            }
+        } else {
+            while (n > 0 && (unsigned int)cpu->pc - lo < span && cpu->stop == CPU_RUNNING) {
+                execute_instruction(cpu);
+                n--;
+            }
+        }
+    }
+    b->ran = asked - n;
+    return cpu->stop == CPU_RUNNING ? BREAK_DONE : BREAK_STOPPED;
+}
+
+void breakpoint_describe(Breakpoints *b, char *buf, size_t size) {
+    Breakpoint *bp = b->hit;
+    if (bp == NULL) {
+        snprintf(buf, size, "Breakpoint");
+    } else if (bp->kind == BREAK_WATCH) {
+        snprintf(buf, size, "Watch %d (%s): %d -> %d", bp->number, bp->text, bp->old_value, bp->value);
+    } else {
+        snprintf(buf, size, "Break %d (%s)", bp->number, bp->text);
+    }
+}
+
+void breakpoints_report(Breakpoints *b, FILE *out) {
+    for (int i = 0; i < BREAK_MAX; i++) {
+        Breakpoint *bp = &b->list[i];
+        if (bp->number == 0) {
+            continue;
+        }
+        double each = bp->timed ? bp->seconds / bp->timed : 0;
+        fprintf(out, "%s %d (%s): ", bp->kind == BREAK_WATCH ? "Watch" : "Break", bp->number, bp->text);
+        if (bp->cond.anchor >= 0) {
+            fprintf(out, "at $%04lX, ", bp->cond.anchor);
+        } else {
+            fprintf(out, "%s, ", bp->cond.every ? "after every instruction" : "after stores to what it reads");
+        }
+        fprintf(out, "%lu evaluations, %lu hits, %.0f ns per evaluation", bp->evaluations, bp->hits, each * 1e9);
+        if (bp->hits) {
+            fprintf(out, ", %.2f us of evaluation per hit", each * bp->evaluations / bp->hits * 1e6);
+        }
+        fprintf(out, "\n");
+    }
+}
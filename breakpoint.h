@@ -0,0 +1,116 @@
+/*6502 emul - breakpoints, compiled conditions and watch expressions*/
+#ifndef BREAKPOINT_H
+#define BREAKPOINT_H
+#include <stdio.h>
+#include "cpu6502.h"
+#include "timetravel.h"
+
+#define BREAK_MAX 32
+#define BREAK_CODE_SIZE 128
+#define BREAK_STACK_SIZE 16
+#define BREAK_WORDS (MEMORY_SIZE / 64)
+// Constant memory addresses a condition can reference before it counts
+// as reading any address
+#define BREAK_REFS 8
+#define BREAK_TESTS 8
+#define BREAK_SOURCE_MEM 0xFF
+
+// Conditions: C-like expressions over the registers (A X Y SP P PC,
+// and DEPTH for the return stack), memory bytes mem[address] and
+// numbers ($hex, 0xhex or decimal), with ! ~ - unary, * + - & ^ | and
+// comparisons, && and || (short-circuit) and parentheses. Values are
+// ints. Memory is read from RAM, never from a device.
+//
+// A condition compiles to bytecode for a small stack machine. When one
+// of the terms joined by the top-level && is PC == constant, the
+// condition is anchored there: it is only evaluated when the PC reaches
+// that address, found through the breakpoint bitmap like a plain
+// breakpoint, so code elsewhere runs at full speed. Other conditions
+// and watches are evaluated after each store to a memory byte they
+// read (and after host calls), or after every instruction when they
+// read registers or a computed address.
+//
+// The common shape, comparisons of a register or mem[constant] with a
+// constant joined by &&, is also compiled to a list of tests that is
+// evaluated without the stack machine.
+typedef struct {
+    unsigned char source; // register number, or BREAK_SOURCE_MEM
+    unsigned char op;     // a comparison opcode
+    unsigned short address;
+    int value;
+} BreakTest;
+
+typedef struct {
+    unsigned char code[BREAK_CODE_SIZE];
+    unsigned int len;
+    BreakTest test[BREAK_TESTS];
+    int tests;            // 0 when the bytecode must be run
+    long anchor;          // PC the condition requires, -1 if none
+    int every;            // reads registers or a computed address
+    int refs;             // constant addresses read
+    unsigned short ref[BREAK_REFS];
+} BreakCondition;
+
+#define BREAK_WHEN 0  // stop when the condition holds
+#define BREAK_WATCH 1 // stop when the value changes
+
+typedef struct {
+    int number;           // 1-based, 0 for a free slot
+    int kind;
+    char text[160];
+    BreakCondition cond;
+    int value;            // watch: value when last evaluated
+    int old_value;        // watch: value before the last change
+    // Cost
+    unsigned long evaluations;
+    unsigned long hits;
+    unsigned long timed;  // evaluations in the timing samples
+    double seconds;       // spent on them
+} Breakpoint;
+
+// Breakpoints of one machine: plain breakpoints (no condition, from the
+// debugger) and numbered conditions and watches
+typedef struct {
+    unsigned long long plain[BREAK_WORDS];
+    // Addresses to stop at: plain breakpoints and condition anchors, with
+    // a summary bit per word that has one
+    unsigned long long breaks[BREAK_WORDS];
+    unsigned long long summary[BREAK_WORDS / 64];
+    unsigned char watched[MEMORY_SIZE / 8]; // bytes unanchored conditions read
+    Breakpoint *anchored[BREAK_MAX];    // conditions evaluated at a PC
+    int anchored_count;
+    Breakpoint *unanchored[BREAK_MAX];  // conditions evaluated on stores
+    int unanchored_count;
+    int every;            // of them, evaluated after every instruction
+    Breakpoint list[BREAK_MAX];
+    int next_number;
+    Breakpoint *hit;      // what stopped the last run (NULL: a plain one)
+    unsigned long ran;    // instructions the last run executed
+} Breakpoints;
+
+// breakpoints_run results
+#define BREAK_DONE 0    // ran the instructions asked for
+#define BREAK_HIT 1     // stopped on a breakpoint or watch (b->hit)
+#define BREAK_STOPPED 2 // the CPU stopped (cpu->stop)
+
+void breakpoints_init(Breakpoints *b);
+// Plain breakpoint at address on or off
+void breakpoint_set(Breakpoints *b, unsigned short address, int on);
+// Add a condition (BREAK_WHEN) or watch expression (BREAK_WATCH, whose
+// value on cpu now is the starting point); returns its number, or -1
+// with a message in error
+int breakpoint_add(Breakpoints *b, const char *text, int kind, const CPU6502 *cpu, char *error, size_t size);
+// Remove a condition or watch by number; returns -1 if there is none
+int breakpoint_delete(Breakpoints *b, int number);
+// Compile an expression; returns 0, or -1 with a message in error
+int breakpoint_compile(const char *text, BreakCondition *cond, char *error, size_t size);
+int breakpoint_eval(const BreakCondition *cond, const CPU6502 *cpu);
+// Run up to n instructions (through history if it is not NULL), stopping
+// at a breakpoint or when a watch fires. The breakpoint at the PC does
+// not count when resuming from it.
+int breakpoints_run(Breakpoints *b, CPU6502 *cpu, TimeTravel *history, unsigned long n, int resume);
+// One line on what b->hit is, for a stop message
+void breakpoint_describe(Breakpoints *b, char *buf, size_t size);
+// Evaluations, hits and cost of each condition
+void breakpoints_report(Breakpoints *b, FILE *out);
+#endif
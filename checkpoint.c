@@ -0,0 +1,110 @@
+/*6502 emul - periodic background checkpoints*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "checkpoint.h"
+
+static double monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Compress and write each snapshot the run loop hands over
+static void *writer_thread(void *arg) {
+    Checkpoint *cp = arg;
+    // Batch scheduling: waking the writer must not preempt the run loop
+    // when both share a core
+    struct sched_param param = { 0 };
+    sched_setscheduler(0, SCHED_BATCH, &param);
+    pthread_mutex_lock(&cp->lock);
+    for (;;) {
+        while (!cp->busy && !cp->quit) {
+            pthread_cond_wait(&cp->wake, &cp->lock);
+        }
+        if (!cp->busy) {
+            break;
+        }
+        pthread_mutex_unlock(&cp->lock);
+        long size = savestate_write(cp->path, &cp->header, cp->mem);
+        pthread_mutex_lock(&cp->lock);
+        if (size < 0) {
+            cp->failed++;
+        } else {
+            cp->last_size = size;
+        }
+        cp->busy = 0;
+    }
+    pthread_mutex_unlock(&cp->lock);
+    return NULL;
+}
+
+Checkpoint *checkpoint_open(const char *path, double interval) {
+    Checkpoint *cp = calloc(1, sizeof(Checkpoint));
+    if (cp == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    cp->path = path;
+    cp->interval = interval;
+    cp->due = monotonic() + interval;
+    cp->last_size = -1;
+    pthread_mutex_init(&cp->lock, NULL);
+    pthread_cond_init(&cp->wake, NULL);
+    if (pthread_create(&cp->writer, NULL, writer_thread, cp) != 0) {
+        printf("Cannot start the checkpoint writer\n");
+        exit(1);
+    }
+    return cp;
+}
+
+// The pause of the run loop is the header fill and one 64 KB memcpy;
+// the writer gets the snapshot buffer only while it is idle
+int checkpoint_take(Checkpoint *cp, const CPU6502 *cpu, const Acia *acia) {
+    double start = monotonic();
+    pthread_mutex_lock(&cp->lock);
+    if (cp->busy) {
+        pthread_mutex_unlock(&cp->lock);
+        cp->skipped++;
+        return -1;
+    }
+    savestate_header(&cp->header, cpu, acia);
+    memcpy(cp->mem, cpu->mem, MEMORY_SIZE);
+    cp->busy = 1;
+    pthread_cond_signal(&cp->wake);
+    pthread_mutex_unlock(&cp->lock);
+    double pause = monotonic() - start;
+    cp->taken++;
+    cp->pause_sum += pause;
+    if (pause > cp->pause_max) {
+        cp->pause_max = pause;
+    }
+    return 0;
+}
+
+void checkpoint_poll(Checkpoint *cp, const CPU6502 *cpu, const Acia *acia) {
+    double t = monotonic();
+    if (t < cp->due) {
+        return;
+    }
+    cp->due = t + cp->interval;
+    checkpoint_take(cp, cpu, acia);
+}
+
+void checkpoint_close(Checkpoint *cp, FILE *out) {
+    pthread_mutex_lock(&cp->lock);
+    cp->quit = 1;
+    pthread_cond_signal(&cp->wake);
+    pthread_mutex_unlock(&cp->lock);
+    pthread_join(cp->writer, NULL);
+    if (out && cp->taken) {
+        fprintf(out, "Checkpoints: %lu taken, %lu skipped, %lu failed; pause avg %.1f us, max %.1f us; last %ld bytes\n",
+                cp->taken, cp->skipped, cp->failed, cp->pause_sum / cp->taken * 1e6, cp->pause_max * 1e6,
+                cp->last_size);
+    }
+    pthread_mutex_destroy(&cp->lock);
+    pthread_cond_destroy(&cp->wake);
+    free(cp);
+}
@@ -0,0 +1,47 @@
+/*6502 emul - periodic background checkpoints*/
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <pthread.h>
+#include <stdio.h>
+#include "cpu6502.h"
+#include "acia.h"
+#include "savestate.h"
+
+// Instructions between two looks at the clock by the run loop
+#define CHECKPOINT_SLICE 65536
+
+// The run loop only copies the machine into a snapshot buffer; a
+// writer thread compresses the copy and replaces the checkpoint file.
+// A checkpoint that falls due while the writer is still busy with the
+// previous one is skipped rather than waited for.
+typedef struct {
+    const char *path;
+    double interval;    // seconds between checkpoints
+    double due;         // monotonic time of the next one
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int busy;           // snapshot handed to the writer, not yet written
+    int quit;
+    // Snapshot: only touched by the writer while busy is set
+    SavestateHeader header;
+    unsigned char mem[MEMORY_SIZE];
+    // Counters
+    unsigned long taken;
+    unsigned long skipped;
+    unsigned long failed;
+    long last_size;
+    double pause_sum;   // time the run loop spent in checkpoint_poll
+    double pause_max;
+} Checkpoint;
+
+// Checkpoint the machine to path every interval seconds
+Checkpoint *checkpoint_open(const char *path, double interval);
+// Called by the run loop every CHECKPOINT_SLICE instructions
+void checkpoint_poll(Checkpoint *cp, const CPU6502 *cpu, const Acia *acia);
+// Take a checkpoint now, unless the writer is busy; returns 0 if taken
+int checkpoint_take(Checkpoint *cp, const CPU6502 *cpu, const Acia *acia);
+// Wait for the last write, stop the writer and report the pause times
+// on out (NULL for no report)
+void checkpoint_close(Checkpoint *cp, FILE *out);
+#endif
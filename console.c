@@ -0,0 +1,36 @@
+/*6502 emul - console backends for the I/O host calls*/
+#include <string.h>
+#include <unistd.h>
+#include "console.h"
+
+static int stdio_getc(Console *con) {
+    return getchar();
+}
+
+static int stdio_gets(Console *con, char *buf, unsigned int size) {
+    if (fgets(buf, size, stdin) == NULL) {
+        return EOF;
+    }
+    return strlen(buf);
+}
+
+// Single characters go through stdio; strings leave with one write()
+// straight from the caller's buffer
+static int stdio_write(Console *con, const unsigned char *buf, unsigned int len) {
+    if (len == 1) {
+        putchar(buf[0]);
+        return 0;
+    }
+    fflush(stdout); // Keep ordering with characters sent by putchar
+    while (len > 0) {
+        ssize_t n = write(1, buf, len);
+        if (n <= 0) {
+            break;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+Console console_stdio = { stdio_getc, stdio_gets, stdio_write };
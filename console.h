@@ -0,0 +1,23 @@
+/*6502 emul - console backends for the I/O host calls*/
+#ifndef CONSOLE_H
+#define CONSOLE_H
+#include <stdio.h>
+// Returned when the backend cannot complete the call yet: the host call
+// rewinds to its JSR and stops the CPU with CPU_WAIT_IO, so the call is
+// retried when the machine next runs
+#define CONSOLE_AGAIN (-2)
+
+typedef struct Console Console;
+struct Console {
+    // Next input byte, or EOF at end of input
+    int (*getc)(Console *con);
+    // A line of at most size - 1 bytes (keeping its newline) into buf,
+    // NUL-terminated; returns its length, or EOF at end of input
+    int (*gets)(Console *con, char *buf, unsigned int size);
+    // Output len bytes, all of them or (CONSOLE_AGAIN) none
+    int (*write)(Console *con, const unsigned char *buf, unsigned int len);
+};
+
+// stdin/stdout, used by cpu_init
+extern Console console_stdio;
+#endif
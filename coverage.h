@@ -0,0 +1,22 @@
+/*6502 emul - edge coverage for fuzzing*/
+#ifndef COVERAGE_H
+#define COVERAGE_H
+#include "cpu6502.h"
+// AFL-compatible map: one hit counter per hashed (previous, new) PC
+// pair, so the guest's edges show up in afl-fuzz as they would for an
+// instrumented host binary
+#define COVERAGE_MAP_SIZE 65536
+
+// Called only where control transfers (branches, JMP, JSR, RTS), after
+// PC has its new value; straight-line code never gets here
+static inline void coverage_edge(CPU6502 *cpu) {
+    if (cpu->coverage) {
+        unsigned short location = cpu->pc * 40503u; // spread nearby PCs
+        cpu->coverage[location ^ cpu->coverage_prev]++;
+        cpu->coverage_prev = location >> 1;
+    }
+}
+
+// The map afl-fuzz shares through __AFL_SHM_ID, or NULL
+unsigned char *coverage_attach_afl(void);
+#endif
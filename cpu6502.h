@@ -0,0 +1,43 @@
+/*6502 emul - shared declarations*/
+#ifndef CPU6502_H
+#define CPU6502_H
+#include <stdio.h>
+// Memory (64 KB)
+#define MEMORY_SIZE (65536)
+// Stack (Simplified): return addresses of JSR/RTS
+#define STACK_SIZE 256
+
+// Why the CPU stopped (cpu->stop)
+#define CPU_RUNNING 0
+#define CPU_WAIT_IO 1 // a host call is waiting for the console
+#define CPU_HALTED 2 // the guest exited (exit code in A)
+#define CPU_BAD_OPCODE 3 // PC points at an unrecognized opcode
+#define CPU_STACK_OVERFLOW 4 // PC points at the JSR that overflowed
+#define CPU_STACK_UNDERFLOW 5 // PC points at the RTS that underflowed
+
+struct Console;
+
+// 6502 CPU Registers, plus the machine they run on
+typedef struct {
+    unsigned char a;  // Accumulator
+    unsigned char x;  // Index Register X
+    unsigned char y;  // Index Register Y
+    unsigned short pc; // Program Counter
+    unsigned char sp; // Stack Pointer
+    unsigned char p;  // Processor Status Register
+    unsigned char stop; // CPU_RUNNING, or why the run loop must return
+    unsigned char stack_pointer;
+    unsigned short stack[STACK_SIZE];
+    unsigned char *mem; // 64 KB address space
+    struct Console *console; // host side of the I/O host calls
+    unsigned char *coverage; // edge hit counts (coverage.h), or NULL
+    unsigned short coverage_prev;
+} CPU6502;
+// Memory of the default machine
+extern unsigned char memory[MEMORY_SIZE];
+
+void cpu_init(CPU6502 *cpu);
+int read_char(CPU6502 *cpu);
+void execute_instruction(CPU6502 *cpu);
+int cpu_report(CPU6502 *cpu, FILE *out);
+#endif
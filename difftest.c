@@ -0,0 +1,754 @@
+/*6502 emul - differential testing of execution engines*/
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "difftest.h"
+#include "hostcall.h"
+#include "memview.h"
+#include "trace.h"
+
+// The reference: execute_instruction on a private machine
+typedef struct {
+    Engine engine;
+    CPU6502 cpu;
+    unsigned char mem[MEMORY_SIZE];
+} ReferenceEngine;
+
+static unsigned long reference_run(Engine *e, unsigned long n) {
+    CPU6502 *cpu = &((ReferenceEngine *)e)->cpu;
+    unsigned long done = 0;
+    while (done < n && cpu->stop == CPU_RUNNING) {
+        execute_instruction(cpu);
+        done++;
+    }
+    return done;
+}
+
+static CPU6502 *reference_state(Engine *e) {
+    return &((ReferenceEngine *)e)->cpu;
+}
+
+static void reference_free(Engine *e) {
+    free(e);
+}
+
+// Lockstep vector engine (batch.h) with a single lane (difftest_random
+// tests it on DIFFTEST_LANES)
+typedef struct {
+    Engine engine;
+    Batch *batch;
+} BatchEngine;
+
+static unsigned long batch_engine_run(Engine *e, unsigned long n) {
+    Batch *b = ((BatchEngine *)e)->batch;
+    unsigned long steps = b->steps;
+    batch_run(b, n);
+    return b->steps - steps;
+}
+
+static CPU6502 *batch_engine_state(Engine *e) {
+    return &((BatchEngine *)e)->batch->cpu[0];
+}
+
+static void batch_engine_free(Engine *e) {
+    batch_free(((BatchEngine *)e)->batch);
+    free(e);
+}
+
+// Registers, stack and stop code of from into to, whose memory and
+// console stay its own
+static void copy_registers(CPU6502 *to, const CPU6502 *from) {
+    to->a = from->a;
+    to->x = from->x;
+    to->y = from->y;
+    to->pc = from->pc;
+    to->sp = from->sp;
+    to->p = from->p;
+    to->stop = from->stop;
+    to->stack_pointer = from->stack_pointer;
+    memcpy(to->stack, from->stack, sizeof(to->stack));
+}
+
+Engine *engine_create(const char *name, const CPU6502 *cpu, Console *console) {
+    Engine *e;
+    CPU6502 *state;
+    if (strcmp(name, "reference") == 0) {
+        ReferenceEngine *r = malloc(sizeof(ReferenceEngine));
+        if (r == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        cpu_init(&r->cpu);
+        r->cpu.mem = r->mem;
+        memcpy(r->mem, cpu->mem, MEMORY_SIZE);
+        r->engine.run = reference_run;
+        r->engine.state = reference_state;
+        r->engine.free = reference_free;
+        e = &r->engine;
+    } else if (strcmp(name, "batch") == 0) {
+        BatchEngine *be = malloc(sizeof(BatchEngine));
+        if (be == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        be->batch = batch_create(1, cpu->mem, cpu->pc);
+        be->engine.run = batch_engine_run;
+        be->engine.state = batch_engine_state;
+        be->engine.free = batch_engine_free;
+        e = &be->engine;
+    } else {
+        return NULL;
+    }
+    e->name = name;
+    state = e->state(e);
+    copy_registers(state, cpu);
+    state->console = console;
+    state->coverage = NULL;
+    return e;
+}
+
+// Input from a buffer; output is only hashed and counted
+typedef struct {
+    Console console;
+    const unsigned char *input;
+    size_t input_len;
+    size_t input_pos;
+    unsigned long long output;
+    unsigned long output_len;
+} DiffConsole;
+
+static int diff_getc(Console *con) {
+    DiffConsole *c = (DiffConsole *)con;
+    if (c->input_pos >= c->input_len) {
+        return EOF;
+    }
+    return c->input[c->input_pos++];
+}
+
+static int diff_gets(Console *con, char *buf, unsigned int size) {
+    DiffConsole *c = (DiffConsole *)con;
+    size_t left = c->input_len - c->input_pos;
+    if (left == 0) {
+        return EOF;
+    }
+    const unsigned char *start = c->input + c->input_pos;
+    unsigned int len = left < size - 1 ? left : size - 1;
+    const unsigned char *nl = memchr(start, '\n', len);
+    if (nl) {
+        len = nl - start + 1;
+    }
+    memcpy(buf, start, len);
+    buf[len] = 0;
+    c->input_pos += len;
+    return len;
+}
+
+static int diff_write(Console *con, const unsigned char *buf, unsigned int len) {
+    DiffConsole *c = (DiffConsole *)con;
+    for (unsigned int i = 0; i < len; i++) {
+        c->output = (c->output ^ buf[i]) * 0x100000001B3ULL;
+    }
+    c->output_len += len;
+    return len;
+}
+
+// One machine under test and the console it talks to
+typedef struct {
+    char name[16];
+    Engine *engine; // NULL for a lane of a batch
+    CPU6502 *cpu;   // its state
+    DiffConsole console;
+} DiffSide;
+
+// A state both engines agreed on
+typedef struct {
+    CPU6502 cpu;
+    unsigned char mem[MEMORY_SIZE];
+    size_t input_pos;
+    unsigned long long output;
+    unsigned long output_len;
+} DiffSnapshot;
+
+static unsigned long long mix(unsigned long long h, unsigned long long v) {
+    h = (h ^ v) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+// Registers, the live part of the stack, memory and console position.
+// Memory is hashed in four independent lanes of eight bytes with the
+// xxHash64 round, folded in at the end.
+static unsigned long long state_hash(DiffSide *s) {
+    const CPU6502 *cpu = s->cpu;
+    const unsigned long long *words = (const unsigned long long *)cpu->mem;
+    unsigned long long h = mix(0, cpu->a | cpu->x << 8 | cpu->y << 16 | (unsigned long long)cpu->pc << 24 |
+                                      (unsigned long long)cpu->sp << 40 | (unsigned long long)cpu->p << 48 |
+                                      (unsigned long long)cpu->stop << 56);
+    h = mix(h, cpu->stack_pointer);
+    for (int i = cpu->stack_pointer + 1; i < STACK_SIZE; i++) {
+        h = mix(h, cpu->stack[i]);
+    }
+    unsigned long long lane[4] = { 1, 2, 3, 4 };
+    for (int i = 0; i < MEMORY_SIZE / 8; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            unsigned long long v = lane[j] + words[i + j] * 0xC2B2AE3D27D4EB4FULL;
+            lane[j] = ((v << 31) | (v >> 33)) * 0x9E3779B185EBCA87ULL;
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        h = mix(h, lane[i]);
+    }
+    h = mix(h, s->console.input_pos);
+    h = mix(h, s->console.output);
+    return mix(h, s->console.output_len);
+}
+
+static void save(DiffSide *s, DiffSnapshot *snap) {
+    const CPU6502 *cpu = s->cpu;
+    snap->cpu = *cpu;
+    memcpy(snap->mem, cpu->mem, MEMORY_SIZE);
+    snap->input_pos = s->console.input_pos;
+    snap->output = s->console.output;
+    snap->output_len = s->console.output_len;
+}
+
+static void restore(DiffSide *s, const DiffSnapshot *snap) {
+    CPU6502 *cpu = s->cpu;
+    copy_registers(cpu, &snap->cpu);
+    memcpy(cpu->mem, snap->mem, MEMORY_SIZE);
+    s->console.input_pos = snap->input_pos;
+    s->console.output = snap->output;
+    s->console.output_len = snap->output_len;
+}
+
+// Both states side by side, then the memory lines that differ
+static void print_states(FILE *out, DiffSide *a, DiffSide *b) {
+    const CPU6502 *x = a->cpu;
+    const CPU6502 *y = b->cpu;
+    fprintf(out, "        %-12s %-12s\n", a->name, b->name);
+    fprintf(out, "  A     %02X           %02X%s\n", x->a, y->a, x->a != y->a ? "   <" : "");
+    fprintf(out, "  X     %02X           %02X%s\n", x->x, y->x, x->x != y->x ? "   <" : "");
+    fprintf(out, "  Y     %02X           %02X%s\n", x->y, y->y, x->y != y->y ? "   <" : "");
+    fprintf(out, "  P     %02X           %02X%s\n", x->p, y->p, x->p != y->p ? "   <" : "");
+    fprintf(out, "  SP    %02X           %02X%s\n", x->sp, y->sp, x->sp != y->sp ? "   <" : "");
+    fprintf(out, "  PC    %04X         %04X%s\n", x->pc, y->pc, x->pc != y->pc ? "   <" : "");
+    fprintf(out, "  stop  %-12d %d%s\n", x->stop, y->stop, x->stop != y->stop ? "   <" : "");
+    fprintf(out, "  depth %-12d %d%s\n", STACK_SIZE - 1 - x->stack_pointer, STACK_SIZE - 1 - y->stack_pointer,
+            x->stack_pointer != y->stack_pointer ? "   <" : "");
+    fprintf(out, "  in    %-12zu %zu%s\n", a->console.input_pos, b->console.input_pos,
+            a->console.input_pos != b->console.input_pos ? "   <" : "");
+    fprintf(out, "  out   %-12lu %lu%s\n", a->console.output_len, b->console.output_len,
+            a->console.output != b->console.output || a->console.output_len != b->console.output_len ? "   <" : "");
+    if (x->stack_pointer == y->stack_pointer) {
+        for (int i = x->stack_pointer + 1; i < STACK_SIZE; i++) {
+            if (x->stack[i] != y->stack[i]) {
+                fprintf(out, "  stack[%d] %04X      %04X   <\n", i, x->stack[i], y->stack[i]);
+            }
+        }
+    }
+    if (memcmp(x->mem, y->mem, MEMORY_SIZE) != 0) {
+        fprintf(out, "  memory (- %s, + %s):\n", a->name, b->name);
+        memview_diff(out, x->mem, y->mem);
+    }
+}
+
+// b left a different state than a after instruction count, which was
+// code at pc
+static void print_divergence(FILE *out, DiffSide *a, DiffSide *b, unsigned long count, unsigned short pc,
+                             const unsigned char *code) {
+    char text[48];
+    trace_disassemble(text, sizeof(text), pc, code[0], code + 1);
+    fprintf(out, "difftest: %s and %s differ after instruction %lu: $%04X %02X %02X %02X  %s\n", a->name, b->name,
+            count, pc, code[0], code[1], code[2], text);
+    print_states(out, a, b);
+}
+
+// The code at the PC of cpu
+static unsigned short fetch_code(const CPU6502 *cpu, unsigned char *code) {
+    for (int i = 0; i < 3; i++) {
+        code[i] = cpu->mem[(unsigned short)(cpu->pc + i)];
+    }
+    return cpu->pc;
+}
+
+// The states matched after lo instructions (saved in good, taken after
+// good_count) and differ after hi: narrow it down to one instruction by
+// rerunning both engines from good, then print the instruction and the
+// states it left
+static void bisect(DiffSide *a, DiffSide *b, const DiffSnapshot *good, unsigned long good_count, unsigned long lo,
+                   unsigned long hi, FILE *out, DiffResult *result) {
+    while (hi - lo > 1) {
+        unsigned long mid = lo + (hi - lo) / 2;
+        restore(a, good);
+        restore(b, good);
+        a->engine->run(a->engine, mid - good_count);
+        b->engine->run(b->engine, mid - good_count);
+        result->probes++;
+        if (state_hash(a) == state_hash(b)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    restore(a, good);
+    restore(b, good);
+    a->engine->run(a->engine, lo - good_count);
+    b->engine->run(b->engine, lo - good_count);
+    unsigned char code[3];
+    unsigned short pc = fetch_code(a->cpu, code);
+    a->engine->run(a->engine, 1);
+    b->engine->run(b->engine, 1);
+    result->diverged = hi;
+    print_divergence(out, a, b, hi, pc, code);
+}
+
+static void console_setup(DiffConsole *c, const unsigned char *input, size_t input_len) {
+    memset(c, 0, sizeof(*c));
+    c->console.getc = diff_getc;
+    c->console.gets = diff_gets;
+    c->console.write = diff_write;
+    c->input = input;
+    c->input_len = input_len;
+}
+
+static void side_setup(DiffSide *s) {
+    snprintf(s->name, sizeof(s->name), "%s", s->engine->name);
+    s->cpu = s->engine->state(s->engine);
+}
+
+int difftest_run(const char *engine, const CPU6502 *cpu, const unsigned char *input, size_t input_len,
+                 unsigned long interval, unsigned long budget, FILE *out, DiffResult *result) {
+    DiffSide a;
+    DiffSide b;
+    memset(result, 0, sizeof(*result));
+    console_setup(&a.console, input, input_len);
+    console_setup(&b.console, input, input_len);
+    b.engine = engine_create(engine, cpu, &b.console.console);
+    if (b.engine == NULL) {
+        printf("Unknown engine: %s (engines: %s)\n", engine, ENGINE_NAMES);
+        return -1;
+    }
+    a.engine = engine_create("reference", cpu, &a.console.console);
+    side_setup(&a);
+    side_setup(&b);
+    DiffSnapshot *good = malloc(sizeof(DiffSnapshot));
+    if (good == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    save(&a, good);
+    unsigned long good_count = 0;
+    int status = 0;
+    if (interval == 0) {
+        interval = DIFFTEST_DEFAULT_INTERVAL;
+    }
+    while (result->instructions < budget) {
+        unsigned long n = budget - result->instructions < interval ? budget - result->instructions : interval;
+        unsigned long done = a.engine->run(a.engine, n);
+        b.engine->run(b.engine, n);
+        result->instructions += done;
+        result->checks++;
+        unsigned long long hash = state_hash(&a);
+        if (hash != state_hash(&b)) {
+            // A machine that stopped early ran fewer: bisect over the slots
+            bisect(&a, &b, good, good_count, good_count, good_count + n, out, result);
+            status = 1;
+            break;
+        }
+        result->hash = mix(result->hash, hash);
+        if (done < n) {
+            result->stopped = 1;
+            break;
+        }
+        save(&a, good);
+        good_count = result->instructions;
+    }
+    free(good);
+    a.engine->free(a.engine);
+    b.engine->free(b.engine);
+    return status;
+}
+
+// Lanes of one batch, each checked against a reference machine of its
+// own. Lanes differ in registers, memory and input but run the same
+// code, so they split and meet again as the batch runs.
+typedef struct {
+    Batch *batch;
+    int lanes;
+    DiffSide lane[DIFFTEST_LANES];
+    DiffSide reference[DIFFTEST_LANES];
+    unsigned long reference_count[DIFFTEST_LANES]; // instructions run by each reference
+    // Last state every lane agreed on
+    DiffSnapshot *good_lane;
+    DiffSnapshot *good_reference;
+    unsigned long good_count[DIFFTEST_LANES];
+    unsigned long good_age;
+    unsigned long good_turn;
+    int good_turn_lane;
+    unsigned char good_dirty[MEMORY_SIZE];
+} LaneTest;
+
+// The batch's schedule and code_dirty are saved too, so that rerunning
+// from here takes the same steps
+static void lanes_save(LaneTest *t) {
+    Batch *b = t->batch;
+    for (int i = 0; i < t->lanes; i++) {
+        save(&t->lane[i], &t->good_lane[i]);
+        save(&t->reference[i], &t->good_reference[i]);
+        t->good_count[i] = b->lane_retired[i];
+    }
+    t->good_age = b->age;
+    t->good_turn = b->turn;
+    t->good_turn_lane = b->turn_lane;
+    memcpy(t->good_dirty, b->code_dirty, MEMORY_SIZE);
+}
+
+static void lanes_restore(LaneTest *t) {
+    Batch *b = t->batch;
+    for (int i = 0; i < t->lanes; i++) {
+        restore(&t->lane[i], &t->good_lane[i]);
+        restore(&t->reference[i], &t->good_reference[i]);
+        b->lane_retired[i] = t->reference_count[i] = t->good_count[i];
+    }
+    b->age = t->good_age;
+    b->turn = t->good_turn;
+    b->turn_lane = t->good_turn_lane;
+    memcpy(b->code_dirty, t->good_dirty, MEMORY_SIZE);
+}
+
+// Run the batch n steps and every reference as far as its lane got;
+// returns the steps run
+static unsigned long lanes_run(LaneTest *t, unsigned long n) {
+    Batch *b = t->batch;
+    unsigned long steps = b->steps;
+    batch_run(b, n);
+    for (int i = 0; i < t->lanes; i++) {
+        Engine *e = t->reference[i].engine;
+        e->run(e, b->lane_retired[i] - t->reference_count[i]);
+        t->reference_count[i] = b->lane_retired[i];
+    }
+    return b->steps - steps;
+}
+
+// Lane k matched its reference lo steps after the good state and
+// differs after hi: narrow it down to the step that ran the lane's
+// diverging instruction
+static void lanes_bisect(LaneTest *t, int k, unsigned long lo, unsigned long hi, FILE *out, DiffResult *result) {
+    while (hi - lo > 1) {
+        unsigned long mid = lo + (hi - lo) / 2;
+        lanes_restore(t);
+        lanes_run(t, mid);
+        result->probes++;
+        if (state_hash(&t->lane[k]) == state_hash(&t->reference[k])) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    lanes_restore(t);
+    lanes_run(t, lo);
+    unsigned char code[3];
+    unsigned short pc = fetch_code(t->lane[k].cpu, code);
+    lanes_restore(t);
+    lanes_run(t, hi);
+    result->diverged = t->batch->lane_retired[k];
+    print_divergence(out, &t->reference[k], &t->lane[k], result->diverged, pc, code);
+}
+
+// Run lanes machines sharing their code on one batch and each also on
+// the reference engine, comparing every lane with its reference every
+// interval batch steps, at most budget steps; like difftest_run
+// otherwise
+static int difftest_lanes(const CPU6502 *cpus, const unsigned char *const *inputs, const size_t *input_lens, int lanes,
+                          unsigned long interval, unsigned long budget, FILE *out, DiffResult *result) {
+    LaneTest *t = calloc(1, sizeof(LaneTest));
+    if (t == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    memset(result, 0, sizeof(*result));
+    t->lanes = lanes;
+    t->batch = batch_create(lanes, cpus[0].mem, cpus[0].pc);
+    t->good_lane = malloc(lanes * sizeof(DiffSnapshot));
+    t->good_reference = malloc(lanes * sizeof(DiffSnapshot));
+    if (t->good_lane == NULL || t->good_reference == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < lanes; i++) {
+        DiffSide *lane = &t->lane[i];
+        DiffSide *reference = &t->reference[i];
+        console_setup(&lane->console, inputs[i], input_lens[i]);
+        console_setup(&reference->console, inputs[i], input_lens[i]);
+        reference->engine = engine_create("reference", &cpus[i], &reference->console.console);
+        side_setup(reference);
+        snprintf(lane->name, sizeof(lane->name), "batch %d", i);
+        lane->cpu = &t->batch->cpu[i];
+        memcpy(lane->cpu->mem, cpus[i].mem, MEMORY_SIZE);
+        copy_registers(lane->cpu, &cpus[i]);
+        lane->cpu->console = &lane->console.console;
+        lane->cpu->coverage = NULL;
+        // Bytes that differ between lanes count as stored to
+        for (int j = 0; j < MEMORY_SIZE; j++) {
+            t->batch->code_dirty[j] |= cpus[i].mem[j] != cpus[0].mem[j];
+        }
+    }
+    lanes_save(t);
+    int status = 0;
+    if (interval == 0) {
+        interval = DIFFTEST_DEFAULT_INTERVAL;
+    }
+    unsigned long steps = 0;
+    while (steps < budget) {
+        unsigned long n = budget - steps < interval ? budget - steps : interval;
+        unsigned long done = lanes_run(t, n);
+        steps += done;
+        result->checks++;
+        int bad = -1;
+        for (int i = 0; i < lanes && bad < 0; i++) {
+            unsigned long long hash = state_hash(&t->reference[i]);
+            if (hash != state_hash(&t->lane[i])) {
+                bad = i;
+            }
+            result->hash = mix(result->hash, hash);
+        }
+        if (bad >= 0) {
+            lanes_bisect(t, bad, 0, n, out, result);
+            status = 1;
+            break;
+        }
+        if (done < n) {
+            break;
+        }
+        lanes_save(t);
+    }
+    for (int i = 0; i < lanes; i++) {
+        result->instructions += t->batch->lane_retired[i];
+        result->stopped += t->lane[i].cpu->stop != CPU_RUNNING;
+        t->reference[i].engine->free(t->reference[i].engine);
+    }
+    result->splits = t->batch->splits;
+    batch_free(t->batch);
+    free(t->good_lane);
+    free(t->good_reference);
+    free(t);
+    return status;
+}
+
+// Random program generation
+static unsigned int next_random(unsigned long long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state >> 32;
+}
+
+enum { GEN_NONE, GEN_IMM, GEN_ZP, GEN_LOAD, GEN_STORE, GEN_INC, GEN_BRANCH, GEN_JMP, GEN_JSR, GEN_JUNK, GEN_SPLIT_LOAD,
+       GEN_SPLIT_CMP };
+
+typedef struct {
+    unsigned char opcode;
+    unsigned char kind;
+} GenOp;
+
+// The instruction set of execute_instruction, common ones listed more
+// than once. RTS and bytes that may not be opcodes, which stop the
+// machine when they do not match a JSR, are added separately and rarely.
+static const GenOp gen_ops[] = {
+    { 0xA9, GEN_IMM },    { 0xA9, GEN_IMM },    { 0xA2, GEN_IMM },    { 0xA0, GEN_IMM },    { 0x69, GEN_IMM },
+    { 0x69, GEN_IMM },    { 0xC9, GEN_IMM },    { 0xC9, GEN_IMM },    { 0xAD, GEN_LOAD },   { 0xAE, GEN_LOAD },
+    { 0xAC, GEN_LOAD },   { 0xA6, GEN_ZP },     { 0xA1, GEN_ZP },     { 0x8D, GEN_STORE },  { 0x8D, GEN_STORE },
+    { 0x9E, GEN_STORE },  { 0x9D, GEN_STORE },  { 0xE6, GEN_INC },    { 0xE8, GEN_NONE },   { 0xC8, GEN_NONE },
+    { 0xAA, GEN_NONE },   { 0x8A, GEN_NONE },   { 0xA8, GEN_NONE },   { 0x98, GEN_NONE },   { 0x9A, GEN_NONE },
+    { 0xBA, GEN_NONE },   { 0xD0, GEN_BRANCH }, { 0xF0, GEN_BRANCH }, { 0x90, GEN_BRANCH }, { 0xB0, GEN_BRANCH },
+    { 0x4C, GEN_JMP },    { 0x20, GEN_JSR },    { 0x20, GEN_JSR },
+};
+static const GenOp gen_rts = { 0x60, GEN_NONE };
+static const GenOp gen_junk = { 0x00, GEN_JUNK };
+// A branch on a zero page byte, which holds a small number that differs
+// between lanes: LDA $00zz, CMP #n, BNE or BEQ
+static const GenOp gen_split[] = {
+    { 0xAD, GEN_SPLIT_LOAD }, { 0xC9, GEN_SPLIT_CMP }, { 0xD0, GEN_BRANCH }, { 0xF0, GEN_BRANCH },
+};
+#define GEN_SPLIT_VALUES 4
+
+static const unsigned char gen_length[] = {
+    [GEN_NONE] = 1, [GEN_IMM] = 2, [GEN_ZP] = 2, [GEN_LOAD] = 3, [GEN_STORE] = 3,
+    [GEN_INC] = 3,  [GEN_BRANCH] = 2, [GEN_JMP] = 3, [GEN_JSR] = 3, [GEN_JUNK] = 1,
+    [GEN_SPLIT_LOAD] = 3, [GEN_SPLIT_CMP] = 2,
+};
+
+// A later instruction start (or the exit) within reach of from, or from
+static unsigned short forward_target(unsigned long long *rng, const unsigned short *starts, int count, int from,
+                                     unsigned int reach) {
+    int last = from;
+    while (last + 1 < count && starts[last + 1] - starts[from] <= reach) {
+        last++;
+    }
+    return starts[from + next_random(rng) % (last - from + 1)];
+}
+
+// Random registers and zero page: what differs between the lanes
+static void vary(unsigned long long *rng, CPU6502 *cpu) {
+    for (int i = 0; i < 0x100; i++) {
+        cpu->mem[i] = next_random(rng) % GEN_SPLIT_VALUES;
+    }
+    cpu->a = next_random(rng);
+    cpu->x = next_random(rng);
+    cpu->y = next_random(rng);
+    cpu->p = next_random(rng) & 3;
+}
+
+// Fill mem with a random program at DIFFTEST_RANDOM_START that ends in
+// an exit host call, random data around it (small numbers in the zero
+// page), and random registers; returns the address after the program
+static unsigned short generate(unsigned long long *rng, CPU6502 *cpu) {
+    unsigned char *mem = cpu->mem;
+    unsigned char kinds[DIFFTEST_RANDOM_LENGTH];
+    unsigned short starts[DIFFTEST_RANDOM_LENGTH + 1];
+    memset(mem, 0, MEMORY_SIZE);
+    for (int i = 0x100; i < 0x400; i++) {
+        mem[i] = next_random(rng);
+    }
+    // Layout first, so jumps and branches can pick later instructions
+    unsigned short pc = DIFFTEST_RANDOM_START;
+    int split = 0; // instructions left of a split branch
+    for (int i = 0; i < DIFFTEST_RANDOM_LENGTH; i++) {
+        unsigned int r = next_random(rng);
+        const GenOp *op;
+        if (split > 0) {
+            op = split == 1 ? &gen_split[2 + r % 2] : &gen_split[1];
+            split--;
+        } else if (r % 64 == 2 && i + 3 <= DIFFTEST_RANDOM_LENGTH) {
+            op = &gen_split[0];
+            split = 2;
+        } else {
+            op = r % 64 == 0 ? &gen_rts : r % 64 == 1 ? &gen_junk : &gen_ops[(r >> 8) % (sizeof(gen_ops) / sizeof(gen_ops[0]))];
+        }
+        kinds[i] = op->kind;
+        starts[i] = pc;
+        mem[pc] = op->kind == GEN_JUNK ? next_random(rng) : op->opcode;
+        pc += gen_length[op->kind];
+    }
+    starts[DIFFTEST_RANDOM_LENGTH] = pc;
+    for (int i = 0; i < DIFFTEST_RANDOM_LENGTH; i++) {
+        unsigned char *operand = mem + starts[i] + 1;
+        unsigned int r = next_random(rng);
+        unsigned short address;
+        switch (kinds[i]) {
+            case GEN_IMM:
+            case GEN_ZP:
+                operand[0] = r;
+                break;
+            case GEN_LOAD:
+                address = r & 1 ? (r >> 8) & 0x3FF : r >> 16;
+                operand[0] = address;
+                operand[1] = address >> 8;
+                break;
+            case GEN_STORE:
+                // Mostly data, sometimes the program itself
+                address = r % 8 == 0 ? DIFFTEST_RANDOM_START + (r >> 8) % (pc - DIFFTEST_RANDOM_START)
+                                     : 0x200 + ((r >> 8) & 0x1FF);
+                operand[0] = address;
+                operand[1] = address >> 8;
+                break;
+            case GEN_INC:
+                operand[0] = r;
+                operand[1] = r >> 8;
+                break;
+            case GEN_SPLIT_LOAD:
+                operand[0] = r;
+                operand[1] = 0;
+                break;
+            case GEN_SPLIT_CMP:
+                operand[0] = r % GEN_SPLIT_VALUES;
+                break;
+            case GEN_BRANCH:
+                operand[0] = forward_target(rng, starts, DIFFTEST_RANDOM_LENGTH + 1, i + 1, 127) - starts[i + 1];
+                break;
+            case GEN_JMP:
+            case GEN_JSR:
+                address = forward_target(rng, starts, DIFFTEST_RANDOM_LENGTH + 1, i + 1, 64);
+                if (kinds[i] == GEN_JMP && r % 4 == 0) {
+                    // A loop, left by a branch or after DIFFTEST_RANDOM_BUDGET
+                    address = starts[(r >> 8) % (i + 1)];
+                }
+                if (kinds[i] == GEN_JSR && r % 3 == 0) {
+                    // Console host calls (file I/O would be shared between
+                    // the engines)
+                    address = r % 4 == 0 ? HOSTCALL_PUTCHAR + (r >> 8) % 5 : HOSTCALL_PUTCHAR;
+                }
+                operand[0] = address;
+                operand[1] = address >> 8;
+                break;
+        }
+    }
+    // Exit
+    mem[pc++] = 0xA9;
+    mem[pc++] = next_random(rng);
+    mem[pc++] = 0x20;
+    mem[pc++] = HOSTCALL_EXIT;
+    mem[pc++] = 0x00;
+    cpu->pc = DIFFTEST_RANDOM_START;
+    vary(rng, cpu);
+    return pc;
+}
+
+int difftest_random(const char *engine, unsigned long seed, int count, unsigned long interval, FILE *out) {
+    static unsigned char mem[DIFFTEST_LANES][MEMORY_SIZE];
+    static unsigned char input[DIFFTEST_LANES][64];
+    CPU6502 cpus[DIFFTEST_LANES];
+    const unsigned char *inputs[DIFFTEST_LANES];
+    size_t input_lens[DIFFTEST_LANES];
+    int lanes = strcmp(engine, "batch") == 0 ? DIFFTEST_LANES : 1;
+    unsigned long instructions = 0;
+    unsigned long splits = 0;
+    int failures = 0;
+    int halted = 0;
+    for (int i = 0; i < count; i++) {
+        unsigned long long rng = (seed + i) * 0x9E3779B97F4A7C15ULL + 1;
+        DiffResult result;
+        unsigned short end = 0;
+        for (int lane = 0; lane < lanes; lane++) {
+            cpu_init(&cpus[lane]);
+            cpus[lane].mem = mem[lane];
+            if (lane == 0) {
+                end = generate(&rng, &cpus[0]);
+            } else {
+                memcpy(mem[lane], mem[0], MEMORY_SIZE);
+                vary(&rng, &cpus[lane]);
+                cpus[lane].pc = cpus[0].pc;
+            }
+            input_lens[lane] = next_random(&rng) % sizeof(input[lane]);
+            for (size_t j = 0; j < input_lens[lane]; j++) {
+                unsigned int r = next_random(&rng);
+                input[lane][j] = r % 8 == 0 ? '\n' : 'A' + r % 26;
+            }
+            inputs[lane] = input[lane];
+        }
+        int status;
+        if (lanes > 1) {
+            status = difftest_lanes(cpus, inputs, input_lens, lanes, interval, DIFFTEST_RANDOM_BUDGET, out, &result);
+        } else {
+            status = difftest_run(engine, &cpus[0], inputs[0], input_lens[0], interval, DIFFTEST_RANDOM_BUDGET, out,
+                                  &result);
+        }
+        if (status < 0) {
+            return -1;
+        }
+        instructions += result.instructions;
+        splits += result.splits;
+        halted += result.stopped;
+        if (status) {
+            // The engines ran on copies: mem still holds the program
+            fprintf(out, "difftest: random program %lu (--seed %lu) diverged; the program:\n", seed + i, seed + i);
+            memview_dump(out, mem[0], DIFFTEST_RANDOM_START, end - 1);
+            failures++;
+        }
+    }
+    fprintf(out, "difftest: %d random programs against %s", count, engine);
+    if (lanes > 1) {
+        fprintf(out, " on %d lanes (%lu splits)", lanes, splits);
+    }
+    fprintf(out, ", %lu instructions, %d stopped, %d diverged\n", instructions, halted, failures);
+    return failures;
+}
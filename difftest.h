@@ -0,0 +1,70 @@
+/*6502 emul - differential testing of execution engines*/
+#ifndef DIFFTEST_H
+#define DIFFTEST_H
+#include <stddef.h>
+#include <stdio.h>
+#include "cpu6502.h"
+#include "console.h"
+
+// Instructions between state hash checks
+#define DIFFTEST_DEFAULT_INTERVAL 10000
+// Instructions each random program may run
+#define DIFFTEST_RANDOM_BUDGET 100000
+// Random programs: instructions generated from this address on
+#define DIFFTEST_RANDOM_START 0x0400
+#define DIFFTEST_RANDOM_LENGTH 192
+// Batch lanes each random program runs on
+#define DIFFTEST_LANES 8
+
+// An execution engine: a way of running a machine that must behave
+// exactly like execute_instruction. Its state is a CPU6502 the caller
+// may read and change between runs (registers, stack, stop code and
+// memory).
+typedef struct Engine Engine;
+struct Engine {
+    const char *name;
+    // Run n instructions, fewer if the machine stops; returns how many
+    unsigned long (*run)(Engine *e, unsigned long n);
+    CPU6502 *(*state)(Engine *e);
+    void (*free)(Engine *e);
+};
+
+// Engine names for engine_create, separated by spaces
+#define ENGINE_NAMES "reference batch"
+
+// Engine by name, starting from a copy of cpu (registers and memory)
+// whose host calls use console; NULL if there is no such engine
+Engine *engine_create(const char *name, const CPU6502 *cpu, Console *console);
+
+typedef struct {
+    unsigned long instructions; // run by each engine
+    unsigned long checks;       // state hashes compared
+    unsigned long long hash;    // rolling hash of the states checked
+    unsigned long diverged;     // first instruction whose effect differs, 0 if none
+    unsigned long probes;       // bisection reruns
+    unsigned long stopped;      // machines that stopped within the budget
+    unsigned long splits;       // times the batch lanes split
+} DiffResult;
+
+// Run the machine in cpu on the reference engine and on engine side by
+// side for at most budget instructions, each reading input through its
+// console, and compare hashes of their state (registers, stack, memory,
+// console input and output) every interval instructions. On a mismatch
+// the interval is bisected from the last matching state to the first
+// instruction whose effect differs, and both states are printed to out.
+// Returns 0 when the engines agree, 1 when they diverge, -1 if engine
+// does not exist.
+int difftest_run(const char *engine, const CPU6502 *cpu, const unsigned char *input, size_t input_len,
+                 unsigned long interval, unsigned long budget, FILE *out, DiffResult *result);
+
+// Stress test: count random programs (straight-line code with forward
+// branches, jumps and calls, self-modifying stores, console host calls
+// and an exit) from seed, each run with difftest_run on random input.
+// The batch engine instead runs each program on DIFFTEST_LANES lanes
+// with registers, zero page and input of their own, and branches on
+// the zero page so that the lanes split; each lane is compared with a
+// reference machine of its own. A diverging program is printed with
+// its seed. Returns the number of programs that diverged, or -1 if
+// engine does not exist.
+int difftest_random(const char *engine, unsigned long seed, int count, unsigned long interval, FILE *out);
+#endif
@@ -0,0 +1,462 @@
+/*6502 emul - thread-pool farm of independent machines*/
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "console.h"
+#include "fileio.h"
+#include "loader.h"
+#include "farm.h"
+
+static void *farm_alloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (p == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+Farm *farm_create(void) {
+    Farm *farm = calloc(1, sizeof(Farm));
+    if (farm == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    farm->width = 1;
+    farm->slice = FARM_DEFAULT_SLICE;
+    return farm;
+}
+
+int farm_add_image(Farm *farm, const char *path, const unsigned char *mem, unsigned short start) {
+    FarmImage *image = farm_alloc(NULL, sizeof(FarmImage));
+    image->path = strdup(path);
+    image->start = start;
+    memcpy(image->mem, mem, MEMORY_SIZE);
+    farm->images = farm_alloc(farm->images, (farm->image_count + 1) * sizeof(FarmImage *));
+    farm->images[farm->image_count] = image;
+    return farm->image_count++;
+}
+
+FarmJob *farm_add_job(Farm *farm, const char *name, int image, const unsigned char *input, size_t input_len,
+                      unsigned long budget) {
+    if (farm->job_count == farm->job_size) {
+        farm->job_size = farm->job_size ? farm->job_size * 2 : 64;
+        farm->jobs = farm_alloc(farm->jobs, farm->job_size * sizeof(FarmJob));
+    }
+    FarmJob *job = &farm->jobs[farm->job_count++];
+    memset(job, 0, sizeof(*job));
+    job->name = strdup(name);
+    job->image = image;
+    job->input = input;
+    job->input_len = input_len;
+    job->budget = budget;
+    return job;
+}
+
+// Whole file into a malloc'd buffer
+static unsigned char *read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    unsigned char *data = farm_alloc(NULL, st.st_size ? st.st_size : 1);
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + done, st.st_size - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    *len = done;
+    return data;
+}
+
+Farm *farm_load(const char *list) {
+    FILE *f = fopen(list, "r");
+    if (f == NULL) {
+        perror(list);
+        return NULL;
+    }
+    Farm *farm = farm_create();
+    static unsigned char mem[MEMORY_SIZE];
+    char line[4096];
+    int number = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char program[1024], input[1024];
+        unsigned long budget = FARM_DEFAULT_BUDGET;
+        number++;
+        int fields = sscanf(line, "%1023s %1023s %lu", program, input, &budget);
+        if (fields <= 0 || program[0] == '#') {
+            continue;
+        }
+        // Programs are loaded once, however many jobs run them
+        int image = -1;
+        for (int i = 0; i < farm->image_count; i++) {
+            if (strcmp(farm->images[i]->path, program) == 0) {
+                image = i;
+            }
+        }
+        if (image < 0) {
+            unsigned short start = LOAD_DEFAULT_ADDRESS;
+            memset(mem, 0, MEMORY_SIZE);
+            if (load_program(program, mem, LOAD_AUTO, LOAD_DEFAULT_ADDRESS, &start) < 0) {
+                printf("%s:%d: cannot load %s\n", list, number, program);
+                fclose(f);
+                farm_free(farm);
+                return NULL;
+            }
+            image = farm_add_image(farm, program, mem, start);
+        }
+        unsigned char *data = NULL;
+        size_t len = 0;
+        if (fields >= 2 && strcmp(input, "-") != 0 && (data = read_file(input, &len)) == NULL) {
+            fclose(f);
+            farm_free(farm);
+            return NULL;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%d", farm->job_count + 1);
+        farm_add_job(farm, name, image, data, len, budget)->input_owned = data;
+    }
+    fclose(f);
+    return farm;
+}
+
+// Console of one job: input from memory, output collected up to
+// FARM_OUTPUT_LIMIT. Never returns CONSOLE_AGAIN, so jobs never wait.
+typedef struct {
+    Console console; // first, so the host calls get back to the job
+    FarmJob *job;
+    size_t in_pos;
+    size_t out_size;
+} JobConsole;
+
+static int job_getc(Console *con) {
+    JobConsole *c = (JobConsole *)con;
+    if (c->in_pos >= c->job->input_len) {
+        return EOF;
+    }
+    return c->job->input[c->in_pos++];
+}
+
+static int job_gets(Console *con, char *buf, unsigned int size) {
+    JobConsole *c = (JobConsole *)con;
+    size_t left = c->job->input_len - c->in_pos;
+    if (left == 0) {
+        return EOF;
+    }
+    const unsigned char *start = c->job->input + c->in_pos;
+    unsigned int len = left < size - 1 ? left : size - 1;
+    const unsigned char *nl = memchr(start, '\n', len);
+    if (nl) {
+        len = nl - start + 1;
+    }
+    memcpy(buf, start, len);
+    buf[len] = 0;
+    c->in_pos += len;
+    return len;
+}
+
+static int job_write(Console *con, const unsigned char *buf, unsigned int len) {
+    JobConsole *c = (JobConsole *)con;
+    FarmJob *job = c->job;
+    size_t keep = job->output_len < FARM_OUTPUT_LIMIT ? FARM_OUTPUT_LIMIT - job->output_len : 0;
+    if (keep > len) {
+        keep = len;
+    }
+    if (keep > 0 && job->output_len + keep > c->out_size) {
+        size_t size = c->out_size ? c->out_size : 256;
+        while (size < job->output_len + keep) {
+            size *= 2;
+        }
+        job->output = farm_alloc(job->output, size);
+        c->out_size = size;
+    }
+    memcpy(job->output + job->output_len, buf, keep);
+    job->output_len += len;
+    return 0;
+}
+
+// Each worker owns the slice [head, tail) of the shared order array:
+// it takes jobs from the tail, thieves take half of what is left from
+// the head. A worker only steals once its own slice is empty.
+typedef struct {
+    pthread_t thread;
+    Farm *farm;
+    int id;
+    int count;
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+    unsigned long jobs_run;
+    unsigned long steals;
+} Worker;
+
+// A job in flight on a worker, with its own machine memory and guest
+// file handles
+typedef struct {
+    FarmJob *job;
+    JobConsole con;
+    CPU6502 cpu;
+    FileTable files;
+    unsigned long count;
+} Slot;
+
+static int *order;
+
+static void start_job(Worker *w, Slot *s, FarmJob *job) {
+    const FarmImage *image = w->farm->images[job->image];
+    unsigned char *mem = s->cpu.mem;
+    s->job = job;
+    s->con = (JobConsole){ { job_getc, job_gets, job_write }, job, 0, 0 };
+    cpu_init(&s->cpu);
+    s->cpu.mem = mem;
+    s->cpu.console = &s->con.console;
+    s->cpu.pc = image->start;
+    s->count = 0;
+    memset(&s->files, 0, sizeof(s->files));
+    memcpy(mem, image->mem, MEMORY_SIZE);
+}
+
+// Run the job in s for up to slice instructions; returns 1 once it is
+// finished and its results are in the job
+static int run_slice(Slot *s, unsigned long slice) {
+    CPU6502 *cpu = &s->cpu;
+    unsigned long end = s->count + slice;
+    if (end > s->job->budget) {
+        end = s->job->budget;
+    }
+    unsigned long count = s->count;
+    while (cpu->stop == CPU_RUNNING && count < end) {
+        execute_instruction(cpu);
+        count++;
+    }
+    s->count = count;
+    if (cpu->stop == CPU_RUNNING && count < s->job->budget) {
+        return 0;
+    }
+    s->job->stop = cpu->stop;
+    s->job->exit_code = cpu->a;
+    s->job->pc = cpu->pc;
+    s->job->instructions = count;
+    return 1;
+}
+
+// Pull the lines the next slice of s starts on into the cache while
+// the current slot runs: registers, return stack, code at PC and the
+// zero page
+static void prefetch_slot(Slot *s) {
+    const unsigned char *mem = s->cpu.mem;
+    unsigned short pc = s->cpu.pc & ~63;
+    __builtin_prefetch(&s->cpu, 1);
+    __builtin_prefetch(&s->cpu.stack[s->cpu.stack_pointer], 1);
+    __builtin_prefetch(mem + pc);
+    __builtin_prefetch(mem + ((pc + 64) & 0xFFFF));
+    for (int i = 0; i < 256; i += 64) {
+        __builtin_prefetch(mem + i, 1);
+    }
+}
+
+// Next job of worker w, stealing when its slice ran out; -1 when every
+// slice is empty (no job is ever added once the pool runs)
+static int next_job(Worker *w, Worker *workers) {
+    pthread_mutex_lock(&w->lock);
+    if (w->head < w->tail) {
+        int job = order[--w->tail];
+        pthread_mutex_unlock(&w->lock);
+        return job;
+    }
+    pthread_mutex_unlock(&w->lock);
+    for (int i = 1; i < w->count; i++) {
+        Worker *victim = &workers[(w->id + i) % w->count];
+        pthread_mutex_lock(&victim->lock);
+        int left = victim->tail - victim->head;
+        if (left <= 0) {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        int take = (left + 1) / 2;
+        int head = victim->head;
+        victim->head += take;
+        pthread_mutex_unlock(&victim->lock);
+        w->steals++;
+        pthread_mutex_lock(&w->lock);
+        w->head = head;
+        w->tail = head + take - 1;
+        pthread_mutex_unlock(&w->lock);
+        return order[head + take - 1];
+    }
+    return -1;
+}
+
+static Worker *pool;
+
+// Keeps up to farm->width jobs in flight and runs them round robin,
+// farm->slice instructions at a time
+static void *worker_thread(void *arg) {
+    Worker *w = arg;
+    int width = w->farm->width;
+    Slot *slots = farm_alloc(NULL, width * sizeof(Slot));
+    unsigned char *mem = farm_alloc(NULL, (size_t)width * MEMORY_SIZE);
+    int live = 0;
+    for (int i = 0; i < width; i++) {
+        int job = next_job(w, pool);
+        slots[i].cpu.mem = mem + (size_t)i * MEMORY_SIZE;
+        slots[i].job = NULL;
+        if (job >= 0) {
+            start_job(w, &slots[i], &w->farm->jobs[job]);
+            live++;
+        }
+    }
+    for (int i = 0; live > 0; i = (i + 1) % width) {
+        Slot *s = &slots[i];
+        if (s->job == NULL) {
+            continue;
+        }
+        if (width > 1) {
+            prefetch_slot(&slots[(i + 1) % width]);
+        }
+        fileio_use(&s->files);
+        if (!run_slice(s, w->farm->slice)) {
+            continue;
+        }
+        fileio_close_all();
+        w->jobs_run++;
+        s->job = NULL;
+        live--;
+        int job = next_job(w, pool);
+        if (job >= 0) {
+            start_job(w, s, &w->farm->jobs[job]);
+            live++;
+        }
+    }
+    fileio_use(NULL);
+    free(mem);
+    free(slots);
+    return NULL;
+}
+
+int farm_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+double farm_run(Farm *farm, int threads) {
+    struct timespec t0, t1;
+    if (threads <= 0) {
+        threads = farm_threads();
+    }
+    order = farm_alloc(NULL, (farm->job_count + 1) * sizeof(int));
+    for (int i = 0; i < farm->job_count; i++) {
+        order[i] = i;
+        free(farm->jobs[i].output);
+        farm->jobs[i].output = NULL;
+        farm->jobs[i].output_len = 0;
+    }
+    pool = farm_alloc(NULL, threads * sizeof(Worker));
+    for (int i = 0; i < threads; i++) {
+        Worker *w = &pool[i];
+        w->farm = farm;
+        w->id = i;
+        w->count = threads;
+        w->head = (long)farm->job_count * i / threads;
+        w->tail = (long)farm->job_count * (i + 1) / threads;
+        w->jobs_run = 0;
+        w->steals = 0;
+        pthread_mutex_init(&w->lock, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool[i].thread, NULL, worker_thread, &pool[i]) != 0) {
+            printf("Cannot start farm worker %d\n", i);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(pool[i].thread, NULL);
+        pthread_mutex_destroy(&pool[i].lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(pool);
+    free(order);
+    pool = NULL;
+    order = NULL;
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static void job_status(const FarmJob *job, char *buf, size_t size) {
+    switch (job->stop) {
+        case CPU_HALTED:
+            snprintf(buf, size, "exit %d", job->exit_code);
+            break;
+        case CPU_RUNNING:
+            snprintf(buf, size, "budget exhausted at $%04X", job->pc);
+            break;
+        case CPU_BAD_OPCODE:
+            snprintf(buf, size, "unrecognized opcode at $%04X", job->pc);
+            break;
+        case CPU_STACK_OVERFLOW:
+            snprintf(buf, size, "stack overflow at $%04X", job->pc);
+            break;
+        case CPU_STACK_UNDERFLOW:
+            snprintf(buf, size, "stack underflow at $%04X", job->pc);
+            break;
+        default:
+            snprintf(buf, size, "stopped (%d) at $%04X", job->stop, job->pc);
+            break;
+    }
+}
+
+int farm_report(Farm *farm, FILE *out, const char *out_dir) {
+    int failed = 0;
+    for (int i = 0; i < farm->job_count; i++) {
+        FarmJob *job = &farm->jobs[i];
+        char status[64];
+        job_status(job, status, sizeof(status));
+        fprintf(out, "%s %s: %s, %lu instructions, %zu bytes output\n", job->name,
+                farm->images[job->image]->path, status, job->instructions, job->output_len);
+        if (job->stop != CPU_HALTED || job->exit_code != 0) {
+            failed = 1;
+        }
+        if (out_dir) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s.out", out_dir, job->name);
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            size_t len = job->output_len < FARM_OUTPUT_LIMIT ? job->output_len : FARM_OUTPUT_LIMIT;
+            if (fd < 0 || write(fd, job->output, len) != (ssize_t)len) {
+                perror(path);
+                failed = 1;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    return failed;
+}
+
+void farm_free(Farm *farm) {
+    for (int i = 0; i < farm->image_count; i++) {
+        free(farm->images[i]->path);
+        free(farm->images[i]);
+    }
+    for (int i = 0; i < farm->job_count; i++) {
+        free(farm->jobs[i].name);
+        free(farm->jobs[i].input_owned);
+        free(farm->jobs[i].output);
+    }
+    free(farm->images);
+    free(farm->jobs);
+    free(farm);
+}
@@ -0,0 +1,71 @@
+/*6502 emul - thread-pool farm of independent machines*/
+#ifndef FARM_H
+#define FARM_H
+#include <stddef.h>
+#include <stdio.h>
+#include "cpu6502.h"
+
+// Instructions a job may run before it is stopped
+#define FARM_DEFAULT_BUDGET 100000000UL
+// Output kept per job; the rest is counted but dropped
+#define FARM_OUTPUT_LIMIT (1024 * 1024)
+// Instructions a job runs before an interleaved worker switches to the
+// next job in flight
+#define FARM_DEFAULT_SLICE 1024
+
+// Program image shared by every job that runs it
+typedef struct {
+    char *path;
+    unsigned short start;
+    unsigned char mem[MEMORY_SIZE];
+} FarmImage;
+
+typedef struct {
+    char *name;
+    int image;
+    const unsigned char *input; // console input, EOF after input_len bytes
+    size_t input_len;
+    unsigned char *input_owned; // freed with the farm
+    unsigned long budget;
+    // Results
+    unsigned char stop; // CPU stop code; CPU_RUNNING if the budget ran out
+    unsigned char exit_code; // A when the guest exited
+    unsigned short pc;
+    unsigned long instructions;
+    unsigned char *output;
+    size_t output_len; // bytes written by the guest, kept or not
+} FarmJob;
+
+typedef struct {
+    FarmImage **images;
+    int image_count;
+    FarmJob *jobs;
+    int job_count;
+    int job_size;
+    // Jobs each worker keeps in flight, switching between them every
+    // slice instructions and prefetching the next one's hot lines
+    int width;
+    unsigned long slice;
+} Farm;
+
+Farm *farm_create(void);
+// Add a program image (copied); returns its index
+int farm_add_image(Farm *farm, const char *path, const unsigned char *mem, unsigned short start);
+// Add a job (name is copied); input must stay valid until the farm is
+// freed. The pointer is only good until the next job is added.
+FarmJob *farm_add_job(Farm *farm, const char *name, int image, const unsigned char *input, size_t input_len,
+                      unsigned long budget);
+// Read a job list: one job per line, "PROGRAM [INPUT] [BUDGET]", where
+// INPUT is a file fed to the console ("-" for none) and BUDGET an
+// instruction count; blank lines and lines starting with # are skipped.
+// Every program is loaded once. Returns NULL after printing why.
+Farm *farm_load(const char *list);
+// Run every job on a work-stealing pool of threads (0 = one per core);
+// each job gets a fresh machine. Returns the elapsed time in seconds.
+double farm_run(Farm *farm, int threads);
+// One line per job on out, each job's output to DIR/N.out when out_dir
+// is set; returns 0 if every job exited with code 0
+int farm_report(Farm *farm, FILE *out, const char *out_dir);
+void farm_free(Farm *farm);
+int farm_threads(void);
+#endif
@@ -0,0 +1,174 @@
+/*6502 emul - guest file I/O host calls*/
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "hostcall.h"
+#include "fileio.h"
+
+// Each host thread has a table of its own, used unless fileio_use
+// switched it to another, so machines run by different threads never
+// share handles
+static __thread FileTable own;
+static __thread FileTable *current;
+
+static int *table(void) {
+    return current ? current->fds : own.fds;
+}
+
+void fileio_use(FileTable *files) {
+    current = files;
+}
+
+// Host fd for a guest handle, or -1
+static int handle_fd(unsigned char handle) {
+    if (handle >= FILEIO_MAX_HANDLES) {
+        return -1;
+    }
+    return table()[handle] - 1;
+}
+
+// Parameter block at X:A, or NULL if it would run past $FFFF
+static unsigned char *param_block(CPU6502 *cpu, unsigned char *mem, int size) {
+    unsigned short address = hostcall_pointer(cpu);
+    if (address + size > MEMORY_SIZE) {
+        return NULL;
+    }
+    return mem + address;
+}
+
+static unsigned short block_word(unsigned char *block) {
+    return block[0] | (block[1] << 8);
+}
+
+// JSR $002A: open the file named in the block, handle -> A
+static void hc_open(CPU6502 *cpu, unsigned char *mem) {
+    static const int modes[] = {
+        O_RDONLY,
+        O_WRONLY | O_CREAT | O_TRUNC,
+        O_WRONLY | O_CREAT | O_APPEND,
+        O_RDWR | O_CREAT,
+    };
+    unsigned char *block = param_block(cpu, mem, 3);
+    cpu->a = 0xFF;
+    if (block == NULL) {
+        return;
+    }
+    unsigned short path = block_word(block);
+    if (block[2] > 3 || memchr(mem + path, 0, MEMORY_SIZE - path) == NULL) {
+        return;
+    }
+    int *handles = table();
+    for (int i = 0; i < FILEIO_MAX_HANDLES; i++) {
+        if (handles[i] == 0) {
+            int fd = open((const char *)(mem + path), modes[block[2]] | O_CLOEXEC, 0666);
+            if (fd >= 0) {
+                handles[i] = fd + 1;
+                cpu->a = i;
+            }
+            return;
+        }
+    }
+}
+
+// Shared by READ and WRITE: move up to length bytes between the host
+// file and guest memory, never past $FFFF
+static void transfer(CPU6502 *cpu, unsigned char *mem, int writing) {
+    unsigned char *block = param_block(cpu, mem, 5);
+    cpu->a = 0xFF;
+    if (block == NULL) {
+        return;
+    }
+    int fd = handle_fd(block[0]);
+    unsigned short buffer = block_word(block + 1);
+    unsigned int len = block_word(block + 3);
+    unsigned int done = 0;
+    if (len > MEMORY_SIZE - buffer) {
+        len = MEMORY_SIZE - buffer;
+    }
+    if (fd < 0) {
+        return;
+    }
+    while (done < len) {
+        ssize_t n = writing ? write(fd, mem + buffer + done, len - done)
+                            : read(fd, mem + buffer + done, len - done);
+        if (n < 0) {
+            return;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    block[3] = done & 0xFF;
+    block[4] = done >> 8;
+    cpu->a = 0;
+}
+
+// JSR $002B: read into a guest buffer
+static void hc_read(CPU6502 *cpu, unsigned char *mem) {
+    transfer(cpu, mem, 0);
+}
+
+// JSR $002C: write a guest buffer
+static void hc_write(CPU6502 *cpu, unsigned char *mem) {
+    transfer(cpu, mem, 1);
+}
+
+// JSR $002D: move the file position
+static void hc_seek(CPU6502 *cpu, unsigned char *mem) {
+    static const int whences[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+    unsigned char *block = param_block(cpu, mem, 6);
+    cpu->a = 0xFF;
+    if (block == NULL) {
+        return;
+    }
+    int fd = handle_fd(block[0]);
+    int offset = block[1] | (block[2] << 8) | (block[3] << 16) | ((unsigned int)block[4] << 24);
+    if (fd < 0 || block[5] > 2) {
+        return;
+    }
+    off_t pos = lseek(fd, offset, whences[block[5]]);
+    if (pos < 0) {
+        return;
+    }
+    block[1] = pos & 0xFF;
+    block[2] = (pos >> 8) & 0xFF;
+    block[3] = (pos >> 16) & 0xFF;
+    block[4] = (pos >> 24) & 0xFF;
+    cpu->a = 0;
+}
+
+// JSR $002E: release a handle
+static void hc_close(CPU6502 *cpu, unsigned char *mem) {
+    unsigned char handle = mem[hostcall_pointer(cpu)];
+    int fd = handle_fd(handle);
+    cpu->a = 0xFF;
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+    table()[handle] = 0;
+    cpu->a = 0;
+}
+
+// Close every handle the guest left open
+void fileio_close_all(void) {
+    int *handles = table();
+    for (int i = 0; i < FILEIO_MAX_HANDLES; i++) {
+        if (handles[i] > 0) {
+            close(handles[i] - 1);
+            handles[i] = 0;
+        }
+    }
+}
+
+// Install the file host calls; handles a previous machine left open on
+// this thread are closed
+void fileio_init(void) {
+    fileio_close_all();
+    hostcall_register(HOSTCALL_FOPEN, hc_open);
+    hostcall_register(HOSTCALL_FREAD, hc_read);
+    hostcall_register(HOSTCALL_FWRITE, hc_write);
+    hostcall_register(HOSTCALL_FSEEK, hc_seek);
+    hostcall_register(HOSTCALL_FCLOSE, hc_close);
+}
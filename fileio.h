@@ -0,0 +1,37 @@
+/*6502 emul - guest file I/O host calls*/
+#ifndef FILEIO_H
+#define FILEIO_H
+// Every call takes a parameter block at X:A (A = low, X = high) and
+// returns A = $00 on success, $FF on error. Data moves straight between
+// the host file and the guest buffer in memory[].
+//
+// OPEN  block: +0 path lo, +1 path hi (NUL-terminated), +2 mode
+//       mode 0 = read, 1 = write (create/truncate), 2 = append, 3 = read/write
+//       returns the handle in A ($FF on error)
+// READ  block: +0 handle, +1 buffer lo, +2 buffer hi, +3 length lo, +4 length hi
+// WRITE       bytes transferred are stored back in +3/+4 (0 = end of file)
+// SEEK  block: +0 handle, +1..+4 offset (signed, little endian), +5 whence
+//       (0 = set, 1 = current, 2 = end); the new position is stored in +1..+4
+// CLOSE block: +0 handle
+#define HOSTCALL_FOPEN  0x002A
+#define HOSTCALL_FREAD  0x002B
+#define HOSTCALL_FWRITE 0x002C
+#define HOSTCALL_FSEEK  0x002D
+#define HOSTCALL_FCLOSE 0x002E
+
+#define FILEIO_MAX_HANDLES 16
+
+// Host file descriptor plus one behind each guest handle (0 = free, so
+// a zeroed table is empty)
+typedef struct {
+    int fds[FILEIO_MAX_HANDLES];
+} FileTable;
+
+// Handle tables are per thread and start empty; fileio_init and
+// fileio_close_all close the calling thread's open handles
+void fileio_init(void);
+void fileio_close_all(void);
+// Make files the calling thread's handle table, NULL for the thread's
+// own; lets one thread interleave machines that each keep their handles
+void fileio_use(FileTable *files);
+#endif
@@ -0,0 +1,113 @@
+/*6502 emul - headless filter console (stdin to stdout pipelines)*/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "filter.h"
+
+typedef struct {
+    Console console; // first, so the host calls get back to the filter
+    int in_fd;
+    int out_fd;
+    int eof;
+    unsigned char *in;
+    unsigned int in_head;
+    unsigned int in_len;
+    unsigned char *out;
+    unsigned int out_len;
+} Filter;
+
+static void filter_flush(Filter *f) {
+    unsigned int done = 0;
+    while (done < f->out_len) {
+        ssize_t n = write(f->out_fd, f->out + done, f->out_len - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    f->out_len = 0;
+}
+
+// Make input available; returns 0 once the input is exhausted
+static int filter_fill(Filter *f) {
+    if (f->in_head < f->in_len) {
+        return 1;
+    }
+    if (f->eof) {
+        return 0;
+    }
+    ssize_t n = read(f->in_fd, f->in, FILTER_BUFFER_SIZE);
+    if (n <= 0) {
+        f->eof = 1;
+        return 0;
+    }
+    f->in_head = 0;
+    f->in_len = n;
+    return 1;
+}
+
+static int filter_getc(Console *con) {
+    Filter *f = (Filter *)con;
+    if (!filter_fill(f)) {
+        return EOF;
+    }
+    return f->in[f->in_head++];
+}
+
+static int filter_gets(Console *con, char *buf, unsigned int size) {
+    Filter *f = (Filter *)con;
+    unsigned int len = 0;
+    while (len < size - 1 && filter_fill(f)) {
+        unsigned int n = f->in_len - f->in_head;
+        if (n > size - 1 - len) {
+            n = size - 1 - len;
+        }
+        unsigned char *nl = memchr(f->in + f->in_head, '\n', n);
+        if (nl) {
+            n = nl - (f->in + f->in_head) + 1;
+        }
+        memcpy(buf + len, f->in + f->in_head, n);
+        f->in_head += n;
+        len += n;
+        if (nl) {
+            break;
+        }
+    }
+    if (len == 0) {
+        return EOF;
+    }
+    buf[len] = 0;
+    return len;
+}
+
+static int filter_write(Console *con, const unsigned char *buf, unsigned int len) {
+    Filter *f = (Filter *)con;
+    if (f->out_len + len > FILTER_BUFFER_SIZE) {
+        filter_flush(f);
+    }
+    memcpy(f->out + f->out_len, buf, len);
+    f->out_len += len;
+    return 0;
+}
+
+Console *filter_open(int in_fd, int out_fd) {
+    Filter *f = calloc(1, sizeof(Filter));
+    if (f == NULL || (f->in = malloc(FILTER_BUFFER_SIZE)) == NULL || (f->out = malloc(FILTER_BUFFER_SIZE)) == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    f->console.getc = filter_getc;
+    f->console.gets = filter_gets;
+    f->console.write = filter_write;
+    f->in_fd = in_fd;
+    f->out_fd = out_fd;
+    return &f->console;
+}
+
+void filter_close(Console *con) {
+    Filter *f = (Filter *)con;
+    filter_flush(f);
+    free(f->in);
+    free(f->out);
+    free(f);
+}
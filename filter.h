@@ -0,0 +1,14 @@
+/*6502 emul - headless filter console (stdin to stdout pipelines)*/
+#ifndef FILTER_H
+#define FILTER_H
+#include "console.h"
+
+#define FILTER_BUFFER_SIZE (1024 * 1024)
+
+// Console reading in_fd and writing out_fd through large buffers, for
+// guests used as Unix filters. End of input is reported to the guest
+// by the host calls with the carry flag set.
+Console *filter_open(int in_fd, int out_fd);
+// Flush pending output and release the buffers
+void filter_close(Console *con);
+#endif
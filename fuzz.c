@@ -0,0 +1,422 @@
+/*6502 emul - fuzzing harness (AFL fork server, persistent mode)*/
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "coverage.h"
+#include "fileio.h"
+#include "fuzz.h"
+
+static int fuzz_getc(Console *con) {
+    FuzzTarget *t = (FuzzTarget *)con;
+    if (t->input_pos >= t->input_len) {
+        return EOF;
+    }
+    return t->input[t->input_pos++];
+}
+
+static int fuzz_gets(Console *con, char *buf, unsigned int size) {
+    FuzzTarget *t = (FuzzTarget *)con;
+    size_t left = t->input_len - t->input_pos;
+    if (left == 0) {
+        return EOF;
+    }
+    const unsigned char *start = t->input + t->input_pos;
+    unsigned int len = left < size - 1 ? left : size - 1;
+    const unsigned char *nl = memchr(start, '\n', len);
+    if (nl) {
+        len = nl - start + 1;
+    }
+    memcpy(buf, start, len);
+    buf[len] = 0;
+    t->input_pos += len;
+    return len;
+}
+
+static int fuzz_write(Console *con, const unsigned char *buf, unsigned int len) {
+    return 0;
+}
+
+void fuzz_init(FuzzTarget *t, CPU6502 *cpu, unsigned long budget) {
+    t->console.getc = fuzz_getc;
+    t->console.gets = fuzz_gets;
+    t->console.write = fuzz_write;
+    t->cpu = cpu;
+    t->budget = budget;
+    t->runs = 0;
+    t->pages_reset = 0;
+    cpu->console = &t->console;
+    t->start = *cpu;
+    memcpy(t->snapshot, cpu->mem, MEMORY_SIZE);
+}
+
+int fuzz_run(FuzzTarget *t, const unsigned char *input, size_t len) {
+    CPU6502 *cpu = t->cpu;
+    t->input = input;
+    t->input_len = len;
+    t->input_pos = 0;
+    t->runs++;
+    for (unsigned long n = 0; n < t->budget && cpu->stop == CPU_RUNNING; n++) {
+        execute_instruction(cpu);
+    }
+    return cpu->stop;
+}
+
+// Pages are compared with the snapshot rather than tracked on every
+// store: 64 KB compares in a few microseconds and also catches memory
+// written by host calls
+void fuzz_reset(FuzzTarget *t) {
+    CPU6502 *cpu = t->cpu;
+    unsigned char *mem = cpu->mem;
+    *cpu = t->start;
+    cpu->mem = mem;
+    cpu->console = &t->console;
+    for (int offset = 0; offset < MEMORY_SIZE; offset += FUZZ_PAGE_SIZE) {
+        if (memcmp(mem + offset, t->snapshot + offset, FUZZ_PAGE_SIZE) != 0) {
+            memcpy(mem + offset, t->snapshot + offset, FUZZ_PAGE_SIZE);
+            t->pages_reset++;
+        }
+    }
+    fileio_close_all();
+}
+
+// AFL rewrites the input file behind stdin before every run
+static size_t read_input(unsigned char *buf) {
+    size_t len = 0;
+    lseek(0, 0, SEEK_SET);
+    while (len < FUZZ_MAX_INPUT) {
+        ssize_t n = read(0, buf + len, FUZZ_MAX_INPUT - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    return len;
+}
+
+// Child side: run inputs until told to stop; guest crashes become
+// SIGABRT so AFL files them as crashes
+static void afl_child(FuzzTarget *t, int persistent) {
+    static unsigned char input[FUZZ_MAX_INPUT];
+    close(AFL_CONTROL_FD);
+    close(AFL_STATUS_FD);
+    for (int i = 0;; i++) {
+        size_t len = read_input(input);
+        int stop = fuzz_run(t, input, len);
+        if (stop == CPU_BAD_OPCODE || stop == CPU_STACK_OVERFLOW || stop == CPU_STACK_UNDERFLOW) {
+            abort();
+        }
+        if (!persistent || i + 1 >= FUZZ_PERSISTENT_RUNS) {
+            _exit(0);
+        }
+        raise(SIGSTOP);
+        fuzz_reset(t);
+    }
+}
+
+int fuzz_afl(FuzzTarget *t, int persistent) {
+    unsigned int hello = 0;
+    if (write(AFL_STATUS_FD, &hello, 4) != 4) {
+        return -1;
+    }
+    pid_t child = -1;
+    int stopped = 0;
+    for (;;) {
+        unsigned int was_killed;
+        int status;
+        if (read(AFL_CONTROL_FD, &was_killed, 4) != 4) {
+            exit(0);
+        }
+        // A stopped persistent child that AFL killed on a timeout
+        if (stopped && was_killed) {
+            waitpid(child, &status, 0);
+            stopped = 0;
+        }
+        if (stopped) {
+            kill(child, SIGCONT);
+            stopped = 0;
+        } else {
+            child = fork();
+            if (child < 0) {
+                perror("fork");
+                exit(1);
+            }
+            if (child == 0) {
+                afl_child(t, persistent);
+            }
+        }
+        if (write(AFL_STATUS_FD, &child, 4) != 4) {
+            exit(1);
+        }
+        if (waitpid(child, &status, persistent ? WUNTRACED : 0) < 0) {
+            perror("waitpid");
+            exit(1);
+        }
+        stopped = WIFSTOPPED(status);
+        if (write(AFL_STATUS_FD, &status, 4) != 4) {
+            exit(1);
+        }
+    }
+}
+
+static unsigned long long rng_state = 0x6502650265026502ULL;
+
+static unsigned int rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state >> 32;
+}
+
+static double clock_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    unsigned char *data[FUZZ_MAX_CORPUS];
+    size_t len[FUZZ_MAX_CORPUS];
+    int count;
+} Corpus;
+
+static void corpus_add(Corpus *corpus, const unsigned char *data, size_t len) {
+    if (corpus->count == FUZZ_MAX_CORPUS) {
+        return;
+    }
+    unsigned char *copy = malloc(len ? len : 1);
+    if (copy == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    memcpy(copy, data, len);
+    corpus->data[corpus->count] = copy;
+    corpus->len[corpus->count++] = len;
+}
+
+static void save_input(const char *dir, const char *prefix, unsigned long id, const unsigned char *data, size_t len) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s%06lu", dir, prefix, id);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || write(fd, data, len) != (ssize_t)len) {
+        perror(path);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static void load_seeds(Corpus *corpus, const char *dir) {
+    static unsigned char data[FUZZ_MAX_MUTATED];
+    DIR *d = dir ? opendir(dir) : NULL;
+    struct dirent *entry;
+    while (d && (entry = readdir(d)) != NULL) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            ssize_t n = read(fd, data, sizeof(data));
+            if (n >= 0) {
+                corpus_add(corpus, data, n);
+            }
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    if (corpus->count == 0) {
+        corpus_add(corpus, (const unsigned char *)"\n", 1);
+    }
+}
+
+// Hit counts folded into AFL's buckets: 1, 2, 3, 4-7, 8-15, 16-31,
+// 32-127, 128+
+static unsigned char bucket(unsigned char hits) {
+    static unsigned char table[256];
+    if (table[1] == 0) {
+        for (int i = 1; i < 256; i++) {
+            table[i] = i == 1 ? 1 : i == 2 ? 2 : i == 3 ? 4 : i < 8 ? 8 : i < 16 ? 16 : i < 32 ? 32 : i < 128 ? 64 : 128;
+        }
+    }
+    return table[hits];
+}
+
+// Fold the trace into virgin; returns 1 when it hit a new edge or a new
+// bucket of an old one. *edges counts entries hit for the first time.
+static int new_coverage(const unsigned char *trace, unsigned char *virgin, unsigned long *edges) {
+    const unsigned long long *words = (const unsigned long long *)trace;
+    int found = 0;
+    for (int w = 0; w < COVERAGE_MAP_SIZE / 8; w++) {
+        if (words[w] == 0) {
+            continue;
+        }
+        for (int i = w * 8; i < w * 8 + 8; i++) {
+            unsigned char b = bucket(trace[i]);
+            if (b & virgin[i]) {
+                if (virgin[i] == 0xFF && edges) {
+                    (*edges)++;
+                }
+                virgin[i] &= ~b;
+                found = 1;
+            }
+        }
+    }
+    return found;
+}
+
+// Stack a few random edits onto buf; returns the new length
+static size_t mutate(unsigned char *buf, size_t len, const Corpus *corpus) {
+    static const unsigned char interesting[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF, '\n', '0', 'A', ' ' };
+    int edits = 1 << (rng() % 4);
+    for (int e = 0; e < edits; e++) {
+        size_t pos = len ? rng() % len : 0;
+        switch (rng() % 8) {
+            case 0: // flip a bit
+                if (len) {
+                    buf[pos] ^= 1 << (rng() % 8);
+                }
+                break;
+            case 1: // random byte
+                if (len) {
+                    buf[pos] = rng();
+                }
+                break;
+            case 2: // interesting byte
+                if (len) {
+                    buf[pos] = interesting[rng() % sizeof(interesting)];
+                }
+                break;
+            case 3: // small add or subtract
+                if (len) {
+                    buf[pos] += (int)(rng() % 17) - 8;
+                }
+                break;
+            case 4: // insert a byte
+                if (len < FUZZ_MAX_MUTATED) {
+                    memmove(buf + pos + 1, buf + pos, len - pos);
+                    buf[pos] = rng();
+                    len++;
+                }
+                break;
+            case 5: // delete a byte
+                if (len > 1) {
+                    memmove(buf + pos, buf + pos + 1, len - pos - 1);
+                    len--;
+                }
+                break;
+            case 6: { // duplicate a chunk
+                size_t n = len ? 1 + rng() % (len - pos) : 0;
+                if (n && len + n <= FUZZ_MAX_MUTATED) {
+                    memmove(buf + pos + n, buf + pos, len - pos);
+                    len += n;
+                }
+                break;
+            }
+            case 7: { // splice: the tail of another corpus input
+                int other = rng() % corpus->count;
+                size_t from = corpus->len[other] ? rng() % corpus->len[other] : 0;
+                size_t n = corpus->len[other] - from;
+                if (pos + n > FUZZ_MAX_MUTATED) {
+                    n = FUZZ_MAX_MUTATED - pos;
+                }
+                memcpy(buf + pos, corpus->data[other] + from, n);
+                len = pos + n;
+                break;
+            }
+        }
+    }
+    return len;
+}
+
+int fuzz_campaign(FuzzTarget *t, FuzzCampaign *c) {
+    static Corpus corpus;
+    static unsigned char buf[FUZZ_MAX_MUTATED];
+    unsigned char *trace = calloc(1, COVERAGE_MAP_SIZE);
+    unsigned char *virgin = malloc(COVERAGE_MAP_SIZE);
+    unsigned char *virgin_crash = malloc(COVERAGE_MAP_SIZE);
+    if (trace == NULL || virgin == NULL || virgin_crash == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    memset(virgin, 0xFF, COVERAGE_MAP_SIZE);
+    memset(virgin_crash, 0xFF, COVERAGE_MAP_SIZE);
+    t->cpu->coverage = trace;
+    t->cpu->coverage_prev = 0;
+    t->start.coverage = trace;
+    t->start.coverage_prev = 0;
+    corpus.count = 0;
+    load_seeds(&corpus, c->corpus_dir);
+    int seeds = corpus.count;
+    c->runs = c->crashes = c->hangs = c->edges = 0;
+    c->first_crash = -1;
+
+    double start = clock_now(), last_report = start;
+    unsigned long last_runs = 0, last_edges = 0;
+    for (unsigned long n = 0; n < c->max_runs; n++) {
+        size_t len;
+        // Seeds run once as they are, then mutated corpus inputs
+        if (n < seeds) {
+            len = corpus.len[n];
+            memcpy(buf, corpus.data[n], len);
+        } else {
+            int pick = rng() % corpus.count;
+            len = corpus.len[pick];
+            memcpy(buf, corpus.data[pick], len);
+            len = mutate(buf, len, &corpus);
+        }
+        memset(trace, 0, COVERAGE_MAP_SIZE);
+        int stop = fuzz_run(t, buf, len);
+        c->runs++;
+        if (stop == CPU_BAD_OPCODE || stop == CPU_STACK_OVERFLOW || stop == CPU_STACK_UNDERFLOW) {
+            c->crashes++;
+            if (c->first_crash < 0) {
+                c->first_crash = clock_now() - start;
+            }
+            if (new_coverage(trace, virgin_crash, NULL) && c->crash_dir) {
+                save_input(c->crash_dir, "crash-", c->crashes, buf, len);
+            }
+        } else if (stop == CPU_RUNNING) {
+            c->hangs++;
+        } else if (new_coverage(trace, virgin, &c->edges) && n >= seeds) {
+            corpus_add(&corpus, buf, len);
+            if (c->corpus_dir) {
+                save_input(c->corpus_dir, "id-", corpus.count, buf, len);
+            }
+        }
+        fuzz_reset(t);
+        if (c->crashes && c->stop_on_crash) {
+            break;
+        }
+        if (c->report && (n & 1023) == 0) {
+            double now = clock_now();
+            if (now - last_report >= 1) {
+                fprintf(stderr, "fuzz: %lu runs, %.0f execs/s, corpus %d, %lu edges (+%.1f/s), %lu crashes, %lu hangs\n",
+                        c->runs, (c->runs - last_runs) / (now - last_report), corpus.count, c->edges,
+                        (c->edges - last_edges) / (now - last_report), c->crashes, c->hangs);
+                last_report = now;
+                last_runs = c->runs;
+                last_edges = c->edges;
+            }
+        }
+    }
+    c->elapsed = clock_now() - start;
+    c->corpus = corpus.count;
+    t->cpu->coverage = NULL;
+    t->start.coverage = NULL;
+    for (int i = 0; i < corpus.count; i++) {
+        free(corpus.data[i]);
+    }
+    free(trace);
+    free(virgin);
+    free(virgin_crash);
+    return c->crashes ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+/*6502 emul - fuzzing harness (AFL fork server, persistent mode)*/
+#ifndef FUZZ_H
+#define FUZZ_H
+#include <stddef.h>
+#include "cpu6502.h"
+#include "console.h"
+
+// Instructions one input may run; more counts as a hang
+#define FUZZ_DEFAULT_BUDGET 10000000UL
+// Inputs a persistent-mode child runs before AFL starts a fresh one
+#define FUZZ_PERSISTENT_RUNS 10000
+// Largest input read from stdin
+#define FUZZ_MAX_INPUT (1024 * 1024)
+// Granularity of the reset between inputs
+#define FUZZ_PAGE_SIZE 256
+
+// AFL fork server descriptors
+#define AFL_CONTROL_FD 198
+#define AFL_STATUS_FD 199
+
+// A loaded machine and the snapshot every input starts from. The guest
+// reads the input through its console (GETCHAR, GETS); its output is
+// dropped.
+typedef struct {
+    Console console; // first, so the host calls get back to the target
+    CPU6502 *cpu;
+    CPU6502 start;
+    unsigned char snapshot[MEMORY_SIZE];
+    unsigned long budget;
+    const unsigned char *input;
+    size_t input_len;
+    size_t input_pos;
+    // Counters
+    unsigned long runs;
+    unsigned long pages_reset;
+} FuzzTarget;
+
+// Snapshot cpu (registers and memory) as the start of every input
+void fuzz_init(FuzzTarget *t, CPU6502 *cpu, unsigned long budget);
+// Run one input from the current state; returns the stop code, or
+// CPU_RUNNING when the budget ran out
+int fuzz_run(FuzzTarget *t, const unsigned char *input, size_t len);
+// Back to the snapshot: registers, open files, and the memory pages that
+// differ from it
+void fuzz_reset(FuzzTarget *t);
+// Serve AFL over AFL_CONTROL_FD/AFL_STATUS_FD, reading each input from
+// stdin. Fork mode forks a child per input off the loaded machine;
+// persistent mode keeps one child running FUZZ_PERSISTENT_RUNS inputs,
+// stopping itself (SIGSTOP) after each one and resetting in between
+// (run afl-fuzz with AFL_PERSISTENT=1). Guest crashes abort the child.
+// Returns -1 at once when not started by AFL, otherwise never returns.
+int fuzz_afl(FuzzTarget *t, int persistent);
+
+// Built-in coverage-guided fuzzer: mutates corpus inputs, runs them
+// with an edge map (coverage.h) and keeps those that reach new edges
+// or new hit-count buckets, as AFL does
+#define FUZZ_MAX_CORPUS 4096
+#define FUZZ_MAX_MUTATED 4096 // longest input the mutator builds
+
+typedef struct {
+    const char *corpus_dir; // seeds are read from and new inputs written
+                            // to it; NULL starts from a single newline
+    const char *crash_dir;  // inputs reaching new crash edges, or NULL
+    unsigned long max_runs;
+    int stop_on_crash;
+    int report;             // progress on stderr every second
+    // Results
+    unsigned long runs;
+    unsigned long crashes;
+    unsigned long hangs;    // budget ran out
+    unsigned long edges;    // map entries ever hit
+    int corpus;
+    double elapsed;
+    double first_crash;     // seconds into the campaign, -1 if none
+} FuzzCampaign;
+
+int fuzz_campaign(FuzzTarget *t, FuzzCampaign *c);
+#endif
@@ -0,0 +1,643 @@
+/*6502 emul - GDB remote serial protocol stub*/
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "gdbstub.h"
+
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<feature name=\"org.e65.cpu\">"
+    "<reg name=\"a\" bitsize=\"8\" type=\"uint8\" regnum=\"0\"/>"
+    "<reg name=\"x\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"y\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"p\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+// Connection
+
+static int read_byte(Gdb *g) {
+    if (g->in_head == g->in_len) {
+        ssize_t n = read(g->fd, g->in, sizeof(g->in));
+        if (n <= 0) {
+            return -1;
+        }
+        g->in_head = 0;
+        g->in_len = n;
+    }
+    return g->in[g->in_head++];
+}
+
+// Whether the debugger sent an interrupt (^C) while the machine runs
+static int interrupted(Gdb *g, int timeout) {
+    struct pollfd pfd = { g->fd, POLLIN, 0 };
+    while (g->in_head < g->in_len || poll(&pfd, 1, timeout) > 0) {
+        int c = read_byte(g);
+        if (c < 0 || c == 0x03) {
+            return 1;
+        }
+        timeout = 0;
+    }
+    return 0;
+}
+
+static const char hex[] = "0123456789abcdef";
+
+static int from_hex(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static int send_packet(Gdb *g, const char *data) {
+    char frame[sizeof(g->reply) + 4];
+    unsigned char sum = 0;
+    size_t len = strlen(data);
+    frame[0] = '$';
+    for (size_t i = 0; i < len; i++) {
+        sum += (unsigned char)data[i];
+    }
+    memcpy(frame + 1, data, len);
+    frame[len + 1] = '#';
+    frame[len + 2] = hex[sum >> 4];
+    frame[len + 3] = hex[sum & 15];
+    for (;;) {
+        if (write(g->fd, frame, len + 4) != (ssize_t)(len + 4)) {
+            return -1;
+        }
+        if (!g->ack) {
+            return 0;
+        }
+        // Resend on '-'
+        int c;
+        while ((c = read_byte(g)) != '+' && c != '-') {
+            if (c < 0) {
+                return -1;
+            }
+        }
+        if (c == '+') {
+            return 0;
+        }
+    }
+}
+
+// Next packet into g->packet; returns its length, or -1 when the
+// connection is gone. An interrupt while stopped reads as "?".
+static int receive_packet(Gdb *g) {
+    for (;;) {
+        int c = read_byte(g);
+        if (c < 0) {
+            return -1;
+        }
+        if (c == 0x03) {
+            strcpy(g->packet, "?");
+            return 1;
+        }
+        if (c != '$') {
+            continue; // acks and noise between packets
+        }
+        unsigned int len = 0;
+        unsigned char sum = 0;
+        while ((c = read_byte(g)) != '#') {
+            if (c < 0) {
+                return -1;
+            }
+            sum += c;
+            if (len < GDB_PACKET_SIZE) {
+                g->packet[len++] = c;
+            }
+        }
+        int high = read_byte(g);
+        int low = read_byte(g);
+        if (low < 0) {
+            return -1;
+        }
+        g->packet[len] = 0;
+        if (!g->ack) {
+            return len;
+        }
+        if (from_hex(high) * 16 + from_hex(low) == sum) {
+            write(g->fd, "+", 1);
+            return len;
+        }
+        write(g->fd, "-", 1);
+    }
+}
+
+// Packets
+
+static char *put_hex(char *out, const unsigned char *bytes, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        *out++ = hex[bytes[i] >> 4];
+        *out++ = hex[bytes[i] & 15];
+    }
+    *out = 0;
+    return out;
+}
+
+// Up to n bytes of hex at text; returns the number decoded
+static unsigned int get_hex(const char *text, unsigned char *bytes, unsigned int n) {
+    unsigned int i = 0;
+    while (i < n && from_hex(text[2 * i]) >= 0 && from_hex(text[2 * i + 1]) >= 0) {
+        bytes[i] = from_hex(text[2 * i]) * 16 + from_hex(text[2 * i + 1]);
+        i++;
+    }
+    return i;
+}
+
+static void get_registers(CPU6502 *cpu, unsigned char *regs) {
+    regs[0] = cpu->a;
+    regs[1] = cpu->x;
+    regs[2] = cpu->y;
+    regs[3] = cpu->p;
+    regs[4] = cpu->sp;
+    regs[5] = cpu->pc;
+    regs[6] = cpu->pc >> 8;
+}
+
+static void set_registers(CPU6502 *cpu, const unsigned char *regs, unsigned int first, unsigned int n) {
+    unsigned char all[7];
+    get_registers(cpu, all);
+    memcpy(all + first, regs, n);
+    cpu->a = all[0];
+    cpu->x = all[1];
+    cpu->y = all[2];
+    cpu->p = all[3];
+    cpu->sp = all[4];
+    cpu->pc = all[5] | all[6] << 8;
+}
+
+// Register number to its offset and size in the 'g' layout
+static int register_bytes(unsigned int n, unsigned int *offset) {
+    if (n > 5) {
+        return 0;
+    }
+    *offset = n;
+    return n == 5 ? 2 : 1;
+}
+
+// Stop reply for a machine that is no longer running
+static void stopped(Gdb *g) {
+    CPU6502 *cpu = g->cpu;
+    switch (cpu->stop) {
+        case CPU_HALTED:
+            snprintf(g->stop_reply, sizeof(g->stop_reply), "W%02x", cpu->a);
+            break;
+        case CPU_BAD_OPCODE:
+            strcpy(g->stop_reply, "S04"); // SIGILL
+            break;
+        default:
+            strcpy(g->stop_reply, "S0b"); // SIGSEGV: return stack
+            break;
+    }
+}
+
+// Send text to the debugger's console (an 'O' packet)
+static void console_output(Gdb *g, const char *text) {
+    g->reply[0] = 'O';
+    put_hex(g->reply + 1, (const unsigned char *)text, strlen(text) < GDB_PACKET_SIZE ? strlen(text) : GDB_PACKET_SIZE);
+    send_packet(g, g->reply);
+}
+
+// Continue until a breakpoint, a stop or an interrupt
+static void run(Gdb *g) {
+    CPU6502 *cpu = g->cpu;
+    // The breakpoint the machine is stopped on does not count
+    int resume = 1;
+    for (;;) {
+        if (cpu->stop == CPU_WAIT_IO) {
+            // Console not ready: look out for the debugger meanwhile
+            if (interrupted(g, 10)) {
+                strcpy(g->stop_reply, "S02");
+                return;
+            }
+            cpu->stop = CPU_RUNNING;
+        }
+        int status = breakpoints_run(g->breaks, cpu, g->history, GDB_POLL_SLICE, resume);
+        resume = 0;
+        if (status == BREAK_HIT) {
+            if (g->breaks->hit) {
+                char text[256];
+                breakpoint_describe(g->breaks, text, sizeof(text) - 1);
+                strcat(text, "\n");
+                console_output(g, text);
+            }
+            strcpy(g->stop_reply, "S05");
+            return;
+        }
+        if (status == BREAK_STOPPED && cpu->stop != CPU_WAIT_IO) {
+            stopped(g);
+            return;
+        }
+        if (status == BREAK_DONE && interrupted(g, 0)) {
+            strcpy(g->stop_reply, "S02");
+            return;
+        }
+    }
+}
+
+static void one_instruction(Gdb *g) {
+    if (g->history) {
+        timetravel_run(g->history, 1);
+    } else {
+        execute_instruction(g->cpu);
+    }
+}
+
+static void step(Gdb *g) {
+    CPU6502 *cpu = g->cpu;
+    if (cpu->stop == CPU_WAIT_IO) {
+        cpu->stop = CPU_RUNNING;
+    }
+    if (cpu->stop == CPU_RUNNING) {
+        one_instruction(g);
+    }
+    if (cpu->stop == CPU_RUNNING || cpu->stop == CPU_WAIT_IO) {
+        strcpy(g->stop_reply, "S05");
+    } else {
+        stopped(g);
+    }
+}
+
+// The recorded history only replays what the machine did: state written
+// by the debugger would not come back after a reverse step
+static int history_attached(Gdb *g) {
+    if (g->history) {
+        strcpy(g->reply, "E01");
+        return 1;
+    }
+    return 0;
+}
+
+static void read_memory(Gdb *g, const char *args) {
+    unsigned int address = 0;
+    unsigned int len = 0;
+    if (sscanf(args, "%x,%x", &address, &len) != 2) {
+        strcpy(g->reply, "E01");
+        return;
+    }
+    if (len > GDB_PACKET_SIZE) {
+        len = GDB_PACKET_SIZE;
+    }
+    char *out = g->reply;
+    for (unsigned int i = 0; i < len; i++) {
+        out = put_hex(out, &g->cpu->mem[(unsigned short)(address + i)], 1);
+    }
+}
+
+// 'M addr,len:hex' or 'X addr,len:binary'
+static void write_memory(Gdb *g, const char *args, int len, int binary) {
+    unsigned int address = 0;
+    unsigned int n = 0;
+    const char *data = memchr(args, ':', len);
+    if (sscanf(args, "%x,%x", &address, &n) != 2 || data == NULL) {
+        strcpy(g->reply, "E01");
+        return;
+    }
+    data++;
+    const char *end = args + len;
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned char byte;
+        if (binary) {
+            if (data >= end) {
+                break;
+            }
+            byte = *data++;
+            if (byte == '}' && data < end) {
+                byte = *data++ ^ 0x20;
+            }
+        } else if (get_hex(data, &byte, 1) == 1) {
+            data += 2;
+        } else {
+            break;
+        }
+        g->cpu->mem[(unsigned short)(address + i)] = byte;
+    }
+    strcpy(g->reply, "OK");
+}
+
+static void breakpoint(Gdb *g, const char *args, int on) {
+    unsigned int type = 0;
+    unsigned int address = 0;
+    if (sscanf(args, "%x,%x", &type, &address) != 2) {
+        strcpy(g->reply, "E01");
+        return;
+    }
+    if (type > 1) {
+        g->reply[0] = 0; // watchpoints are not supported
+        return;
+    }
+    breakpoint_set(g->breaks, address, on);
+    strcpy(g->reply, "OK");
+}
+
+// qXfer:features:read:target.xml:offset,length
+static void read_target_xml(Gdb *g, const char *args) {
+    unsigned int offset = 0;
+    unsigned int len = 0;
+    if (strncmp(args, "target.xml:", 11) != 0 || sscanf(args + 11, "%x,%x", &offset, &len) != 2) {
+        strcpy(g->reply, "E00");
+        return;
+    }
+    unsigned int size = sizeof(target_xml) - 1;
+    if (offset > size) {
+        offset = size;
+    }
+    if (len > GDB_PACKET_SIZE) {
+        len = GDB_PACKET_SIZE;
+    }
+    unsigned int n = size - offset < len ? size - offset : len;
+    g->reply[0] = offset + n < size ? 'm' : 'l';
+    memcpy(g->reply + 1, target_xml + offset, n);
+    g->reply[n + 1] = 0;
+}
+
+// monitor break EXPR, watch EXPR, delete N or info
+static void monitor(Gdb *g, const char *hex_command) {
+    char command[GDB_PACKET_SIZE / 2 + 1];
+    char text[256];
+    unsigned int n = get_hex(hex_command, (unsigned char *)command, GDB_PACKET_SIZE / 2);
+    command[n] = 0;
+    if (strncmp(command, "break ", 6) == 0 || strncmp(command, "watch ", 6) == 0) {
+        int kind = command[0] == 'w' ? BREAK_WATCH : BREAK_WHEN;
+        int number = breakpoint_add(g->breaks, command + 6, kind, g->cpu, text, sizeof(text) - 1);
+        if (number > 0) {
+            snprintf(text, sizeof(text), "%s %d\n", kind == BREAK_WATCH ? "Watch" : "Break", number);
+        } else {
+            strcat(text, "\n");
+        }
+    } else if (strncmp(command, "delete ", 7) == 0) {
+        int number = atoi(command + 7);
+        snprintf(text, sizeof(text), breakpoint_delete(g->breaks, number) < 0 ? "No breakpoint %d\n" : "Deleted %d\n",
+                 number);
+    } else if (strcmp(command, "info") == 0) {
+        char *report = NULL;
+        size_t size = 0;
+        FILE *out = open_memstream(&report, &size);
+        breakpoints_report(g->breaks, out);
+        fclose(out);
+        // One output packet per line
+        for (char *line = report; line && *line;) {
+            char *end = strchr(line, '\n');
+            size_t len = end ? end - line + 1 : strlen(line);
+            snprintf(text, sizeof(text), "%.*s", (int)len, line);
+            console_output(g, text);
+            line += len;
+        }
+        free(report);
+        text[0] = 0;
+    } else {
+        snprintf(text, sizeof(text), "Commands: break EXPR, watch EXPR, delete N, info\n");
+    }
+    if (text[0]) {
+        console_output(g, text);
+    }
+    send_packet(g, "OK");
+}
+
+static void query(Gdb *g, const char *packet) {
+    if (strncmp(packet, "qSupported", 10) == 0) {
+        snprintf(g->reply, sizeof(g->reply), "PacketSize=%x;QStartNoAckMode+;qXfer:features:read+%s",
+                 GDB_PACKET_SIZE, g->history ? ";ReverseStep+" : "");
+    } else if (strcmp(packet, "QStartNoAckMode") == 0) {
+        send_packet(g, "OK");
+        g->ack = 0;
+        g->reply[0] = 0;
+        return;
+    } else if (strncmp(packet, "qXfer:features:read:", 20) == 0) {
+        read_target_xml(g, packet + 20);
+    } else if (strncmp(packet, "qRcmd,", 6) == 0) {
+        monitor(g, packet + 6);
+        return;
+    } else if (strcmp(packet, "qAttached") == 0) {
+        strcpy(g->reply, "1");
+    } else if (strcmp(packet, "qC") == 0) {
+        strcpy(g->reply, "QC1");
+    } else if (strcmp(packet, "qfThreadInfo") == 0) {
+        strcpy(g->reply, "m1");
+    } else if (strcmp(packet, "qsThreadInfo") == 0) {
+        strcpy(g->reply, "l");
+    } else {
+        g->reply[0] = 0;
+    }
+    send_packet(g, g->reply);
+}
+
+// Serve one debugger connection
+static int session(Gdb *g) {
+    CPU6502 *cpu = g->cpu;
+    int len;
+    g->ack = 1;
+    strcpy(g->stop_reply, "S05");
+    while ((len = receive_packet(g)) >= 0) {
+        char *p = g->packet;
+        unsigned char bytes[GDB_PACKET_SIZE / 2];
+        unsigned int n;
+        unsigned int offset;
+        g->reply[0] = 0;
+        if (p[0] == 'q' || p[0] == 'Q') {
+            query(g, p);
+            continue;
+        }
+        switch (p[0]) {
+            case '?':
+                strcpy(g->reply, g->stop_reply);
+                break;
+            case 'g':
+                get_registers(cpu, bytes);
+                put_hex(g->reply, bytes, 7);
+                break;
+            case 'G':
+                if (history_attached(g)) {
+                    break;
+                }
+                set_registers(cpu, bytes, 0, get_hex(p + 1, bytes, 7));
+                strcpy(g->reply, "OK");
+                break;
+            case 'p':
+                n = register_bytes(strtoul(p + 1, NULL, 16), &offset);
+                if (n == 0) {
+                    strcpy(g->reply, "E01");
+                    break;
+                }
+                get_registers(cpu, bytes);
+                put_hex(g->reply, bytes + offset, n);
+                break;
+            case 'P': {
+                char *value = strchr(p, '=');
+                n = register_bytes(strtoul(p + 1, NULL, 16), &offset);
+                if (history_attached(g)) {
+                    break;
+                }
+                if (n == 0 || value == NULL || get_hex(value + 1, bytes, n) != n) {
+                    strcpy(g->reply, "E01");
+                    break;
+                }
+                set_registers(cpu, bytes, offset, n);
+                strcpy(g->reply, "OK");
+                break;
+            }
+            case 'm':
+                read_memory(g, p + 1);
+                break;
+            case 'M':
+            case 'X':
+                if (history_attached(g)) {
+                    break;
+                }
+                write_memory(g, p + 1, len - 1, p[0] == 'X');
+                break;
+            case 'Z':
+            case 'z':
+                breakpoint(g, p + 1, p[0] == 'Z');
+                break;
+            case 'c':
+            case 's':
+                if (p[1] && history_attached(g)) {
+                    break;
+                }
+                if (p[1]) {
+                    cpu->pc = strtoul(p + 1, NULL, 16);
+                }
+                if (p[0] == 'c') {
+                    run(g);
+                } else {
+                    step(g);
+                }
+                strcpy(g->reply, g->stop_reply);
+                break;
+            case 'v':
+                if (strcmp(p, "vCont?") == 0) {
+                    strcpy(g->reply, "vCont;c;C;s;S");
+                } else if (strncmp(p, "vCont;", 6) == 0) {
+                    if (p[6] == 'c' || p[6] == 'C') {
+                        run(g);
+                    } else {
+                        step(g);
+                    }
+                    strcpy(g->reply, g->stop_reply);
+                }
+                break;
+            case 'b':
+                // Reverse step through the recorded history
+                if (p[1] == 's' && g->history) {
+                    if (timetravel_step_back(g->history, 1) < 0) {
+                        strcpy(g->stop_reply, "T05replaylog:begin;");
+                    } else {
+                        strcpy(g->stop_reply, "S05");
+                    }
+                    strcpy(g->reply, g->stop_reply);
+                }
+                break;
+            case 'H':
+            case 'T':
+                strcpy(g->reply, "OK");
+                break;
+            case 'D':
+                send_packet(g, "OK");
+                return GDB_DETACHED;
+            case 'k':
+                return GDB_KILLED;
+        }
+        if (send_packet(g, g->reply) < 0) {
+            break;
+        }
+    }
+    return GDB_KILLED;
+}
+
+// Listening socket for host:port, :port or a Unix socket path
+static int listen_on(const char *address) {
+    const char *colon = strrchr(address, ':');
+    int fd;
+    if (colon) {
+        struct sockaddr_in addr;
+        char host[64];
+        size_t host_len = colon - address;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(colon + 1));
+        if (host_len >= sizeof(host)) {
+            printf("Bad address: %s\n", address);
+            return -1;
+        }
+        memcpy(host, address, host_len);
+        host[host_len] = 0;
+        if (inet_pton(AF_INET, host_len ? host : "127.0.0.1", &addr.sin_addr) != 1) {
+            printf("Bad address: %s\n", address);
+            return -1;
+        }
+        int on = 1;
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        }
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+            perror(address);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            printf("Socket path too long: %s\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+        unlink(address);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+            perror(address);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+int gdb_serve(const char *address, CPU6502 *cpu, TimeTravel *history, Breakpoints *breaks) {
+    int listen_fd = listen_on(address);
+    if (listen_fd < 0) {
+        return -1;
+    }
+    fprintf(stderr, "Waiting for the debugger on %s\n", address);
+    int fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (fd < 0) {
+        perror(address);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    Gdb *g = calloc(1, sizeof(Gdb));
+    if (g == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    g->cpu = cpu;
+    g->history = history;
+    g->breaks = breaks;
+    g->fd = fd;
+    int status = session(g);
+    close(fd);
+    free(g);
+    return status;
+}
@@ -0,0 +1,45 @@
+/*6502 emul - GDB remote serial protocol stub*/
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+#include "cpu6502.h"
+#include "timetravel.h"
+#include "breakpoint.h"
+
+// Instructions run between checks for an interrupt from the debugger
+#define GDB_POLL_SLICE 100000
+#define GDB_PACKET_SIZE 4096
+
+// gdb_serve results
+#define GDB_DETACHED 0 // the machine is left to run on its own
+#define GDB_KILLED 1   // killed, or the connection was lost
+
+// Registers in 'g' packets and target.xml, in this order: A, X, Y, P,
+// SP (a byte each) and PC (two bytes, little endian). Memory accesses
+// go to RAM directly, so they never trigger device side effects.
+// Z0/Z1 breakpoints are plain breakpoints in breakpoint.h; conditions
+// and watch expressions come through monitor commands:
+//   monitor break EXPR, monitor watch EXPR, monitor delete N,
+//   monitor info (evaluations, hits and cost of each)
+typedef struct {
+    CPU6502 *cpu;
+    TimeTravel *history; // backs reverse stepping (may be NULL)
+    Breakpoints *breaks;
+    int fd;
+    int ack;             // '+' acknowledgements (until QStartNoAckMode)
+    unsigned char in[GDB_PACKET_SIZE];
+    unsigned int in_head;
+    unsigned int in_len;
+    char packet[GDB_PACKET_SIZE + 1];
+    char reply[GDB_PACKET_SIZE * 2 + 8];
+    char stop_reply[32]; // why the machine last stopped
+} Gdb;
+
+// Listen on address (host:port or :port for TCP, 127.0.0.1 when the
+// host is empty, or the path of a Unix socket), wait for a debugger and
+// let it control cpu until it detaches or kills it. history (may be
+// NULL) records the run so the debugger can step backwards, and while
+// it does, register and memory writes and 'c'/'s' with an address
+// fail with E01; breaks holds the breakpoints and conditions. Returns GDB_DETACHED,
+// GDB_KILLED, or -1 if the socket cannot be set up.
+int gdb_serve(const char *address, CPU6502 *cpu, TimeTravel *history, Breakpoints *breaks);
+#endif
@@ -0,0 +1,122 @@
+/*6502 emul - host-call (trap) table*/
+#include <stdio.h>
+#include <string.h>
+#include "console.h"
+#include "hostcall.h"
+
+unsigned char hostcall_bitmap[MEMORY_SIZE / 8];
+hostcall_fn hostcall_table[MEMORY_SIZE];
+
+// Bind a C routine to a trap address (replaces any previous binding)
+void hostcall_register(unsigned short address, hostcall_fn fn) {
+    if (fn == NULL) {
+        hostcall_unregister(address);
+        return;
+    }
+    hostcall_table[address] = fn;
+    hostcall_bitmap[address >> 3] |= (1 << (address & 7));
+}
+
+// Turn a trap address back into ordinary memory
+void hostcall_unregister(unsigned short address) {
+    hostcall_bitmap[address >> 3] &= ~(1 << (address & 7));
+    hostcall_table[address] = NULL;
+}
+
+// The console cannot take the call yet: rewind to the JSR and stop
+// the CPU so the call is retried on the next run
+static void wait_io(CPU6502 *cpu) {
+    cpu->pc -= 3;
+    cpu->stop = CPU_WAIT_IO;
+}
+
+static void set_eof(CPU6502 *cpu, int eof) {
+    if (eof) {
+        cpu->p |= HOSTCALL_EOF_FLAG;
+    } else {
+        cpu->p &= ~HOSTCALL_EOF_FLAG;
+    }
+}
+
+// JSR $0025: print the character in A
+static void hc_putchar(CPU6502 *cpu, unsigned char *mem) {
+    if (cpu->console->write(cpu->console, &cpu->a, 1) == CONSOLE_AGAIN) {
+        wait_io(cpu);
+    }
+}
+
+// JSR $0026: read a character into A
+static void hc_getchar(CPU6502 *cpu, unsigned char *mem) {
+    int c = read_char(cpu);
+    if (c == CONSOLE_AGAIN) {
+        wait_io(cpu);
+        return;
+    }
+    set_eof(cpu, c == EOF);
+    cpu->a = c;
+}
+
+// Send len bytes of guest memory to the console in one call, straight
+// from the memory array. Strings never wrap past $FFFF.
+static void write_guest(CPU6502 *cpu, unsigned char *mem, unsigned short address, unsigned int len) {
+    if (len > MEMORY_SIZE - address) {
+        len = MEMORY_SIZE - address;
+    }
+    if (cpu->console->write(cpu->console, mem + address, len) == CONSOLE_AGAIN) {
+        wait_io(cpu);
+    }
+}
+
+// JSR $0027: print the NUL-terminated string at X:A
+static void hc_puts(CPU6502 *cpu, unsigned char *mem) {
+    unsigned short address = hostcall_pointer(cpu);
+    unsigned char *end = memchr(mem + address, 0, MEMORY_SIZE - address);
+    write_guest(cpu, mem, address, end ? end - (mem + address) : MEMORY_SIZE - address);
+}
+
+// JSR $0028: print Y bytes starting at X:A
+static void hc_write(CPU6502 *cpu, unsigned char *mem) {
+    write_guest(cpu, mem, hostcall_pointer(cpu), cpu->y);
+}
+
+// JSR $0029: read a line of at most Y bytes into X:A.
+// The newline is dropped, the string is NUL-terminated and its length
+// is returned in A (0 on end of input).
+static void hc_gets(CPU6502 *cpu, unsigned char *mem) {
+    unsigned short address = hostcall_pointer(cpu);
+    unsigned int size = cpu->y + 1;
+    if (size > MEMORY_SIZE - address) {
+        size = MEMORY_SIZE - address;
+    }
+    char *line = (char *)(mem + address);
+    int len = size < 2 ? EOF : cpu->console->gets(cpu->console, line, size);
+    if (len == CONSOLE_AGAIN) {
+        wait_io(cpu);
+        return;
+    }
+    set_eof(cpu, len == EOF);
+    if (len == EOF) {
+        line[0] = 0;
+        cpu->a = 0;
+        return;
+    }
+    if (len > 0 && line[len - 1] == '\n') {
+        line[--len] = 0;
+    }
+    cpu->a = len;
+}
+
+// JSR $002F: stop the machine; A is the exit code
+static void hc_exit(CPU6502 *cpu, unsigned char *mem) {
+    cpu->stop = CPU_HALTED;
+}
+
+// Install the built-in host calls
+void hostcall_init(void) {
+    hostcall_register(HOSTCALL_PUTCHAR, hc_putchar);
+    hostcall_register(HOSTCALL_GETCHAR, hc_getchar);
+    hostcall_register(HOSTCALL_PUTS, hc_puts);
+    hostcall_register(HOSTCALL_WRITE, hc_write);
+    hostcall_register(HOSTCALL_GETS, hc_gets);
+    hostcall_register(HOSTCALL_EXIT, hc_exit);
+}
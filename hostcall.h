@@ -0,0 +1,38 @@
+/*6502 emul - host-call (trap) table*/
+#ifndef HOSTCALL_H
+#define HOSTCALL_H
+#include "cpu6502.h"
+// A host call is a C routine reached by JSR to a trap address.
+// It runs instead of the subroutine: nothing is pushed or popped and
+// execution resumes after the JSR when the callback returns.
+typedef void (*hostcall_fn)(CPU6502 *cpu, unsigned char *mem);
+
+// Trap addresses used by the built-in routines
+#define HOSTCALL_PUTCHAR 0x0025 // A -> stdout
+#define HOSTCALL_GETCHAR 0x0026 // stdin -> A
+#define HOSTCALL_PUTS    0x0027 // NUL-terminated string at X:A -> stdout
+#define HOSTCALL_WRITE   0x0028 // Y bytes at X:A -> stdout
+#define HOSTCALL_GETS    0x0029 // stdin line (max Y bytes) -> X:A, length -> A
+#define HOSTCALL_EXIT    0x002F // stop the machine, exit code in A
+
+// Set by GETCHAR and GETS at end of input, cleared otherwise
+#define HOSTCALL_EOF_FLAG 0x02 // Carry, as tested by BCC/BCS
+
+// One bit per address: set when JSR to that address is a host call
+extern unsigned char hostcall_bitmap[MEMORY_SIZE / 8];
+extern hostcall_fn hostcall_table[MEMORY_SIZE];
+
+// Checked by JSR on every call, so keep it a single bit test
+static inline int hostcall_is_trap(unsigned short address) {
+    return hostcall_bitmap[address >> 3] & (1 << (address & 7));
+}
+
+void hostcall_register(unsigned short address, hostcall_fn fn);
+void hostcall_unregister(unsigned short address);
+void hostcall_init(void);
+
+// Guest pointer passed in registers: A = low byte, X = high byte
+static inline unsigned short hostcall_pointer(CPU6502 *cpu) {
+    return cpu->a | (cpu->x << 8);
+}
+#endif
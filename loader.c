@@ -0,0 +1,311 @@
+/*6502 emul - program image loader*/
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cpu6502.h"
+#include "loader.h"
+
+// Value of a hex digit, 0xFF for anything else
+static unsigned char hex_value[256];
+static int hex_ready = 0;
+
+static void init_hex(void) {
+    hex_ready = 1;
+    memset(hex_value, 0xFF, sizeof(hex_value));
+    for (int i = 0; i < 10; i++) {
+        hex_value['0' + i] = i;
+    }
+    for (int i = 0; i < 6; i++) {
+        hex_value['A' + i] = 10 + i;
+        hex_value['a' + i] = 10 + i;
+    }
+}
+
+// Parser position in the mapped file
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    const char *path;
+    int line;
+    int bad;
+    long lowest; // lowest address a record stored to, -1 if none
+    int vector; // bit 0/1: a record stored to $FFFC/$FFFD
+} Cursor;
+
+static unsigned int hex_byte(Cursor *c) {
+    if (c->end - c->p < 2) {
+        c->bad = 1;
+        return 0;
+    }
+    unsigned char hi = hex_value[c->p[0]];
+    unsigned char lo = hex_value[c->p[1]];
+    c->p += 2;
+    if ((hi | lo) & 0xF0) {
+        c->bad = 1;
+        return 0;
+    }
+    return (hi << 4) | lo;
+}
+
+static void skip_blank(Cursor *c) {
+    while (c->p < c->end && (*c->p == '\n' || *c->p == '\r')) {
+        if (*c->p == '\n') {
+            c->line++;
+        }
+        c->p++;
+    }
+}
+
+// Skip the rest of the line and any blank lines
+static void next_line(Cursor *c) {
+    while (c->p < c->end && *c->p != '\n') {
+        c->p++;
+    }
+    skip_blank(c);
+}
+
+static int bad_record(Cursor *c, const char *why) {
+    printf("%s:%d: %s\n", c->path, c->line, why);
+    return -1;
+}
+
+// Copy a record's data bytes straight into guest memory
+static int store(Cursor *c, unsigned char *mem, unsigned long address, unsigned int count, unsigned int *sum) {
+    if (address + count > MEMORY_SIZE) {
+        return bad_record(c, "data outside the 64 KB address space");
+    }
+    if (count > 0 && (c->lowest < 0 || address < c->lowest)) {
+        c->lowest = address;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned char b = hex_byte(c);
+        mem[address + i] = b;
+        *sum += b;
+    }
+    if (address <= RESET_VECTOR && address + count > RESET_VECTOR) {
+        c->vector |= 1;
+    }
+    if (address <= RESET_VECTOR + 1 && address + count > RESET_VECTOR + 1) {
+        c->vector |= 2;
+    }
+    return 0;
+}
+
+static int load_ihex(Cursor *c, unsigned char *mem, long *start) {
+    unsigned long base = 0;
+    skip_blank(c);
+    while (c->p < c->end) {
+        if (*c->p != ':') {
+            return bad_record(c, "expected ':'");
+        }
+        c->p++;
+        unsigned int count = hex_byte(c);
+        unsigned int address = hex_byte(c) << 8;
+        address |= hex_byte(c);
+        unsigned int type = hex_byte(c);
+        unsigned int sum = count + (address >> 8) + (address & 0xFF) + type;
+        unsigned long value = 0;
+        if (type == 0x00) {
+            if (store(c, mem, base + address, count, &sum) < 0) {
+                return -1;
+            }
+        } else {
+            for (unsigned int i = 0; i < count; i++) {
+                unsigned int b = hex_byte(c);
+                value = (value << 8) | b;
+                sum += b;
+            }
+        }
+        sum += hex_byte(c);
+        if (c->bad) {
+            return bad_record(c, "malformed record");
+        }
+        if (sum & 0xFF) {
+            return bad_record(c, "checksum mismatch");
+        }
+        switch (type) {
+            case 0x01: // End of file
+                return 0;
+            case 0x02: // Extended segment address
+                base = value << 4;
+                break;
+            case 0x03: // Start segment address (CS:IP)
+                *start = ((value >> 16) << 4) + (value & 0xFFFF);
+                break;
+            case 0x04: // Extended linear address
+                base = value << 16;
+                break;
+            case 0x05: // Start linear address
+                *start = value;
+                break;
+        }
+        next_line(c);
+    }
+    return 0;
+}
+
+static int load_srec(Cursor *c, unsigned char *mem, long *start) {
+    // Address bytes for S0..S9
+    static const unsigned char address_size[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+    skip_blank(c);
+    while (c->p < c->end) {
+        if (c->end - c->p < 2 || c->p[0] != 'S' || c->p[1] < '0' || c->p[1] > '9' || c->p[1] == '4') {
+            return bad_record(c, "expected S-record");
+        }
+        int type = c->p[1] - '0';
+        c->p += 2;
+        unsigned int count = hex_byte(c);
+        unsigned int sum = count;
+        unsigned long address = 0;
+        for (int i = 0; i < address_size[type]; i++) {
+            unsigned int b = hex_byte(c);
+            address = (address << 8) | b;
+            sum += b;
+        }
+        if (count < address_size[type] + 1) {
+            return bad_record(c, "malformed record");
+        }
+        count -= address_size[type] + 1;
+        if (type >= 1 && type <= 3) {
+            if (store(c, mem, address, count, &sum) < 0) {
+                return -1;
+            }
+        } else {
+            for (unsigned int i = 0; i < count; i++) {
+                sum += hex_byte(c);
+            }
+        }
+        sum += hex_byte(c);
+        if (c->bad) {
+            return bad_record(c, "malformed record");
+        }
+        if ((sum & 0xFF) != 0xFF) {
+            return bad_record(c, "checksum mismatch");
+        }
+        if (type >= 7) {
+            *start = address;
+        }
+        next_line(c);
+    }
+    return 0;
+}
+
+// Format from a name ("raw", "prg", "ihex", "srec"), -1 if unknown
+int load_format(const char *name) {
+    static const char *names[] = { "auto", "raw", "prg", "ihex", "srec" };
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcasecmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int detect_format(const char *path, const unsigned char *data, size_t size) {
+    const char *ext = strrchr(path, '.');
+    if (ext) {
+        if (strcasecmp(ext, ".prg") == 0) {
+            return LOAD_PRG;
+        }
+        if (strcasecmp(ext, ".hex") == 0 || strcasecmp(ext, ".ihex") == 0 || strcasecmp(ext, ".ihx") == 0) {
+            return LOAD_IHEX;
+        }
+        if (strcasecmp(ext, ".srec") == 0 || strcasecmp(ext, ".s19") == 0 || strcasecmp(ext, ".s28") == 0 ||
+            strcasecmp(ext, ".s37") == 0 || strcasecmp(ext, ".mot") == 0) {
+            return LOAD_SREC;
+        }
+    }
+    if (size > 0 && data[0] == ':') {
+        return LOAD_IHEX;
+    }
+    if (size > 1 && data[0] == 'S' && data[1] >= '0' && data[1] <= '9') {
+        return LOAD_SREC;
+    }
+    return LOAD_RAW;
+}
+
+int load_program(const char *path, unsigned char *mem, int format, unsigned short load_address, unsigned short *start) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    size_t size = st.st_size;
+    const unsigned char *data = NULL;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    const unsigned char *map = data;
+    size_t map_size = size;
+    if (!hex_ready) {
+        init_hex();
+    }
+    if (format == LOAD_AUTO) {
+        format = detect_format(path, data, size);
+    }
+
+    Cursor c = { data, data + size, path, 1, 0, -1, 0 };
+    long entry = -1;
+    int result = 0;
+    switch (format) {
+        case LOAD_PRG:
+            if (size < 2) {
+                result = bad_record(&c, "PRG image without load address");
+                break;
+            }
+            load_address = data[0] | (data[1] << 8);
+            entry = load_address;
+            data += 2;
+            size -= 2;
+            // Fall through: the rest is a raw image
+        case LOAD_RAW:
+            if (size > MEMORY_SIZE - load_address) {
+                result = bad_record(&c, "image does not fit below $FFFF");
+                break;
+            }
+            memcpy(mem + load_address, data, size);
+            if (entry < 0 && load_address + size < RESET_VECTOR + 2) {
+                entry = load_address; // Reset vector not part of the image
+            }
+            break;
+        case LOAD_IHEX:
+            result = load_ihex(&c, mem, &entry);
+            break;
+        case LOAD_SREC:
+            result = load_srec(&c, mem, &entry);
+            break;
+        default:
+            result = bad_record(&c, "unknown image format");
+            break;
+    }
+    if (map_size > 0) {
+        munmap((void *)map, map_size);
+    }
+    if (result < 0) {
+        return -1;
+    }
+    // Records without a start record: the reset vector if they set it,
+    // else where their data begins
+    if ((entry < 0 || entry >= MEMORY_SIZE) && (format == LOAD_IHEX || format == LOAD_SREC) && c.vector != 3) {
+        entry = c.lowest >= 0 ? c.lowest : load_address;
+    }
+    if (entry < 0 || entry >= MEMORY_SIZE) {
+        entry = mem[RESET_VECTOR] | (mem[RESET_VECTOR + 1] << 8);
+    }
+    *start = entry;
+    return 0;
+}
@@ -0,0 +1,21 @@
+/*6502 emul - program image loader*/
+#ifndef LOADER_H
+#define LOADER_H
+// Image formats
+#define LOAD_AUTO 0 // by extension, then by content
+#define LOAD_RAW  1 // bytes copied to the load address
+#define LOAD_PRG  2 // two-byte little-endian load address, then bytes
+#define LOAD_IHEX 3 // Intel HEX
+#define LOAD_SREC 4 // Motorola S-record
+
+#define LOAD_DEFAULT_ADDRESS 0x0100
+#define RESET_VECTOR 0xFFFC
+
+// Load the image at path into mem with one pass over an mmap of the
+// file. load_address only applies to raw images. The entry point goes
+// to *start: the image's start record (HEX/S-record) or load address
+// (PRG), else the reset vector when the image sets it, else the load
+// address. Returns 0, or -1 after printing why the image was rejected.
+int load_program(const char *path, unsigned char *mem, int format, unsigned short load_address, unsigned short *start);
+int load_format(const char *name);
+#endif
@@ -1,23 +1,34 @@
 /*6502 emul*/
 #include <stdio.h>
 #include <stdlib.h>
-// 6502 CPU Registers
-typedef struct {
-    unsigned char a;  // Accumulator
-    unsigned char x;  // Index Register X
-    unsigned char y;  // Index Register Y
-    unsigned short pc; // Program Counter
-    unsigned char sp; // Stack Pointer
-    unsigned char p;  // Processor Status Register
-} CPU6502;
-// Memory (64 KB)
-#define MEMORY_SIZE (65536)
+#include <string.h>
+#include "cpu6502.h"
+#include "hostcall.h"
+#include "coverage.h"
+#include "fileio.h"
+#include "mmio.h"
+#include "acia.h"
+#include "console.h"
+#include "term.h"
+#include "filter.h"
+#include "serve.h"
+#include "loader.h"
+#include "savestate.h"
+#include "checkpoint.h"
+#include "farm.h"
+#include "fuzz.h"
+#include "replay.h"
+#include "timetravel.h"
+#include "trace.h"
+#include "breakpoint.h"
+#include "gdbstub.h"
+#include "memview.h"
+#include "difftest.h"
+#include "bench.h"
+#include "suite.h"
+// Memory (64 KB) of the default machine
 unsigned char memory[MEMORY_SIZE];
-// Stack (Simplified)
-#define STACK_SIZE 256
-unsigned short stack[STACK_SIZE];
-unsigned char stack_pointer = STACK_SIZE - 1; 
-// Initialize the CPU
+// Initialize the CPU (runs on the default machine until cpu->mem is changed)
 void cpu_init(CPU6502 *cpu) {
     cpu->a = 0;
     cpu->x = 0;
@@ -25,10 +36,16 @@ void cpu_init(CPU6502 *cpu) {
     cpu->pc = 0;
     cpu->sp = 0xFF;  // Initialize Stack Pointer
     cpu->p = 0;
+    cpu->mem = memory;
+    cpu->stack_pointer = STACK_SIZE - 1;
+    cpu->console = &console_stdio;
+    cpu->stop = CPU_RUNNING;
+    cpu->coverage = NULL;
+    cpu->coverage_prev = 0;
 }
 // Fetch a byte from memory
 unsigned char fetch_byte(CPU6502 *cpu) {
-    return memory[cpu->pc++];
+    return cpu->mem[cpu->pc++];
 }
 // Addressing Modes (Simplified)
 unsigned short get_address(CPU6502 *cpu, unsigned char mode) {
@@ -63,35 +80,50 @@ unsigned short get_address(CPU6502 *cpu, unsigned char mode) {
     }
     return address;
 }
+// Data accesses go to a device when the page holds I/O registers
+static inline unsigned char mem_read(CPU6502 *cpu, unsigned short address) {
+    if (mmio_is_device(address)) {
+        return mmio_read(cpu->mem, address);
+    }
+    return cpu->mem[address];
+}
+static inline void mem_write(CPU6502 *cpu, unsigned short address, unsigned char value) {
+    if (mmio_is_device(address)) {
+        mmio_write(cpu->mem, address, value);
+        return;
+    }
+    cpu->mem[address] = value;
+}
 // Read a byte from memory (with addressing mode)
 unsigned char read_byte(CPU6502 *cpu, unsigned char mode) {
     unsigned short address = get_address(cpu, mode);
-    return memory[address];
+    return mem_read(cpu, address);
 }
 // Write a byte to memory (with addressing mode)
 void write_byte(CPU6502 *cpu, unsigned char mode, unsigned char value) {
     unsigned short address = get_address(cpu, mode);
-    memory[address] = value;
+    mem_write(cpu, address, value);
 }
-// Push a value onto the stack
-void push(unsigned short value) {
-    if (stack_pointer == 0) {
-        printf("Stack Overflow!\n");
-        exit(1);
+// Push a value onto the stack (stops the CPU when full)
+void push(CPU6502 *cpu, unsigned short value) {
+    if (cpu->stack_pointer == 0) {
+        cpu->stop = CPU_STACK_OVERFLOW;
+        return;
     }
-    stack[stack_pointer--] = value;
+    cpu->stack[cpu->stack_pointer--] = value;
 }
-// Pop a value from the stack
-unsigned short pop() {
-    if (stack_pointer == STACK_SIZE - 1) {
-        printf("Stack Underflow!\n");
-        exit(1);
+// Pop a value from the stack (stops the CPU when empty)
+unsigned short pop(CPU6502 *cpu) {
+    if (cpu->stack_pointer == STACK_SIZE - 1) {
+        cpu->stop = CPU_STACK_UNDERFLOW;
+        return cpu->pc;
     }
-    return stack[++stack_pointer];
+    return cpu->stack[++cpu->stack_pointer];
 }
-// Basic implementation of getchar()
-unsigned char read_char(CPU6502 *cpu) {
-    return getchar(); 
+// Read a character from the machine's console
+// (EOF at end of input, CONSOLE_AGAIN when nothing has arrived yet)
+int read_char(CPU6502 *cpu) {
+    return cpu->console->getc(cpu->console);
 }
 
 // Decode and execute 6502 instructions
@@ -122,8 +154,8 @@ void execute_instruction(CPU6502 *cpu) {
             break;
         case 0xA1: // LDA ($xx,X) (Load Accumulator, Indexed Indirect)
             unsigned char zero_page_address = fetch_byte(cpu);
-            unsigned short address = ((memory[zero_page_address] | (memory[zero_page_address + 1] << 8)) + cpu->x) & 0xFFFF;
-            cpu->a = memory[address];
+            unsigned short address = ((cpu->mem[zero_page_address] | (cpu->mem[zero_page_address + 1] << 8)) + cpu->x) & 0xFFFF;
+            cpu->a = mem_read(cpu, address);
             break;
         case 0xA6: // LDA $xx (Load Accumulator, Zero Page)
             cpu->a = read_byte(cpu, 1); // Zero page addressing
@@ -158,6 +190,7 @@ void execute_instruction(CPU6502 *cpu) {
             } else {
                 cpu->pc++; // Increment PC for the next instruction
             }
+            coverage_edge(cpu);
             break;
         case 0xF0: // BEQ $xx (Branch if Equal)
             if (!(cpu->p & 0x01)) { // Check the Zero flag (bit 0)
@@ -165,29 +198,36 @@ void execute_instruction(CPU6502 *cpu) {
             } else {
                 cpu->pc++; // Increment PC for the next instruction
             }
+            coverage_edge(cpu);
             break;
         case 0x4C: // JMP $xxxx (Jump)
             cpu->pc = fetch_byte(cpu) | (fetch_byte(cpu) << 8);
+            coverage_edge(cpu);
             break;
-        case 0x20: // JSR $xxxx (Jump to Subroutine)
-            push(cpu->pc + 2); // Push the return address
-            cpu->pc = fetch_byte(cpu) | (fetch_byte(cpu) << 8);
-
-            // Special handling for JSR $0025 (Call to 'putchar')
-            if (cpu->pc == 0x0025) {
-                // Call the C putchar function 
-                putchar(cpu->a);
-                cpu->pc = pop(); // Pop the return address from the stack
+        case 0x20: { // JSR $xxxx (Jump to Subroutine)
+            unsigned short target = get_address(cpu, 2); // Absolute addressing
+            // Host calls ($0025 putchar, $0026 read_char, ...) run in C
+            // without touching the stack
+            if (hostcall_is_trap(target)) {
+                hostcall_table[target](cpu, cpu->mem);
+                break;
             }
-            // Special handling for JSR $0026 (Call to 'read_char')
-            if (cpu->pc == 0x0026) {
-                // Call the C read_char function 
-                cpu->a = read_char(cpu);
-                cpu->pc = pop(); // Pop the return address from the stack
+            push(cpu, cpu->pc); // Push the return address
+            if (cpu->stop == CPU_STACK_OVERFLOW) {
+                cpu->pc -= 3;
+                break;
             }
+            cpu->pc = target;
+            coverage_edge(cpu);
             break;
+        }
         case 0x60: // RTS (Return from Subroutine)
-            cpu->pc = pop(); // Pop the return address
+            cpu->pc = pop(cpu); // Pop the return address
+            if (cpu->stop == CPU_STACK_UNDERFLOW) {
+                cpu->pc--;
+                break;
+            }
+            coverage_edge(cpu);
             break;
         case 0x9A: // TXS (Transfer X to Stack Pointer)
             cpu->sp = cpu->x;
@@ -213,6 +253,7 @@ void execute_instruction(CPU6502 *cpu) {
             } else {
                 cpu->pc++; // Increment PC for the next instruction
             }
+            coverage_edge(cpu);
             break;
         case 0xB0: // BCS $xx (Branch if Carry Set)
             if (cpu->p & 0x02) { // Check the Carry flag (bit 1)
@@ -220,28 +261,33 @@ void execute_instruction(CPU6502 *cpu) {
             } else {
                 cpu->pc++; // Increment PC for the next instruction
             }
+            coverage_edge(cpu);
             break;
         // ... (Add more 6502 opcodes) ...
         default:
-            printf("Unrecognized opcode: 0x%02X\n", opcode);
-            exit(1);
+            cpu->pc--;
+            cpu->stop = CPU_BAD_OPCODE;
+            break;
     }
 }
-// Simple memory dump function (for debugging)
-void dump_memory(int start, int end) {
-    printf("Memory Dump (0x%04X - 0x%04X)\n", start, end);
-    for (int i = start; i <= end; i++) {
-        if ((i % 16) == 0) {
-            printf("%04X: ", i);
-        }
-        printf("%02X ", memory[i]);
-        if ((i % 16) == 15) {
-            printf("\n");
-        }
+// Explain why the CPU stopped; returns the exit status for the process
+int cpu_report(CPU6502 *cpu, FILE *out) {
+    switch (cpu->stop) {
+        case CPU_HALTED:
+            return cpu->a;
+        case CPU_BAD_OPCODE:
+            fprintf(out, "Unrecognized opcode: 0x%02X\n", cpu->mem[cpu->pc]);
+            return 1;
+        case CPU_STACK_OVERFLOW:
+            fprintf(out, "Stack Overflow!\n");
+            return 1;
+        case CPU_STACK_UNDERFLOW:
+            fprintf(out, "Stack Underflow!\n");
+            return 1;
+        default:
+            return 0;
     }
-    printf("\n");
 }
-
 void ex01()
 {
     // Load the program into memory
@@ -444,22 +490,619 @@ void ex02()
     memory[0x1A4] = 0x01;    
 }
 
-int main() {
+/*Esempio 03: come ex02, ma con le chiamate host per stringhe*/
+void ex03()
+{
+    // Strings live in memory and are printed with one JSR each
+    memcpy(&memory[0x300], "What is your name? ", 20);
+    memcpy(&memory[0x320], "Hello, ", 8);
+    memcpy(&memory[0x330], "!\r\n", 4);
+
+    memory[0x100] = 0xA9; // LDA #$00
+    memory[0x101] = 0x00;
+    memory[0x102] = 0xA2; // LDX #$03
+    memory[0x103] = 0x03;
+    memory[0x104] = 0x20; // JSR $0027 (Print string at $0300)
+    memory[0x105] = 0x27;
+    memory[0x106] = 0x00;
+    memory[0x107] = 0xA9; // LDA #$00
+    memory[0x108] = 0x00;
+    memory[0x109] = 0xA2; // LDX #$02
+    memory[0x10A] = 0x02;
+    memory[0x10B] = 0xA0; // LDY #$40
+    memory[0x10C] = 0x40;
+    memory[0x10D] = 0x20; // JSR $0029 (Read line into $0200)
+    memory[0x10E] = 0x29;
+    memory[0x10F] = 0x00;
+    memory[0x110] = 0xA9; // LDA #$20
+    memory[0x111] = 0x20;
+    memory[0x112] = 0xA2; // LDX #$03
+    memory[0x113] = 0x03;
+    memory[0x114] = 0x20; // JSR $0027 (Print "Hello, ")
+    memory[0x115] = 0x27;
+    memory[0x116] = 0x00;
+    memory[0x117] = 0xA9; // LDA #$00
+    memory[0x118] = 0x00;
+    memory[0x119] = 0xA2; // LDX #$02
+    memory[0x11A] = 0x02;
+    memory[0x11B] = 0x20; // JSR $0027 (Print the name)
+    memory[0x11C] = 0x27;
+    memory[0x11D] = 0x00;
+    memory[0x11E] = 0xA9; // LDA #$30
+    memory[0x11F] = 0x30;
+    memory[0x120] = 0xA2; // LDX #$03
+    memory[0x121] = 0x03;
+    memory[0x122] = 0x20; // JSR $0027 (Print "!\r\n")
+    memory[0x123] = 0x27;
+    memory[0x124] = 0x00;
+    memory[0x125] = 0x4C; // JMP $100
+    memory[0x126] = 0x00;
+    memory[0x127] = 0x01;
+}
+
+/*Esempio 04: eco dei caratteri attraverso la ACIA 6551 (--acia 8800)*/
+void ex04()
+{
+    memory[0x100] = 0xAD; // LDA $8801 (ACIA status)
+    memory[0x101] = 0x01;
+    memory[0x102] = 0x88;
+    memory[0x103] = 0xC9; // CMP #$18 (byte received, transmitter empty)
+    memory[0x104] = 0x18;
+    memory[0x105] = 0xD0; // BNE $10A
+    memory[0x106] = 0x03;
+    memory[0x107] = 0x4C; // JMP $100 (keep polling)
+    memory[0x108] = 0x00;
+    memory[0x109] = 0x01;
+    memory[0x10A] = 0xAD; // LDA $8800 (ACIA data)
+    memory[0x10B] = 0x00;
+    memory[0x10C] = 0x88;
+    memory[0x10D] = 0x8D; // STA $8800
+    memory[0x10E] = 0x00;
+    memory[0x10F] = 0x88;
+    memory[0x110] = 0x4C; // JMP $100
+    memory[0x111] = 0x00;
+    memory[0x112] = 0x01;
+}
+
+/*Esempio 05: filtro che copia l'input sull'output (--filter)*/
+void ex05()
+{
+    memory[0x100] = 0x20; // JSR $0026 (Read char)
+    memory[0x101] = 0x26;
+    memory[0x102] = 0x00;
+    memory[0x103] = 0xB0; // BCS $10B (end of input)
+    memory[0x104] = 0x06;
+    memory[0x105] = 0x20; // JSR $0025
+    memory[0x106] = 0x25;
+    memory[0x107] = 0x00;
+    memory[0x108] = 0x4C; // JMP $100
+    memory[0x109] = 0x00;
+    memory[0x10A] = 0x01;
+    memory[0x10B] = 0xA9; // LDA #$00
+    memory[0x10C] = 0x00;
+    memory[0x10D] = 0x20; // JSR $002F (Exit)
+    memory[0x10E] = 0x2F;
+    memory[0x10F] = 0x00;
+}
+
+// --farm: results on stdout, throughput on stderr
+static int run_farm(const char *list, int threads, int width, unsigned long slice, const char *out_dir) {
+    Farm *farm = farm_load(list);
+    if (farm == NULL) {
+        return 1;
+    }
+    farm->width = width > 0 ? width : 1;
+    farm->slice = slice > 0 ? slice : FARM_DEFAULT_SLICE;
+    if (threads <= 0) {
+        threads = farm_threads();
+    }
+    double elapsed = farm_run(farm, threads);
+    unsigned long instructions = 0;
+    for (int i = 0; i < farm->job_count; i++) {
+        instructions += farm->jobs[i].instructions;
+    }
+    int status = farm_report(farm, stdout, out_dir);
+    fprintf(stderr, "Farm: %d jobs on %d threads in %.3f s, %.0f jobs/s, %.1f MIPS\n", farm->job_count, threads,
+            elapsed, farm->job_count / elapsed, instructions / elapsed / 1e6);
+    farm_free(farm);
+    return status;
+}
+
+static void show_position(TimeTravel *tt, const char *what) {
+    CPU6502 *cpu = tt->cpu;
+    fprintf(stderr, "%s: instruction %lu, PC $%04X (opcode $%02X), A=$%02X X=$%02X Y=$%02X P=$%02X SP=$%02X\n",
+            what, tt->count, cpu->pc, cpu->mem[cpu->pc], cpu->a, cpu->x, cpu->y, cpu->p, cpu->sp);
+}
+
+// --back, --last-write: look back from where the machine stopped, then
+// leave it there again
+static void explore_history(TimeTravel *tt, unsigned long back, long last_write) {
+    CPU6502 *cpu = tt->cpu;
+    unsigned long stopped = tt->count;
+    unsigned char stop = cpu->stop;
+    show_position(tt, "Stopped");
+    if (last_write >= 0) {
+        if (timetravel_last_write(tt, last_write) < 0) {
+            fprintf(stderr, "No store to $%04lX since instruction %lu\n", last_write, tt->snaps[0].count);
+        } else {
+            char what[32];
+            snprintf(what, sizeof(what), "Last store to $%04lX", last_write);
+            show_position(tt, what);
+        }
+        timetravel_goto(tt, stopped);
+    }
+    if (back > 0) {
+        if (timetravel_step_back(tt, back) < 0) {
+            fprintf(stderr, "History only reaches back to instruction %lu\n", tt->snaps[0].count);
+        }
+        show_position(tt, "Back");
+        timetravel_goto(tt, stopped);
+    }
+    cpu->stop = stop;
+}
+
+// A condition held or a watch changed: say which and where, and run on
+static void show_break(Breakpoints *b, CPU6502 *cpu) {
+    char text[256];
+    breakpoint_describe(b, text, sizeof(text));
+    fprintf(stderr, "%s at $%04X: A=%02X X=%02X Y=%02X SP=%02X P=%02X\n", text, cpu->pc, cpu->a, cpu->x, cpu->y,
+            cpu->sp, cpu->p);
+}
+
+// Run the loaded program on the reference engine and engine side by
+// side, on all of stdin as input
+static int run_difftest(const char *engine, CPU6502 *cpu, unsigned long interval, unsigned long budget) {
+    size_t size = 65536;
+    size_t len = 0;
+    unsigned char *input = malloc(size);
+    size_t n;
+    if (input == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    while ((n = fread(input + len, 1, size - len, stdin)) > 0) {
+        len += n;
+        if (len == size) {
+            size *= 2;
+            input = realloc(input, size);
+            if (input == NULL) {
+                printf("Out of memory\n");
+                exit(1);
+            }
+        }
+    }
+    DiffResult result;
+    int status = difftest_run(engine, cpu, input, len, interval, budget, stdout, &result);
+    free(input);
+    if (status >= 0) {
+        printf("difftest: %lu instructions, %lu checks, %lu bisection runs, state hash %016llX%s\n",
+               result.instructions, result.checks, result.probes, result.hash, status ? ", diverged" : "");
+    }
+    return status != 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        return bench_main(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "--suite") == 0) {
+        return suite_main(argc - 2, argv + 2);
+    }
     CPU6502 cpu;
     cpu_init(&cpu);
-    //ex01();
-    ex02();
+    hostcall_init();
+    fileio_init();
+    const char *serve_path = NULL;
+    const char *program = NULL;
+    int format = LOAD_AUTO;
+    unsigned short load_address = LOAD_DEFAULT_ADDRESS;
+    long start = -1;
+    Console *filter = NULL;
+    Acia *acia = NULL;
+    const char *boot_path = NULL;
+    const char *ready_path = NULL;
+    const char *checkpoint_path = NULL;
+    double checkpoint_interval = 60;
+    const char *farm_list = NULL;
+    const char *farm_out = NULL;
+    int threads = 0;
+    int interleave = 1;
+    unsigned long farm_slice = FARM_DEFAULT_SLICE;
+    int afl = 0;
+    unsigned long budget = FUZZ_DEFAULT_BUDGET;
+    FuzzCampaign campaign = { NULL, NULL, ~0UL, 0, 1 };
+    int fuzz = 0;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    size_t history_budget = 0;
+    unsigned long back = 0;
+    long last_write = -1;
+    const char *trace_path = NULL;
+    unsigned long trace_last = 0;
+    const char *decode_path = NULL;
+    unsigned long long decode_from = 0;
+    unsigned long long decode_count = ~0ULL;
+    long decode_pc = -1;
+    const char *gdb_address = NULL;
+    const char *break_exprs[BREAK_MAX];
+    int break_kinds[BREAK_MAX];
+    int break_count = 0;
+    long dump_start = -1;
+    long dump_end = -1;
+    const char *save_memory_path = NULL;
+    const char *diff_path = NULL;
+    const char *difftest_engine = NULL;
+    unsigned long difftest_interval = DIFFTEST_DEFAULT_INTERVAL;
+    int difftest_programs = 0;
+    unsigned long seed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--acia") == 0 && i + 1 < argc) {
+            // 6551 ACIA on stdin/stdout at the given hex address
+            acia = acia_create(strtol(argv[++i], NULL, 16), 0, 1);
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            // One machine per client of a Unix-domain socket
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--term") == 0) {
+            // Raw terminal: every key reaches the guest as it is typed
+            Console *term = term_open();
+            if (term) {
+                cpu.console = term;
+            }
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            // Headless: large-buffer stdin/stdout, exit with the guest
+            filter = filter_open(0, 1);
+            cpu.console = filter;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            // raw, prg, ihex or srec (default: guess)
+            format = load_format(argv[++i]);
+            if (format < 0) {
+                printf("Unknown image format: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--at") == 0 && i + 1 < argc) {
+            // Load address of a raw image (hex)
+            load_address = strtol(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            // Entry point (hex), overriding the image
+            start = strtol(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "--boot") == 0 && i + 1 < argc) {
+            // Resume from a savestate instead of loading a program
+            boot_path = argv[++i];
+        } else if (strcmp(argv[i], "--save-ready") == 0 && i + 1 < argc) {
+            // Savestate of the machine when it first asks for input
+            ready_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            // Savestate written in the background every few seconds
+            checkpoint_path = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            // Seconds between checkpoints (default 60)
+            checkpoint_interval = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--farm") == 0 && i + 1 < argc) {
+            // Run every job of a job list on a thread pool
+            farm_list = argv[++i];
+        } else if (strcmp(argv[i], "--farm-out") == 0 && i + 1 < argc) {
+            // Directory for the output of each farm job
+            farm_out = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            // Farm threads (default: one per core)
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--interleave") == 0 && i + 1 < argc) {
+            // Farm jobs in flight per thread (default 1)
+            interleave = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--slice") == 0 && i + 1 < argc) {
+            // Instructions per turn of an interleaved farm job
+            farm_slice = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--afl") == 0) {
+            // AFL fork server: a fresh fork of the loaded machine per input
+            afl = 1;
+        } else if (strcmp(argv[i], "--afl-persistent") == 0) {
+            // AFL persistent mode (AFL_PERSISTENT=1): reset between inputs
+            afl = 2;
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            // Instructions per fuzzing input or differential test
+            budget = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc) {
+            // Built-in coverage-guided fuzzer; corpus in DIR
+            fuzz = 1;
+            campaign.corpus_dir = argv[++i];
+        } else if (strcmp(argv[i], "--crashes") == 0 && i + 1 < argc) {
+            // Where the fuzzer saves crashing inputs
+            campaign.crash_dir = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            // Inputs the fuzzer tries (default: until interrupted)
+            campaign.max_runs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            // Log every input (console, devices, files) for --replay
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            // Rerun a recorded session from its log, without live input
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--history") == 0) {
+            // Keep snapshots and an input log so the run can be stepped back
+            history_budget = TIMETRAVEL_DEFAULT_BUDGET;
+        } else if (strcmp(argv[i], "--history-mb") == 0 && i + 1 < argc) {
+            // Memory for --history snapshots (default 64 MB)
+            history_budget = strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+        } else if (strcmp(argv[i], "--back") == 0 && i + 1 < argc) {
+            // With --history: show the machine N instructions before it stopped
+            back = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--last-write") == 0 && i + 1 < argc) {
+            // With --history: find the last store to an address (hex)
+            last_write = strtol(argv[++i], NULL, 16) & 0xFFFF;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            // Binary trace of every instruction (print with --decode);
+            // about 3x slower on one core, --trace-last stays under 2x
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace-last") == 0 && i + 1 < argc) {
+            // Only keep the last N instructions, written when the run ends
+            trace_last = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--gdb") == 0 && i + 1 < argc) {
+            // Wait for a debugger (GDB remote protocol) on host:port,
+            // :port or a Unix socket path
+            gdb_address = argv[++i];
+        } else if ((strcmp(argv[i], "--break") == 0 || strcmp(argv[i], "--watch") == 0) && i + 1 < argc) {
+            // Report each time a condition holds (--break) or the value of
+            // an expression changes (--watch), e.g. "PC == $2005 && A == $41"
+            if (break_count == BREAK_MAX) {
+                printf("Too many breakpoints\n");
+                return 1;
+            }
+            break_kinds[break_count] = argv[i][2] == 'w' ? BREAK_WATCH : BREAK_WHEN;
+            break_exprs[break_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            // Hex dump of memory when the run ends: START:END (hex, inclusive)
+            char *end;
+            dump_start = strtol(argv[++i], &end, 16) & 0xFFFF;
+            dump_end = *end == ':' ? strtol(end + 1, NULL, 16) & 0xFFFF : 0xFFFF;
+        } else if (strcmp(argv[i], "--save-memory") == 0 && i + 1 < argc) {
+            // Write the 64 KB address space to a file when the run ends
+            save_memory_path = argv[++i];
+        } else if (strcmp(argv[i], "--diff") == 0 && i + 1 < argc) {
+            // When the run ends, print the lines of memory that differ from
+            // a memory image (--save-memory) or savestate
+            diff_path = argv[++i];
+        } else if (strcmp(argv[i], "--difftest") == 0 && i + 1 < argc) {
+            // Run the program on an engine (batch) and on the reference
+            // interpreter side by side, with stdin as input, and report
+            // the first instruction where they differ
+            difftest_engine = argv[++i];
+        } else if (strcmp(argv[i], "--difftest-every") == 0 && i + 1 < argc) {
+            // Instructions between state comparisons (default 10000)
+            difftest_interval = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--difftest-random") == 0 && i + 1 < argc) {
+            // Differential test on N random programs instead
+            difftest_programs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            // First random program (default 1)
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--decode") == 0 && i + 1 < argc) {
+            // Print a trace file as text and exit
+            decode_path = argv[++i];
+        } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            // Decode from this instruction number on
+            decode_from = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            // Decode at most this many instructions
+            decode_count = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--pc") == 0 && i + 1 < argc) {
+            // Decode only the instructions at this hex address
+            decode_pc = strtol(argv[++i], NULL, 16) & 0xFFFF;
+        } else if (argv[i][0] != '-' && program == NULL) {
+            program = argv[i];
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (decode_path) {
+        return trace_decode(decode_path, decode_from, decode_count, decode_pc, stdout) < 0;
+    }
+    if (difftest_programs > 0) {
+        return difftest_random(difftest_engine ? difftest_engine : "batch", seed, difftest_programs,
+                               difftest_interval, stdout) != 0;
+    }
+    if (farm_list) {
+        return run_farm(farm_list, threads, interleave, farm_slice, farm_out);
+    }
     // Set PC to start executing at 0x100
     cpu.pc = 0x100;
-    // Emulator loop
-    while (1) {
-        execute_instruction(&cpu);
-        //dump_memory(0x201, 0x210); // Example: Dump memory from 0x100 to 0x104
-        //printf("A: 0x%02X, X: 0x%02X, Y: 0x%02X, PC: 0x%04X, SP: 0x%02X, P: 0x%02X\n",cpu.a, cpu.x, cpu.y, cpu.pc, cpu.sp, cpu.p);
+    if (boot_path) {
+        if (savestate_boot(boot_path, &cpu, acia ? NULL : &acia) < 0) {
+            return 1;
+        }
+    } else if (program) {
+        if (load_program(program, memory, format, load_address, &cpu.pc) < 0) {
+            return 1;
+        }
+    } else {
+        //ex01();
+        ex02();
+        //ex03();
+        //ex04();
+        //ex05();
+    }
+    if (start >= 0) {
+        cpu.pc = start;
+    }
+    if (serve_path) {
+        return serve(serve_path, &cpu);
+    }
+    if (difftest_engine) {
+        return run_difftest(difftest_engine, &cpu, difftest_interval, budget);
+    }
+    if (fuzz) {
+        static FuzzTarget target;
+        fuzz_init(&target, &cpu, budget);
+        int status = fuzz_campaign(&target, &campaign);
+        fprintf(stderr, "fuzz: %lu runs in %.1f s, %.0f execs/s, corpus %d, %lu edges, %lu crashes, %lu hangs\n",
+                campaign.runs, campaign.elapsed, campaign.runs / campaign.elapsed, campaign.corpus, campaign.edges,
+                campaign.crashes, campaign.hangs);
+        return status;
+    }
+    if (afl) {
+        static FuzzTarget target;
+        Console *console = cpu.console;
+        cpu.coverage = coverage_attach_afl();
+        fuzz_init(&target, &cpu, budget);
+        fuzz_afl(&target, afl == 2);
+        // Not started by AFL: run once on stdin
+        cpu.console = console;
+        cpu.coverage = NULL;
+    }
+    Replay *replay = NULL;
+    if (record_path || replay_path) {
+        replay = record_path ? replay_record(record_path) : replay_open(replay_path);
+        if (replay == NULL) {
+            return 1;
+        }
+        cpu.console = replay_console(replay, cpu.console);
+    }
+    TimeTravel *history = NULL;
+    if (history_budget > 0) {
+        if (replay) {
+            printf("--history cannot be combined with --record or --replay\n");
+            return 1;
+        }
+        history = timetravel_open(&cpu, history_budget);
+        if (history == NULL) {
+            return 1;
+        }
+    }
+    static Breakpoints breakpoints;
+    breakpoints_init(&breakpoints);
+    for (int i = 0; i < break_count; i++) {
+        char error[128];
+        if (breakpoint_add(&breakpoints, break_exprs[i], break_kinds[i], &cpu, error, sizeof(error)) < 0) {
+            printf("%s: %s\n", break_exprs[i], error);
+            return 1;
+        }
+    }
+    if (gdb_address) {
+        if (replay || trace_path || checkpoint_path) {
+            printf("--gdb cannot be combined with --record, --replay, --trace or --checkpoint\n");
+            return 1;
+        }
+        // After a detach the machine runs on as usual
+        int status = gdb_serve(gdb_address, &cpu, history, &breakpoints);
+        if (status != GDB_DETACHED) {
+            if (history) {
+                timetravel_close(history, NULL);
+            }
+            if (acia) {
+                acia_destroy(acia);
+            }
+            return status < 0;
+        }
+    }
+    Trace *trace = NULL;
+    if (trace_path) {
+        if (history || break_count) {
+            printf("--trace cannot be combined with --history, --break or --watch\n");
+            return 1;
+        }
+        trace = trace_open(trace_path, trace_last);
+        if (trace == NULL) {
+            return 1;
+        }
+    }
+    Console *console = cpu.console;
+    if (ready_path) {
+        cpu.console = savestate_ready_console(console);
+    }
+    Checkpoint *checkpoint = NULL;
+    if (checkpoint_path) {
+        checkpoint = checkpoint_open(checkpoint_path, checkpoint_interval);
+    }
+    unsigned int slice = CHECKPOINT_SLICE;
+    int resume = 0;
+    for (;;) {
+        // Emulator loop
+        while (cpu.stop == CPU_RUNNING) {
+            if (break_count) {
+                int status = breakpoints_run(&breakpoints, &cpu, history, CHECKPOINT_SLICE, resume);
+                resume = 0;
+                if (status == BREAK_HIT) {
+                    show_break(&breakpoints, &cpu);
+                    // Stopped before the instruction at an address: run it next
+                    resume = breakpoints.hit == NULL || breakpoints.hit->cond.anchor >= 0;
+                }
+                slice = 1;
+            } else if (history) {
+                timetravel_run(history, CHECKPOINT_SLICE);
+                slice = 1;
+            } else {
+                if (trace) {
+                    trace_step(trace, &cpu);
+                }
+                execute_instruction(&cpu);
+            }
+            if (--slice == 0) {
+                slice = CHECKPOINT_SLICE;
+                if (checkpoint) {
+                    checkpoint_poll(checkpoint, &cpu, acia);
+                }
+            }
+            //memview_dump(stdout, cpu.mem, 0x201, 0x210); // Example: Dump memory from 0x201 to 0x210
 
-        /*if (cpu.pc == 0x105) {
+            /*if (cpu.pc == 0x105) {
+                break;
+            }*/
+        }
+        if (cpu.stop != CPU_WAIT_IO || ready_path == NULL) {
             break;
-        }*/
+        }
+        // First request for input: save the machine at its ready prompt,
+        // after what it sent so far (the transmit FIFO is not saved)
+        if (acia) {
+            acia_flush(acia);
+        }
+        if (savestate_save(ready_path, &cpu, acia) < 0) {
+            return 1;
+        }
+        ready_path = NULL;
+        cpu.console = console;
+        cpu.stop = CPU_RUNNING;
+    }
+    if (checkpoint) {
+        checkpoint_close(checkpoint, stderr);
+    }
+    // Send what the guest left in the transmit FIFO
+    if (acia) {
+        acia_destroy(acia);
+    }
+    if (replay) {
+        replay_close(replay, stderr);
+    }
+    if (trace) {
+        trace_close(trace, stderr);
+    }
+    if (break_count) {
+        breakpoints_report(&breakpoints, stderr);
+    }
+    if (history) {
+        explore_history(history, back, last_write);
+        timetravel_close(history, stderr);
+    }
+    if (dump_start >= 0 || diff_path) {
+        fflush(stdout);
+    }
+    if (dump_start >= 0) {
+        memview_dump(stdout, cpu.mem, dump_start, dump_end);
+    }
+    if (diff_path) {
+        static unsigned char before[MEMORY_SIZE];
+        if (memview_load(diff_path, before) < 0) {
+            return 1;
+        }
+        fprintf(stderr, "%d lines differ from %s\n", memview_diff(stdout, before, cpu.mem), diff_path);
+    }
+    if (save_memory_path && memview_save(save_memory_path, cpu.mem) < 0) {
+        return 1;
+    }
+    if (filter) {
+        filter_close(filter);
+        return cpu_report(&cpu, stderr);
     }
-    return 0;
+    fflush(stdout);
+    return cpu_report(&cpu, stdout);
 }
\ No newline at end of file
@@ -0,0 +1,178 @@
+/*6502 emul - memory inspector: hex dumps and snapshot diffs*/
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "memview.h"
+#include "savestate.h"
+
+static const char hex[] = "0123456789ABCDEF";
+
+// One dump line for the row at address, showing the bytes in lo..hi;
+// returns the end of what was written
+static char *format_line(char *p, const unsigned char *mem, unsigned int address, unsigned int lo, unsigned int hi) {
+    p[0] = hex[address >> 12 & 15];
+    p[1] = hex[address >> 8 & 15];
+    p[2] = hex[address >> 4 & 15];
+    p[3] = hex[address & 15];
+    p[4] = ':';
+    p[5] = ' ';
+    char *bytes = p + 6;
+    char *text = bytes + MEMVIEW_LINE * 3 + 2;
+    bytes[MEMVIEW_LINE * 3] = ' ';
+    bytes[MEMVIEW_LINE * 3 + 1] = '|';
+    for (unsigned int i = 0; i < MEMVIEW_LINE; i++) {
+        unsigned int a = address + i;
+        if (a < lo || a > hi) {
+            memcpy(bytes + i * 3, "   ", 3);
+            text[i] = ' ';
+            continue;
+        }
+        unsigned char c = mem[a];
+        bytes[i * 3] = hex[c >> 4];
+        bytes[i * 3 + 1] = hex[c & 15];
+        bytes[i * 3 + 2] = ' ';
+        text[i] = c >= 0x20 && c < 0x7F ? c : '.';
+    }
+    text[MEMVIEW_LINE] = '|';
+    text[MEMVIEW_LINE + 1] = '\n';
+    return p + MEMVIEW_LINE_SIZE;
+}
+
+size_t memview_size(unsigned int start, unsigned int end) {
+    if (start > end || end >= MEMORY_SIZE) {
+        return 0;
+    }
+    return (size_t)(end / MEMVIEW_LINE - start / MEMVIEW_LINE + 1) * MEMVIEW_LINE_SIZE;
+}
+
+size_t memview_format(char *buf, const unsigned char *mem, unsigned int start, unsigned int end) {
+    char *p = buf;
+    if (start > end || end >= MEMORY_SIZE) {
+        return 0;
+    }
+    for (unsigned int line = start / MEMVIEW_LINE; line <= end / MEMVIEW_LINE; line++) {
+        p = format_line(p, mem, line * MEMVIEW_LINE, start, end);
+    }
+    return p - buf;
+}
+
+void memview_dump(FILE *out, const unsigned char *mem, unsigned int start, unsigned int end) {
+    char *buf = malloc(memview_size(start, end) + 1);
+    if (buf == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    fwrite(buf, 1, memview_format(buf, mem, start, end), out);
+    free(buf);
+}
+
+int memview_changed(const unsigned char *a, const unsigned char *b, unsigned long long changed[MEMVIEW_LINES / 64]) {
+    int count = 0;
+    // 64 lines (1 KB) per bitmap word
+    for (unsigned int w = 0; w < MEMVIEW_LINES / 64; w++) {
+        const unsigned char *x = a + w * 64 * MEMVIEW_LINE;
+        const unsigned char *y = b + w * 64 * MEMVIEW_LINE;
+        unsigned long long bits = 0;
+        // Most blocks are unchanged: libc's memcmp rules them out first
+        if (memcmp(x, y, 64 * MEMVIEW_LINE) == 0) {
+            changed[w] = 0;
+            continue;
+        }
+#if defined(__AVX2__)
+        // Two lines per compare: one mask bit per equal byte
+        for (unsigned int i = 0; i < 64; i += 2) {
+            __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(x + i * MEMVIEW_LINE)),
+                                           _mm256_loadu_si256((const __m256i *)(y + i * MEMVIEW_LINE)));
+            unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(eq);
+            bits |= (unsigned long long)((mask & 0xFFFF) != 0) << i;
+            bits |= (unsigned long long)((mask >> 16) != 0) << (i + 1);
+        }
+#elif defined(__SSE2__)
+        for (unsigned int i = 0; i < 64; i++) {
+            __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(x + i * MEMVIEW_LINE)),
+                                        _mm_loadu_si128((const __m128i *)(y + i * MEMVIEW_LINE)));
+            bits |= (unsigned long long)(_mm_movemask_epi8(eq) != 0xFFFF) << i;
+        }
+#else
+        for (unsigned int i = 0; i < 64; i++) {
+            bits |= (unsigned long long)(memcmp(x + i * MEMVIEW_LINE, y + i * MEMVIEW_LINE, MEMVIEW_LINE) != 0) << i;
+        }
+#endif
+        changed[w] = bits;
+        count += __builtin_popcountll(bits);
+    }
+    return count;
+}
+
+int memview_diff(FILE *out, const unsigned char *old, const unsigned char *new) {
+    unsigned long long changed[MEMVIEW_LINES / 64];
+    int count = memview_changed(old, new, changed);
+    if (count == 0) {
+        return 0;
+    }
+    char *buf = malloc((size_t)count * 2 * (MEMVIEW_LINE_SIZE + 1));
+    if (buf == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    char *p = buf;
+    for (unsigned int w = 0; w < MEMVIEW_LINES / 64; w++) {
+        for (unsigned long long bits = changed[w]; bits; bits &= bits - 1) {
+            unsigned int address = (w * 64 + __builtin_ctzll(bits)) * MEMVIEW_LINE;
+            *p++ = '-';
+            p = format_line(p, old, address, 0, MEMORY_SIZE - 1);
+            *p++ = '+';
+            p = format_line(p, new, address, 0, MEMORY_SIZE - 1);
+        }
+    }
+    fwrite(buf, 1, p - buf, out);
+    free(buf);
+    return count;
+}
+
+int memview_load(const char *path, unsigned char *mem) {
+    FILE *f = fopen(path, "rb");
+    char magic[4];
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    if (n == sizeof(magic) && memcmp(magic, SAVESTATE_MAGIC, 4) == 0) {
+        fclose(f);
+        CPU6502 cpu;
+        cpu_init(&cpu);
+        cpu.mem = mem;
+        if (savestate_boot(path, &cpu, NULL) < 0) {
+            return -1;
+        }
+        // Version 1 maps the saved memory instead of filling mem
+        if (cpu.mem != mem) {
+            memcpy(mem, cpu.mem, MEMORY_SIZE);
+            munmap(cpu.mem - SAVESTATE_HEADER_SIZE, SAVESTATE_HEADER_SIZE + MEMORY_SIZE);
+        }
+        return 0;
+    }
+    memset(mem, 0, MEMORY_SIZE);
+    memcpy(mem, magic, n);
+    fread(mem + n, 1, MEMORY_SIZE - n, f);
+    fclose(f);
+    return 0;
+}
+
+int memview_save(const char *path, const unsigned char *mem) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    fwrite(mem, 1, MEMORY_SIZE, f);
+    if (fclose(f) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
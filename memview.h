@@ -0,0 +1,32 @@
+/*6502 emul - memory inspector: hex dumps and snapshot diffs*/
+#ifndef MEMVIEW_H
+#define MEMVIEW_H
+#include <stdio.h>
+#include "cpu6502.h"
+
+#define MEMVIEW_LINE 16
+#define MEMVIEW_LINES (MEMORY_SIZE / MEMVIEW_LINE)
+// "0400: A9 41 20 ... 00  |.A .............|\n"
+#define MEMVIEW_LINE_SIZE (6 + MEMVIEW_LINE * 3 + 1 + MEMVIEW_LINE + 3)
+
+// Format start..end (inclusive) as hex dump lines into buf, which must
+// hold memview_size(start, end) bytes. Lines cover whole 16-byte rows;
+// bytes outside the range are left blank. Returns the length.
+size_t memview_size(unsigned int start, unsigned int end);
+size_t memview_format(char *buf, const unsigned char *mem, unsigned int start, unsigned int end);
+// Hex dump of start..end with a single write
+void memview_dump(FILE *out, const unsigned char *mem, unsigned int start, unsigned int end);
+
+// Mark each 16-byte line that differs between a and b (64 KB each) with
+// a bit in changed; returns the number of changed lines
+int memview_changed(const unsigned char *a, const unsigned char *b, unsigned long long changed[MEMVIEW_LINES / 64]);
+// Print the changed lines of two snapshots, each as a "-" line (old) and
+// a "+" line (new); returns the number of changed lines
+int memview_diff(FILE *out, const unsigned char *old, const unsigned char *new);
+
+// Read a 64 KB memory image from a savestate (either version) or a raw
+// file, which fills memory from $0000 (shorter files are zero padded)
+int memview_load(const char *path, unsigned char *mem);
+// Write the 64 KB address space as a raw image
+int memview_save(const char *path, const unsigned char *mem);
+#endif
@@ -0,0 +1,84 @@
+/*6502 emul - memory-mapped I/O*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "mmio.h"
+
+typedef struct {
+    unsigned short base;
+    unsigned short size;
+    mmio_read_fn read;
+    mmio_write_fn write;
+    void *dev;
+} MMIODevice;
+
+unsigned char mmio_pages[MEMORY_SIZE >> 8];
+static MMIODevice devices[MMIO_MAX_DEVICES];
+static int device_count = 0;
+static mmio_tap_fn tap_fn = NULL;
+static mmio_write_tap_fn write_tap_fn = NULL;
+static void *tap_ctx;
+
+// Map size registers starting at base onto a device
+void mmio_map(unsigned short base, unsigned short size, mmio_read_fn read, mmio_write_fn write, void *dev) {
+    if (device_count == MMIO_MAX_DEVICES || size == 0 || base + size > MEMORY_SIZE) {
+        printf("Cannot map device at 0x%04X\n", base);
+        exit(1);
+    }
+    MMIODevice *d = &devices[device_count++];
+    d->base = base;
+    d->size = size;
+    d->read = read;
+    d->write = write;
+    d->dev = dev;
+    for (int page = base >> 8; page <= (base + size - 1) >> 8; page++) {
+        mmio_pages[page] = 1;
+    }
+}
+
+// Remove every device
+void mmio_reset(void) {
+    device_count = 0;
+    for (int page = 0; page < (MEMORY_SIZE >> 8); page++) {
+        mmio_pages[page] = 0;
+    }
+}
+
+void mmio_tap(mmio_tap_fn read_tap, mmio_write_tap_fn write_tap, void *ctx) {
+    tap_fn = read_tap;
+    write_tap_fn = write_tap;
+    tap_ctx = ctx;
+}
+
+// Device owning address, or NULL for plain memory in an I/O page
+static MMIODevice *find_device(unsigned short address) {
+    for (int i = 0; i < device_count; i++) {
+        if ((unsigned short)(address - devices[i].base) < devices[i].size) {
+            return &devices[i];
+        }
+    }
+    return NULL;
+}
+
+unsigned char mmio_read(unsigned char *mem, unsigned short address) {
+    MMIODevice *d = find_device(address);
+    if (d == NULL) {
+        return mem[address];
+    }
+    if (tap_fn) {
+        return tap_fn(tap_ctx, d->read, d->dev, address - d->base);
+    }
+    return d->read(d->dev, address - d->base);
+}
+
+void mmio_write(unsigned char *mem, unsigned short address, unsigned char value) {
+    MMIODevice *d = find_device(address);
+    if (d == NULL) {
+        mem[address] = value;
+        return;
+    }
+    if (write_tap_fn) {
+        write_tap_fn(tap_ctx, d->write, d->dev, address - d->base, value);
+        return;
+    }
+    d->write(d->dev, address - d->base, value);
+}
@@ -0,0 +1,33 @@
+/*6502 emul - memory-mapped I/O*/
+#ifndef MMIO_H
+#define MMIO_H
+#include "cpu6502.h"
+// Device register handlers: dev is the pointer given to mmio_map and
+// reg is the offset of the register from the device base
+typedef unsigned char (*mmio_read_fn)(void *dev, unsigned short reg);
+typedef void (*mmio_write_fn)(void *dev, unsigned short reg, unsigned char value);
+
+#define MMIO_MAX_DEVICES 8
+
+// Non-zero for every 256-byte page that holds device registers
+extern unsigned char mmio_pages[MEMORY_SIZE >> 8];
+
+// Checked on every data access, so keep it a single byte test
+static inline int mmio_is_device(unsigned short address) {
+    return mmio_pages[address >> 8];
+}
+
+// Stand in for every access to a device register (record/replay); they
+// may call read(dev, reg) or write(dev, reg, value) themselves
+typedef unsigned char (*mmio_tap_fn)(void *ctx, mmio_read_fn read, void *dev, unsigned short reg);
+typedef void (*mmio_write_tap_fn)(void *ctx, mmio_write_fn write, void *dev, unsigned short reg,
+                                  unsigned char value);
+
+void mmio_map(unsigned short base, unsigned short size, mmio_read_fn read, mmio_write_fn write, void *dev);
+void mmio_reset(void);
+// Route device accesses through the taps (NULL: straight to the devices)
+void mmio_tap(mmio_tap_fn read_tap, mmio_write_tap_fn write_tap, void *ctx);
+// mem backs the addresses of an I/O page that no device claims
+unsigned char mmio_read(unsigned char *mem, unsigned short address);
+void mmio_write(unsigned char *mem, unsigned short address, unsigned char value);
+#endif
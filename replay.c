@@ -0,0 +1,600 @@
+/*6502 emul - deterministic record and replay of external inputs*/
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hostcall.h"
+#include "fileio.h"
+#include "mmio.h"
+#include "replay.h"
+
+#define REPLAY_BUFFER_SIZE 65536
+#define REPLAY_MAX_CHARS 256 // console characters in one record
+#define REPLAY_MAX_PENDING (REPLAY_MAX_CHARS + 24) // encoded pending records
+#define FILE_CALLS (HOSTCALL_FCLOSE - HOSTCALL_FOPEN + 1)
+
+struct Replay {
+    Console console; // first, so the console calls get back to the replay
+    Console *inner;
+    int replaying;
+    int quiet; // drop console output and device writes
+    // Recording: the log, or for a log file what is not written yet.
+    // A signal handler may write out the complete records, so the
+    // pending input is only read there while writing is 0.
+    unsigned char *out;
+    size_t out_len;
+    size_t out_size;
+    volatile size_t committed; // end of the last complete record
+    volatile sig_atomic_t writing;
+    int fd; // log file, -1 in memory
+    long written; // bytes of the log already in the file
+    int in_memory;
+    // Not logged yet: console characters, or a run of device reads
+    // (also used while replaying a record)
+    unsigned char chars[REPLAY_MAX_CHARS];
+    unsigned int char_count;
+    unsigned int char_pos;
+    unsigned char run_value;
+    unsigned long run_count;
+    // Replaying: the whole log
+    unsigned char *data;
+    long len;
+    long pos;
+    int live; // past the end of the log: inputs come from the host again
+    // Counters
+    unsigned long inputs;
+    unsigned long device_reads;
+};
+
+// Host calls carry no context: one machine is recorded or replayed at a time
+static Replay *active;
+static hostcall_fn file_fns[FILE_CALLS];
+// Bytes of the parameter block each file call may change
+static const unsigned char file_block_sizes[FILE_CALLS] = { 0, 5, 5, 6, 0 };
+// A session stopped with Ctrl-C still leaves a complete log
+static const int record_signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+static void (*saved_handlers[4])(int);
+
+static size_t encode_varint(unsigned char *p, unsigned long v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static void put_bytes(Replay *r, const void *p, size_t n) {
+    if (r->out_len + n > r->out_size) {
+        // Only an in-memory log grows: a log file's buffer has room for
+        // one more record of any size (see replay_record)
+        size_t size = r->out_size * 2;
+        while (size < r->out_len + n) {
+            size *= 2;
+        }
+        r->out = realloc(r->out, size);
+        if (r->out == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        r->out_size = size;
+    }
+    memcpy(r->out + r->out_len, p, n);
+    r->out_len += n;
+}
+
+static void put_byte(Replay *r, unsigned char c) {
+    put_bytes(r, &c, 1);
+}
+
+static void put_varint(Replay *r, unsigned long v) {
+    unsigned char buf[10];
+    put_bytes(r, buf, encode_varint(buf, v));
+}
+
+// Write all of buf; async-signal-safe
+static void write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// Move the log buffer to the file, with the record signals held off
+static void flush_log(Replay *r) {
+    sigset_t set, old;
+    sigemptyset(&set);
+    for (int i = 0; i < 4; i++) {
+        sigaddset(&set, record_signals[i]);
+    }
+    sigprocmask(SIG_BLOCK, &set, &old);
+    write_all(r->fd, r->out, r->out_len);
+    r->written += r->out_len;
+    r->out_len = 0;
+    r->committed = 0;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// Around every change to the log or the pending input
+static void log_begin(Replay *r) {
+    r->writing = 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+static void log_end(Replay *r) {
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    r->committed = r->out_len;
+    r->writing = 0;
+    if (r->fd >= 0 && r->out_len >= REPLAY_BUFFER_SIZE) {
+        flush_log(r);
+    }
+}
+
+// The pending input as records; async-signal-safe
+static size_t encode_pending(const Replay *r, unsigned char *buf) {
+    size_t n = 0;
+    if (r->char_count > 0) {
+        buf[n++] = 'c';
+        n += encode_varint(buf + n, r->char_count);
+        memcpy(buf + n, r->chars, r->char_count);
+        n += r->char_count;
+    }
+    if (r->run_count > 0) {
+        buf[n++] = 'd';
+        buf[n++] = r->run_value;
+        n += encode_varint(buf + n, r->run_count);
+    }
+    return n;
+}
+
+// Between log_begin and log_end
+static void flush_pending(Replay *r) {
+    unsigned char buf[REPLAY_MAX_PENDING];
+    put_bytes(r, buf, encode_pending(r, buf));
+    r->char_count = 0;
+    r->run_count = 0;
+}
+
+// Start an input record; log_end completes it
+static void put_tag(Replay *r, int tag) {
+    log_begin(r);
+    flush_pending(r);
+    put_byte(r, tag);
+}
+
+static void diverged(Replay *r, const char *expected) {
+    fprintf(stderr, "Replay diverged at log offset %ld: guest asked for %s, log has '%c'\n", r->pos, expected,
+            r->data[r->pos]);
+    exit(1);
+}
+
+// Tag of the next record, or EOF at the end of the log. There a
+// rewound in-memory log records again, and a log file goes live.
+static int next_tag(Replay *r) {
+    if (r->pos >= r->len) {
+        if (r->in_memory) {
+            r->replaying = 0;
+            r->char_count = 0;
+            r->run_count = 0;
+        } else {
+            fprintf(stderr, "Replay: end of the log, continuing with live input\n");
+            r->live = 1;
+        }
+        return EOF;
+    }
+    return r->data[r->pos++];
+}
+
+static unsigned long get_varint(Replay *r) {
+    unsigned long v = 0;
+    int shift = 0;
+    while (r->pos < r->len) {
+        unsigned char b = r->data[r->pos++];
+        v |= (unsigned long)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+        shift += 7;
+    }
+    fprintf(stderr, "Replay: log truncated\n");
+    exit(1);
+}
+
+// The next n bytes of the log
+static const unsigned char *get_bytes(Replay *r, unsigned long n) {
+    if (n > r->len - r->pos) {
+        fprintf(stderr, "Replay: log truncated\n");
+        exit(1);
+    }
+    r->pos += n;
+    return r->data + r->pos - n;
+}
+
+static int replay_getc(Console *con) {
+    Replay *r = (Replay *)con;
+    if (r->live) {
+        return r->inner->getc(r->inner);
+    }
+    r->inputs++;
+    if (!r->replaying) {
+        int c = r->inner->getc(r->inner);
+        if (c == EOF) {
+            put_tag(r, 'e');
+        } else if (c == CONSOLE_AGAIN) {
+            put_tag(r, 'a');
+        } else {
+            log_begin(r);
+            if (r->run_count > 0 || r->char_count == REPLAY_MAX_CHARS) {
+                flush_pending(r);
+            }
+            r->chars[r->char_count++] = c;
+        }
+        log_end(r);
+        return c;
+    }
+    if (r->char_pos < r->char_count) {
+        return r->chars[r->char_pos++];
+    }
+    switch (next_tag(r)) {
+        case EOF:
+            r->inputs--;
+            return replay_getc(con);
+        case 'e':
+            return EOF;
+        case 'a':
+            return CONSOLE_AGAIN;
+        case 'c':
+            r->char_count = get_varint(r);
+            if (r->char_count == 0 || r->char_count > REPLAY_MAX_CHARS) {
+                fprintf(stderr, "Replay: bad record at log offset %ld\n", r->pos);
+                exit(1);
+            }
+            memcpy(r->chars, get_bytes(r, r->char_count), r->char_count);
+            r->char_pos = 1;
+            return r->chars[0];
+        default:
+            r->pos--;
+            diverged(r, "a character");
+            return EOF;
+    }
+}
+
+static int replay_gets(Console *con, char *buf, unsigned int size) {
+    Replay *r = (Replay *)con;
+    if (r->live) {
+        return r->inner->gets(r->inner, buf, size);
+    }
+    r->inputs++;
+    if (!r->replaying) {
+        int len = r->inner->gets(r->inner, buf, size);
+        if (len == EOF) {
+            put_tag(r, 'e');
+        } else if (len == CONSOLE_AGAIN) {
+            put_tag(r, 'a');
+        } else {
+            put_tag(r, 'l');
+            put_varint(r, len);
+            put_bytes(r, buf, len);
+        }
+        log_end(r);
+        return len;
+    }
+    switch (next_tag(r)) {
+        case EOF:
+            r->inputs--;
+            return replay_gets(con, buf, size);
+        case 'e':
+            return EOF;
+        case 'a':
+            return CONSOLE_AGAIN;
+        case 'l': {
+            unsigned long len = get_varint(r);
+            if (len > size - 1) {
+                diverged(r, "a shorter line");
+            }
+            memcpy(buf, get_bytes(r, len), len);
+            buf[len] = 0;
+            return len;
+        }
+        default:
+            r->pos--;
+            diverged(r, "a line");
+            return EOF;
+    }
+}
+
+static int replay_write(Console *con, const unsigned char *buf, unsigned int len) {
+    Replay *r = (Replay *)con;
+    if (r->quiet) {
+        return 0;
+    }
+    return r->inner->write(r->inner, buf, len);
+}
+
+// Runs of reads returning the same value (a guest polling a status
+// register) take one record
+static unsigned char device_tap(void *ctx, mmio_read_fn read, void *dev, unsigned short reg) {
+    Replay *r = ctx;
+    if (r->live) {
+        return read(dev, reg);
+    }
+    r->device_reads++;
+    if (!r->replaying) {
+        unsigned char value = read(dev, reg);
+        log_begin(r);
+        if (r->char_count > 0 || (r->run_count > 0 && value != r->run_value)) {
+            flush_pending(r);
+        }
+        r->run_value = value;
+        r->run_count++;
+        log_end(r);
+        return value;
+    }
+    if (r->run_count == 0) {
+        int tag = next_tag(r);
+        if (tag == EOF) {
+            r->device_reads--;
+            return device_tap(ctx, read, dev, reg);
+        }
+        if (tag != 'd') {
+            r->pos--;
+            diverged(r, "a device read");
+        }
+        r->run_value = *get_bytes(r, 1);
+        r->run_count = get_varint(r);
+    }
+    r->run_count--;
+    return r->run_value;
+}
+
+static void device_write_tap(void *ctx, mmio_write_fn write, void *dev, unsigned short reg, unsigned char value) {
+    Replay *r = ctx;
+    if (!r->quiet) {
+        write(dev, reg, value);
+    }
+}
+
+// Every file host call: run it and log its results, or set the results
+// from the log without touching host files
+static void file_call(CPU6502 *cpu, unsigned char *mem, int call) {
+    Replay *r = active;
+    unsigned short address = hostcall_pointer(cpu);
+    unsigned int size = file_block_sizes[call];
+    unsigned char *block = address + size <= MEMORY_SIZE ? mem + address : NULL;
+    if (r->live) {
+        file_fns[call](cpu, mem);
+        return;
+    }
+    r->inputs++;
+    if (!r->replaying) {
+        file_fns[call](cpu, mem);
+        put_tag(r, 'f');
+        put_byte(r, cpu->a);
+        if (block) {
+            put_bytes(r, block, size);
+        }
+        if (call == HOSTCALL_FREAD - HOSTCALL_FOPEN && block && cpu->a == 0) {
+            put_bytes(r, mem + (block[1] | (block[2] << 8)), block[3] | (block[4] << 8));
+        }
+        log_end(r);
+        return;
+    }
+    int tag = next_tag(r);
+    if (tag == EOF) {
+        r->inputs--;
+        file_call(cpu, mem, call);
+        return;
+    }
+    if (tag != 'f') {
+        r->pos--;
+        diverged(r, "a file call");
+    }
+    cpu->a = *get_bytes(r, 1);
+    if (block) {
+        memcpy(block, get_bytes(r, size), size);
+    }
+    if (call == HOSTCALL_FREAD - HOSTCALL_FOPEN && block && cpu->a == 0) {
+        unsigned int done = block[3] | (block[4] << 8);
+        memcpy(mem + (block[1] | (block[2] << 8)), get_bytes(r, done), done);
+    }
+}
+
+static void hc_file_open(CPU6502 *cpu, unsigned char *mem) {
+    file_call(cpu, mem, 0);
+}
+
+static void hc_file_read(CPU6502 *cpu, unsigned char *mem) {
+    file_call(cpu, mem, 1);
+}
+
+static void hc_file_write(CPU6502 *cpu, unsigned char *mem) {
+    file_call(cpu, mem, 2);
+}
+
+static void hc_file_seek(CPU6502 *cpu, unsigned char *mem) {
+    file_call(cpu, mem, 3);
+}
+
+static void hc_file_close(CPU6502 *cpu, unsigned char *mem) {
+    file_call(cpu, mem, 4);
+}
+
+// Write out the complete records and, unless the guest was interrupted
+// while changing it, the pending input; then let the handler installed
+// before (the terminal's, or the default) deal with the signal. Only
+// async-signal-safe calls.
+static void record_signal(int sig) {
+    Replay *r = active;
+    if (r && r->fd >= 0) {
+        write_all(r->fd, r->out, r->committed);
+        if (!r->writing) {
+            unsigned char buf[REPLAY_MAX_PENDING];
+            write_all(r->fd, buf, encode_pending(r, buf));
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        if (record_signals[i] == sig) {
+            signal(sig, saved_handlers[i]);
+        }
+    }
+    raise(sig);
+}
+
+static Replay *replay_new(int replaying) {
+    static const hostcall_fn wrappers[FILE_CALLS] = {
+        hc_file_open, hc_file_read, hc_file_write, hc_file_seek, hc_file_close,
+    };
+    Replay *r = calloc(1, sizeof(Replay));
+    if (r == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    r->replaying = replaying;
+    r->fd = -1;
+    r->console.getc = replay_getc;
+    r->console.gets = replay_gets;
+    r->console.write = replay_write;
+    for (int i = 0; i < FILE_CALLS; i++) {
+        file_fns[i] = hostcall_table[HOSTCALL_FOPEN + i];
+        hostcall_register(HOSTCALL_FOPEN + i, wrappers[i]);
+    }
+    mmio_tap(device_tap, device_write_tap, r);
+    active = r;
+    return r;
+}
+
+Replay *replay_record(const char *path) {
+    Replay *r = replay_new(0);
+    r->in_memory = path == NULL;
+    // A log file is written out once REPLAY_BUFFER_SIZE bytes are
+    // complete; the rest leaves room for a 64 KB file read record
+    r->out_size = path ? 2 * REPLAY_BUFFER_SIZE + 256 : REPLAY_BUFFER_SIZE;
+    r->out = malloc(r->out_size);
+    if (r->out == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    if (path) {
+        r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (r->fd < 0) {
+            printf("Cannot create %s\n", path);
+            replay_close(r, NULL);
+            return NULL;
+        }
+        // Ignored signals stay ignored
+        for (int i = 0; i < 4; i++) {
+            saved_handlers[i] = signal(record_signals[i], record_signal);
+            if (saved_handlers[i] == SIG_IGN) {
+                signal(record_signals[i], SIG_IGN);
+            }
+        }
+    }
+    log_begin(r);
+    put_bytes(r, REPLAY_MAGIC, 4);
+    put_byte(r, REPLAY_VERSION);
+    log_end(r);
+    return r;
+}
+
+Replay *replay_open(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Cannot open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = malloc(len > 0 ? len : 1);
+    if (data == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    if (len < 5 || fread(data, 1, len, f) != len || memcmp(data, REPLAY_MAGIC, 4) != 0 ||
+        data[4] != REPLAY_VERSION) {
+        printf("Not a replay log: %s\n", path);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    Replay *r = replay_new(1);
+    r->data = data;
+    r->len = len;
+    r->pos = 5;
+    return r;
+}
+
+Console *replay_console(Replay *r, Console *inner) {
+    r->inner = inner;
+    return &r->console;
+}
+
+long replay_position(Replay *r) {
+    if (r->replaying) {
+        return r->pos;
+    }
+    log_begin(r);
+    flush_pending(r);
+    log_end(r);
+    return r->written + r->out_len;
+}
+
+void replay_seek(Replay *r, long pos) {
+    if (!r->replaying) {
+        log_begin(r);
+        flush_pending(r);
+        log_end(r);
+        // Valid until recording resumes and the log grows
+        r->data = r->out;
+        r->len = r->out_len;
+        r->replaying = 1;
+    }
+    r->pos = pos;
+    r->char_count = 0;
+    r->char_pos = 0;
+    r->run_count = 0;
+}
+
+void replay_quiet(Replay *r, int quiet) {
+    r->quiet = quiet;
+}
+
+void replay_close(Replay *r, FILE *out) {
+    long size;
+    if (r->out == NULL) {
+        size = r->pos;
+    } else {
+        log_begin(r);
+        flush_pending(r);
+        log_end(r);
+        size = r->written + r->out_len;
+        if (r->in_memory) {
+            r->data = NULL;
+        } else if (r->fd >= 0) {
+            flush_log(r);
+            for (int i = 0; i < 4; i++) {
+                signal(record_signals[i], saved_handlers[i]);
+            }
+            close(r->fd);
+        }
+        free(r->out);
+    }
+    mmio_tap(NULL, NULL, NULL);
+    for (int i = 0; i < FILE_CALLS; i++) {
+        hostcall_register(HOSTCALL_FOPEN + i, file_fns[i]);
+    }
+    active = NULL;
+    if (out) {
+        fprintf(out, "%s: %lu console and file inputs, %lu device reads, %ld bytes of log\n", r->replaying ? "Replay" : "Record",
+                r->inputs, r->device_reads, size);
+    }
+    free(r->data);
+    free(r);
+}
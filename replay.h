@@ -0,0 +1,48 @@
+/*6502 emul - deterministic record and replay of external inputs*/
+#ifndef REPLAY_H
+#define REPLAY_H
+#include <stdio.h>
+#include "console.h"
+
+// Log: the magic and version byte, then one record per input in the
+// order the guest took them. Lengths and counts are LEB128 varints.
+//   'c' n bytes   n console characters read one at a time
+//   'e'           console end of input
+//   'a'           console not ready (CONSOLE_AGAIN)
+//   'l' len bytes console line (GETS)
+//   'd' byte n    n device register reads that all returned byte
+//   'f' a block [data]  file host call: A, the parameter block as the
+//                 call left it, and for READ the bytes read
+// The guest is deterministic given these, so replaying them reruns the
+// same instructions. The guest has no clock and no interrupts, so
+// nothing else needs logging.
+#define REPLAY_MAGIC "E65R"
+#define REPLAY_VERSION 1
+
+typedef struct Replay Replay;
+
+// Log every input of the machine to path: device reads and file host
+// calls from now on, console input through replay_console. With a NULL
+// path the log is kept in memory and the machine can be rewound.
+Replay *replay_record(const char *path);
+// Feed the inputs logged in path back: device reads and file host calls
+// are answered from the log without reaching the devices or host files.
+// Past the end of the log the machine gets live input again.
+Replay *replay_open(const char *path);
+// Console whose input is recorded from inner or replayed from the log;
+// output always goes to inner
+Console *replay_console(Replay *r, Console *inner);
+// Log offset of the next input (an in-memory log being recorded, or a
+// log being replayed up to where it was recorded)
+long replay_position(Replay *r);
+// The machine was put back to where replay_position returned pos: feed
+// it the inputs it took from there again. Once they run out the log
+// records again. In-memory logs only.
+void replay_seek(Replay *r, long pos);
+// Drop console output and device writes, e.g. while re-executing
+// history whose output was already shown
+void replay_quiet(Replay *r, int quiet);
+// Flush the log, restore the devices and host calls and report on out
+// (NULL for no report)
+void replay_close(Replay *r, FILE *out);
+#endif
@@ -0,0 +1,372 @@
+/*6502 emul - savestates*/
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "savestate.h"
+
+static void fill_header(SavestateHeader *h, const CPU6502 *cpu, const Acia *acia) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, SAVESTATE_MAGIC, 4);
+    h->version = SAVESTATE_VERSION;
+    h->a = cpu->a;
+    h->x = cpu->x;
+    h->y = cpu->y;
+    h->sp = cpu->sp;
+    h->p = cpu->p;
+    h->pc = cpu->pc;
+    h->stack_pointer = cpu->stack_pointer;
+    memcpy(h->stack, cpu->stack, sizeof(h->stack));
+    if (acia) {
+        h->acia_present = 1;
+        h->acia_base = acia->base;
+        h->acia_command = acia->command;
+        h->acia_control = acia->control;
+    }
+}
+
+static void restore_cpu(CPU6502 *cpu, const SavestateHeader *h) {
+    cpu->a = h->a;
+    cpu->x = h->x;
+    cpu->y = h->y;
+    cpu->sp = h->sp;
+    cpu->p = h->p;
+    cpu->pc = h->pc;
+    cpu->stack_pointer = h->stack_pointer;
+    memcpy(cpu->stack, h->stack, sizeof(cpu->stack));
+    cpu->stop = CPU_RUNNING;
+}
+
+int savestate_save(const char *path, const CPU6502 *cpu, const Acia *acia) {
+    static unsigned char header[SAVESTATE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    fill_header((SavestateHeader *)header, cpu, acia);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 ||
+        write(fd, header, sizeof(header)) != sizeof(header) ||
+        write(fd, cpu->mem, MEMORY_SIZE) != MEMORY_SIZE) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// LZ77-encode a page with in-page back-references: a control byte
+// n < 128 is followed by n + 1 literal bytes; n >= 128 copies n - 125
+// bytes starting d bytes back, d being the next byte (d = 1 encodes a
+// run). Returns the encoded length, or SAVESTATE_PAGE_SIZE with the
+// page copied as is when encoding does not pay.
+static unsigned int encode_page(const unsigned char *page, unsigned char *out) {
+    short last[256]; // latest position of each 3-byte hash
+    unsigned int in = 0;
+    unsigned int len = 0;
+    unsigned int literals = 0; // pending literals end at in
+    memset(last, -1, sizeof(last));
+    while (in < SAVESTATE_PAGE_SIZE) {
+        unsigned int match = 0;
+        unsigned int distance = 0;
+        if (in + 2 < SAVESTATE_PAGE_SIZE) {
+            unsigned char hash = page[in] * 7 ^ page[in + 1] * 3 ^ page[in + 2];
+            int candidate = last[hash];
+            last[hash] = in;
+            // A run is a match one byte back
+            if (in > 0 && page[in - 1] == page[in] && page[in] == page[in + 1] && page[in] == page[in + 2]) {
+                candidate = in - 1;
+            }
+            if (candidate >= 0) {
+                while (in + match < SAVESTATE_PAGE_SIZE && match < 130 && page[candidate + match] == page[in + match]) {
+                    match++;
+                }
+                distance = in - candidate;
+            }
+        }
+        if (match < 3) {
+            in++;
+            literals++;
+            if (literals < 128 && in < SAVESTATE_PAGE_SIZE) {
+                continue;
+            }
+            match = 0;
+        }
+        if (literals > 0) {
+            if (len + 1 + literals >= SAVESTATE_PAGE_SIZE) {
+                len = SAVESTATE_PAGE_SIZE;
+                break;
+            }
+            out[len++] = literals - 1;
+            memcpy(out + len, page + in - literals, literals);
+            len += literals;
+            literals = 0;
+        }
+        if (match >= 3) {
+            if (len + 2 >= SAVESTATE_PAGE_SIZE) {
+                len = SAVESTATE_PAGE_SIZE;
+                break;
+            }
+            out[len++] = match + 125;
+            out[len++] = distance;
+            in += match;
+        }
+    }
+    if (len >= SAVESTATE_PAGE_SIZE) {
+        memcpy(out, page, SAVESTATE_PAGE_SIZE);
+        return SAVESTATE_PAGE_SIZE;
+    }
+    return len;
+}
+
+// Returns 0, or -1 if the record does not decode to exactly one page
+static int decode_page(const unsigned char *in, unsigned int len, unsigned char *page) {
+    if (len == SAVESTATE_PAGE_SIZE) {
+        memcpy(page, in, SAVESTATE_PAGE_SIZE);
+        return 0;
+    }
+    unsigned int out = 0;
+    unsigned int i = 0;
+    while (i < len) {
+        unsigned int n = in[i++];
+        if (n >= 128) {
+            n -= 125;
+            if (i >= len) {
+                return -1;
+            }
+            unsigned int distance = in[i++];
+            if (distance == 0 || distance > out || out + n > SAVESTATE_PAGE_SIZE) {
+                return -1;
+            }
+            // Byte by byte: the source may overlap what is being written
+            for (unsigned int j = 0; j < n; j++, out++) {
+                page[out] = page[out - distance];
+            }
+        } else {
+            n++;
+            if (i + n > len || out + n > SAVESTATE_PAGE_SIZE) {
+                return -1;
+            }
+            memcpy(page + out, in + i, n);
+            i += n;
+            out += n;
+        }
+    }
+    return out == SAVESTATE_PAGE_SIZE ? 0 : -1;
+}
+
+// Write header and encoded pages of a frozen machine
+static long write_compact(const char *path, SavestateHeader *h, const unsigned char *mem) {
+    static const unsigned char zero[SAVESTATE_PAGE_SIZE];
+    // Worst case: every page stored with its 3-byte record header
+    unsigned char *buf = malloc(sizeof(*h) + (MEMORY_SIZE / SAVESTATE_PAGE_SIZE) * (SAVESTATE_PAGE_SIZE + 3));
+    if (buf == NULL) {
+        return -1;
+    }
+    size_t len = sizeof(*h);
+    h->version = SAVESTATE_COMPACT_VERSION;
+    h->pages = 0;
+    for (int page = 0; page < MEMORY_SIZE / SAVESTATE_PAGE_SIZE; page++) {
+        const unsigned char *data = mem + page * SAVESTATE_PAGE_SIZE;
+        if (memcmp(data, zero, SAVESTATE_PAGE_SIZE) == 0) {
+            continue;
+        }
+        unsigned int n = encode_page(data, buf + len + 3);
+        buf[len] = page;
+        buf[len + 1] = n & 0xFF;
+        buf[len + 2] = n >> 8;
+        len += 3 + n;
+        h->pages++;
+    }
+    memcpy(buf, h, sizeof(*h));
+
+    // Replace the old file only once the new one is complete
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    long result = len;
+    if (fd < 0 || write(fd, buf, len) != (ssize_t)len || close(fd) < 0 || rename(tmp, path) < 0) {
+        perror(path);
+        result = -1;
+    }
+    free(buf);
+    return result;
+}
+
+void savestate_header(SavestateHeader *h, const CPU6502 *cpu, const Acia *acia) {
+    fill_header(h, cpu, acia);
+}
+
+long savestate_write(const char *path, SavestateHeader *h, const unsigned char *mem) {
+    return write_compact(path, h, mem);
+}
+
+long savestate_save_compact(const char *path, const CPU6502 *cpu, const Acia *acia) {
+    SavestateHeader h;
+    fill_header(&h, cpu, acia);
+    return write_compact(path, &h, cpu->mem);
+}
+
+struct SavestateJob {
+    pthread_t thread;
+    char *path;
+    long result;
+    SavestateHeader header;
+    unsigned char mem[MEMORY_SIZE];
+};
+
+static void *save_thread(void *arg) {
+    SavestateJob *job = arg;
+    job->result = write_compact(job->path, &job->header, job->mem);
+    return NULL;
+}
+
+SavestateJob *savestate_save_async(const char *path, const CPU6502 *cpu, const Acia *acia) {
+    SavestateJob *job = malloc(sizeof(SavestateJob));
+    if (job == NULL || (job->path = strdup(path)) == NULL) {
+        free(job);
+        return NULL;
+    }
+    fill_header(&job->header, cpu, acia);
+    memcpy(job->mem, cpu->mem, MEMORY_SIZE);
+    if (pthread_create(&job->thread, NULL, save_thread, job) != 0) {
+        free(job->path);
+        free(job);
+        return NULL;
+    }
+    return job;
+}
+
+long savestate_wait(SavestateJob *job) {
+    if (job == NULL) {
+        return -1;
+    }
+    pthread_join(job->thread, NULL);
+    long result = job->result;
+    free(job->path);
+    free(job);
+    return result;
+}
+
+// Decode a compact savestate into cpu->mem
+static int load_compact(const char *path, int fd, CPU6502 *cpu, Acia **acia) {
+    SavestateHeader h;
+    unsigned char record[3];
+    unsigned char data[SAVESTATE_PAGE_SIZE];
+    if (read(fd, &h, sizeof(h)) != sizeof(h)) {
+        printf("%s: truncated savestate\n", path);
+        return -1;
+    }
+    memset(cpu->mem, 0, MEMORY_SIZE);
+    for (int i = 0; i < h.pages; i++) {
+        if (read(fd, record, 3) != 3) {
+            printf("%s: truncated savestate\n", path);
+            return -1;
+        }
+        unsigned int len = record[1] | (record[2] << 8);
+        if (len > SAVESTATE_PAGE_SIZE || read(fd, data, len) != len ||
+            decode_page(data, len, cpu->mem + record[0] * SAVESTATE_PAGE_SIZE) < 0) {
+            printf("%s: corrupt page record\n", path);
+            return -1;
+        }
+    }
+    restore_cpu(cpu, &h);
+    if (h.acia_present && acia) {
+        *acia = acia_create(h.acia_base, 0, 1);
+        (*acia)->command = h.acia_command;
+        (*acia)->control = h.acia_control;
+    }
+    return 0;
+}
+
+int savestate_boot(const char *path, CPU6502 *cpu, Acia **acia) {
+    int fd = open(path, O_RDONLY);
+    SavestateHeader probe;
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (pread(fd, &probe, sizeof(probe), 0) == sizeof(probe) && memcmp(probe.magic, SAVESTATE_MAGIC, 4) == 0 &&
+        probe.version == SAVESTATE_COMPACT_VERSION) {
+        int result = load_compact(path, fd, cpu, acia);
+        close(fd);
+        return result;
+    }
+    // A short file would fault when the mapping is touched past its end
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < SAVESTATE_HEADER_SIZE + MEMORY_SIZE) {
+        printf("%s: truncated savestate\n", path);
+        close(fd);
+        return -1;
+    }
+    unsigned char *map = mmap(NULL, SAVESTATE_HEADER_SIZE + MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    const SavestateHeader *h = (const SavestateHeader *)map;
+    if (memcmp(h->magic, SAVESTATE_MAGIC, 4) != 0 || h->version != SAVESTATE_VERSION) {
+        printf("%s: not a version %d savestate\n", path, SAVESTATE_VERSION);
+        munmap(map, SAVESTATE_HEADER_SIZE + MEMORY_SIZE);
+        return -1;
+    }
+    restore_cpu(cpu, h);
+    cpu->mem = map + SAVESTATE_HEADER_SIZE;
+    if (h->acia_present && acia) {
+        *acia = acia_create(h->acia_base, 0, 1);
+        (*acia)->command = h->acia_command;
+        (*acia)->control = h->acia_control;
+    }
+    return 0;
+}
+
+typedef struct {
+    Console console;
+    Console *inner;
+    int ready;
+} ReadyConsole;
+
+static int ready_getc(Console *con) {
+    ReadyConsole *r = (ReadyConsole *)con;
+    if (!r->ready) {
+        r->ready = 1;
+        return CONSOLE_AGAIN;
+    }
+    return r->inner->getc(r->inner);
+}
+
+static int ready_gets(Console *con, char *buf, unsigned int size) {
+    ReadyConsole *r = (ReadyConsole *)con;
+    if (!r->ready) {
+        r->ready = 1;
+        return CONSOLE_AGAIN;
+    }
+    return r->inner->gets(r->inner, buf, size);
+}
+
+static int ready_write(Console *con, const unsigned char *buf, unsigned int len) {
+    ReadyConsole *r = (ReadyConsole *)con;
+    return r->inner->write(r->inner, buf, len);
+}
+
+Console *savestate_ready_console(Console *inner) {
+    ReadyConsole *r = calloc(1, sizeof(ReadyConsole));
+    if (r == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    r->console.getc = ready_getc;
+    r->console.gets = ready_gets;
+    r->console.write = ready_write;
+    r->inner = inner;
+    return &r->console;
+}
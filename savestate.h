@@ -0,0 +1,64 @@
+/*6502 emul - savestates*/
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+#include "cpu6502.h"
+#include "console.h"
+#include "acia.h"
+
+#define SAVESTATE_MAGIC "E65S"
+// Version 1: header padded to SAVESTATE_HEADER_SIZE, then all 64 KB of
+// memory on a page boundary so it can be mapped
+#define SAVESTATE_VERSION 1
+#define SAVESTATE_HEADER_SIZE 4096
+// Version 2 (compact): the bare header, then one record per 256-byte
+// guest page that is not all zero: page number (1 byte), length
+// (2 bytes, little endian) and the page LZ77-encoded within itself
+// (see encode_page), stored as is when the length is 256
+#define SAVESTATE_COMPACT_VERSION 2
+#define SAVESTATE_PAGE_SIZE 256
+
+typedef struct {
+    char magic[4];
+    unsigned int version;
+    // CPU
+    unsigned char a, x, y, sp, p;
+    unsigned char stack_pointer;
+    unsigned short pc;
+    unsigned short stack[STACK_SIZE];
+    // Devices
+    unsigned char acia_present;
+    unsigned char acia_command;
+    unsigned char acia_control;
+    unsigned short acia_base;
+    // Version 2: number of page records after the header
+    unsigned short pages;
+} SavestateHeader;
+
+// A machine frozen for a background save
+typedef struct SavestateJob SavestateJob;
+
+// Write CPU, memory and device state (acia may be NULL)
+int savestate_save(const char *path, const CPU6502 *cpu, const Acia *acia);
+// Compact (version 2) savestate; returns its size in bytes, or -1
+long savestate_save_compact(const char *path, const CPU6502 *cpu, const Acia *acia);
+// Copy the machine (a 64 KB memcpy) and write a compact savestate of
+// the copy on a background thread while the caller keeps running
+SavestateJob *savestate_save_async(const char *path, const CPU6502 *cpu, const Acia *acia);
+// Wait for a background save; returns its size in bytes, or -1
+long savestate_wait(SavestateJob *job);
+// Building blocks for callers that keep their own copy of memory:
+// the header of a running machine, and a compact savestate of a header
+// plus a 64 KB memory image (written to path.tmp, then renamed)
+void savestate_header(SavestateHeader *h, const CPU6502 *cpu, const Acia *acia);
+long savestate_write(const char *path, SavestateHeader *h, const unsigned char *mem);
+// Resume from a savestate. Version 1 takes a single mmap: cpu->mem
+// points at a private copy-on-write mapping of the saved memory.
+// Version 2 is decoded into cpu->mem. An ACIA in the snapshot is
+// recreated on stdin/stdout and returned through *acia.
+int savestate_boot(const char *path, CPU6502 *cpu, Acia **acia);
+
+// Console that stops the CPU (CPU_WAIT_IO) the first time the guest
+// asks for input, so the caller can snapshot the machine at its ready
+// prompt; afterwards every call goes to inner
+Console *savestate_ready_console(Console *inner);
+#endif
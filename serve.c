@@ -0,0 +1,302 @@
+/*6502 emul - guest consoles over a Unix-domain socket*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "console.h"
+#include "fileio.h"
+#include "serve.h"
+
+// One connected client and its machine, with file handles of its own.
+// Sessions wait on epoll while their guest is blocked on input and only
+// run when it arrives.
+typedef struct Session {
+    Console console; // first, so the host calls get back to the session
+    CPU6502 cpu;
+    int fd;
+    unsigned int events; // current epoll interest
+    int queued;          // in the run queue
+    int dead;            // connection gone, free when dequeued
+    unsigned char in[SESSION_INPUT_SIZE];
+    unsigned int in_head;
+    unsigned int in_len;
+    unsigned char *out;
+    unsigned int out_len;
+    unsigned int out_size;
+    FileTable files; // the guest's file handles
+    struct Session *next; // run queue link
+} Session;
+
+static int epoll_fd;
+static Session *run_head = NULL;
+static Session *run_tail = NULL;
+// Pages of the boot image that are not all zero
+static unsigned char boot_pages[MEMORY_SIZE / 4096];
+
+static void queue_session(Session *s) {
+    if (s->queued) {
+        return;
+    }
+    s->queued = 1;
+    s->next = NULL;
+    if (run_tail) {
+        run_tail->next = s;
+    } else {
+        run_head = s;
+    }
+    run_tail = s;
+}
+
+static int session_getc(Console *con) {
+    Session *s = (Session *)con;
+    if (s->in_len == 0) {
+        return CONSOLE_AGAIN;
+    }
+    s->in_len--;
+    return s->in[s->in_head++];
+}
+
+// A line is ready once a newline arrived or size - 1 bytes are waiting
+static int session_gets(Console *con, char *buf, unsigned int size) {
+    Session *s = (Session *)con;
+    unsigned char *start = s->in + s->in_head;
+    unsigned int len = s->in_len < size - 1 ? s->in_len : size - 1;
+    unsigned char *nl = memchr(start, '\n', len);
+    if (nl) {
+        len = nl - start + 1;
+    } else if (len < size - 1) {
+        return CONSOLE_AGAIN;
+    }
+    memcpy(buf, start, len);
+    buf[len] = 0;
+    s->in_head += len;
+    s->in_len -= len;
+    return len;
+}
+
+static int session_write(Console *con, const unsigned char *buf, unsigned int len) {
+    Session *s = (Session *)con;
+    if (s->out_len >= SESSION_OUTPUT_LIMIT) {
+        return CONSOLE_AGAIN;
+    }
+    if (s->out_len + len > s->out_size) {
+        unsigned int size = s->out_size ? s->out_size : 256;
+        while (size < s->out_len + len) {
+            size *= 2;
+        }
+        s->out = realloc(s->out, size);
+        if (s->out == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        s->out_size = size;
+    }
+    memcpy(s->out + s->out_len, buf, len);
+    s->out_len += len;
+    return 0;
+}
+
+// Release the machine and the files its guest left open
+static void free_session(Session *s) {
+    fileio_use(&s->files);
+    fileio_close_all();
+    fileio_use(NULL);
+    munmap(s->cpu.mem, MEMORY_SIZE);
+    free(s->out);
+    free(s);
+}
+
+static void close_session(Session *s) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    s->dead = 1;
+    if (!s->queued) {
+        free_session(s);
+    }
+}
+
+// Ask epoll for input while there is room for it (fill_session moves
+// unread input down first) and for writability while output is pending
+static void update_events(Session *s) {
+    unsigned int events = 0;
+    if (s->in_len < SESSION_INPUT_SIZE) {
+        events |= EPOLLIN;
+    }
+    if (s->out_len > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events != s->events) {
+        struct epoll_event ev = { events, { .ptr = s } };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s->fd, &ev);
+        s->events = events;
+    }
+}
+
+// Send pending output; returns -1 if the connection failed
+static int flush_session(Session *s) {
+    unsigned int done = 0;
+    while (done < s->out_len) {
+        ssize_t n = send(s->fd, s->out + done, s->out_len - done, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        done += n;
+    }
+    memmove(s->out, s->out + done, s->out_len - done);
+    s->out_len -= done;
+    return 0;
+}
+
+// Read what the client sent; returns -1 once it hung up
+static int fill_session(Session *s) {
+    if (s->in_head > 0) {
+        memmove(s->in, s->in + s->in_head, s->in_len);
+        s->in_head = 0;
+    }
+    // Full: a zero-length recv would look like a hang-up
+    if (s->in_len == SESSION_INPUT_SIZE) {
+        return 0;
+    }
+    ssize_t n = recv(s->fd, s->in + s->in_len, SESSION_INPUT_SIZE - s->in_len, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return -1;
+    }
+    if (n > 0) {
+        s->in_len += n;
+    }
+    return 0;
+}
+
+static void accept_sessions(int listen_fd, const CPU6502 *boot) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        Session *s = calloc(1, sizeof(Session));
+        // Fresh anonymous pages: untouched memory costs nothing
+        unsigned char *mem = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (s == NULL || mem == MAP_FAILED) {
+            free(s);
+            close(fd);
+            return;
+        }
+        for (int page = 0; page < MEMORY_SIZE / 4096; page++) {
+            if (boot_pages[page]) {
+                memcpy(mem + page * 4096, boot->mem + page * 4096, 4096);
+            }
+        }
+        s->cpu = *boot;
+        s->cpu.mem = mem;
+        s->cpu.console = &s->console;
+        s->console.getc = session_getc;
+        s->console.gets = session_gets;
+        s->console.write = session_write;
+        s->fd = fd;
+        s->events = EPOLLIN;
+        struct epoll_event ev = { EPOLLIN, { .ptr = s } };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        queue_session(s);
+    }
+}
+
+// Run every queued session for one slice. Sessions whose guest is
+// waiting for input leave the queue until epoll reports some.
+static void run_sessions(void) {
+    Session *s = run_head;
+    run_head = run_tail = NULL;
+    while (s) {
+        Session *next = s->next;
+        s->queued = 0;
+        if (s->dead) {
+            free_session(s);
+            s = next;
+            continue;
+        }
+        s->cpu.stop = CPU_RUNNING;
+        fileio_use(&s->files);
+        for (int i = 0; i < SESSION_SLICE && s->cpu.stop == CPU_RUNNING; i++) {
+            execute_instruction(&s->cpu);
+        }
+        fileio_use(NULL);
+        if (flush_session(s) < 0 || (s->cpu.stop != CPU_RUNNING && s->cpu.stop != CPU_WAIT_IO)) {
+            // Connection lost, or the guest exited or crashed
+            close_session(s);
+        } else {
+            if (s->cpu.stop == CPU_RUNNING) {
+                queue_session(s);
+            }
+            update_events(s);
+        }
+        s = next;
+    }
+}
+
+int serve(const char *path, const CPU6502 *boot) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        perror(path);
+        return 1;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { EPOLLIN, { .ptr = NULL } };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    for (int page = 0; page < MEMORY_SIZE / 4096; page++) {
+        for (int i = 0; i < 4096; i++) {
+            if (boot->mem[page * 4096 + i]) {
+                boot_pages[page] = 1;
+                break;
+            }
+        }
+    }
+    printf("Serving guest consoles on %s\n", path);
+    fflush(stdout);
+
+    struct epoll_event events[256];
+    for (;;) {
+        // Sleep in epoll_wait unless some guest still has work to do
+        int n = epoll_wait(epoll_fd, events, 256, run_head ? 0 : -1);
+        for (int i = 0; i < n; i++) {
+            Session *s = events[i].data.ptr;
+            if (s == NULL) {
+                accept_sessions(listen_fd, boot);
+                continue;
+            }
+            if (s->dead) {
+                continue;
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && fill_session(s) < 0) {
+                close_session(s);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && flush_session(s) < 0) {
+                close_session(s);
+                continue;
+            }
+            // New input or room for output: let the guest retry
+            queue_session(s);
+            update_events(s);
+        }
+        run_sessions();
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+/*6502 emul - guest consoles over a Unix-domain socket*/
+#ifndef SERVE_H
+#define SERVE_H
+#include "cpu6502.h"
+
+#define SESSION_INPUT_SIZE 1024
+// Pending output above which output host calls wait for the client
+#define SESSION_OUTPUT_LIMIT 16384
+// Instructions a session runs before the others get a turn
+#define SESSION_SLICE 100000
+
+// Accept connections on path; every connection gets its own machine,
+// started from a copy of boot (registers and memory) with its console
+// bound to the connection. Never returns unless setup fails.
+int serve(const char *path, const CPU6502 *boot);
+#endif
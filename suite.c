@@ -0,0 +1,352 @@
+/*6502 emul - benchmark suite: standard workloads, MIPS and JSON*/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu6502.h"
+#include "console.h"
+#include "hostcall.h"
+#include "fileio.h"
+#include "mmio.h"
+#include "suite.h"
+
+// Compiler flags of this binary, set by the bench target in the Makefile
+#ifndef BUILD_FLAGS
+#define BUILD_FLAGS "unknown"
+#endif
+
+// Guest programs, loaded at $0400. Loops count with INX and memory
+// counters bumped by INC; branches only go forward, so each loop ends in
+// a JMP back and BNE (taken on equal here) leaves it. Every workload
+// exits with status 0 through the EXIT host call.
+//
+// Klaus Dormann's 6502 functional test is not among them: it needs the
+// full NMOS instruction set and flags, which this CPU does not have.
+
+// Arithmetic and register transfers: 10 instructions per inner pass,
+// 256 x 256 x 32 passes
+static const unsigned char alu_prog[] = {
+    0x69, 0x07,       // $0400 ADC #$07
+    0xA8,             // $0402 TAY
+    0xC8,             // $0403 INY
+    0x98,             // $0404 TYA
+    0x69, 0x03,       // $0405 ADC #$03
+    0xE8,             // $0407 INX
+    0x8A,             // $0408 TXA
+    0xC9, 0x00,       // $0409 CMP #$00
+    0xD0, 0x03,       // $040B BNE $0410 (X wrapped)
+    0x4C, 0x00, 0x04, // $040D JMP $0400
+    0xE6, 0x10, 0x10, // $0410 INC $10
+    0xA6, 0x10,       // $0413 LDA $10
+    0xC9, 0x00,       // $0415 CMP #$00
+    0xD0, 0x03,       // $0417 BNE $041C
+    0x4C, 0x00, 0x04, // $0419 JMP $0400
+    0xE6, 0x11, 0x11, // $041C INC $11
+    0xA6, 0x11,       // $041F LDA $11
+    0xC9, 0x20,       // $0421 CMP #$20
+    0xD0, 0x03,       // $0423 BNE $0428
+    0x4C, 0x00, 0x04, // $0425 JMP $0400
+    0xA9, 0x00,       // $0428 LDA #$00
+    0x20, 0x2F, 0x00, // $042A JSR EXIT
+};
+
+// Copy the page at $0400 to $3000 byte by byte, 256 x 40 times. The
+// store's address is patched with X on every pass (there is no indexed
+// store).
+static const unsigned char copy_prog[] = {
+    0xA9, 0x00,       // $0400 LDA #$00
+    0x8D, 0xF0, 0x00, // $0402 STA $00F0 (source $0400)
+    0xA9, 0x04,       // $0405 LDA #$04
+    0x8D, 0xF1, 0x00, // $0407 STA $00F1
+    0xA1, 0xF0,       // $040A LDA ($F0,X)
+    0x8D, 0x00, 0x30, // $040C STA $3000 (low byte patched)
+    0xE8,             // $040F INX
+    0x8A,             // $0410 TXA
+    0x8D, 0x0D, 0x04, // $0411 STA $040D
+    0xC9, 0x00,       // $0414 CMP #$00
+    0xD0, 0x03,       // $0416 BNE $041B
+    0x4C, 0x0A, 0x04, // $0418 JMP $040A
+    0xE6, 0x10, 0x10, // $041B INC $10
+    0xA6, 0x10,       // $041E LDA $10
+    0xC9, 0x00,       // $0420 CMP #$00
+    0xD0, 0x03,       // $0422 BNE $0427
+    0x4C, 0x0A, 0x04, // $0424 JMP $040A
+    0xE6, 0x11, 0x11, // $0427 INC $11
+    0xA6, 0x11,       // $042A LDA $11
+    0xC9, 0x28,       // $042C CMP #$28
+    0xD0, 0x03,       // $042E BNE $0433
+    0x4C, 0x0A, 0x04, // $0430 JMP $040A
+    0xA9, 0x00,       // $0433 LDA #$00
+    0x20, 0x2F, 0x00, // $0435 JSR EXIT
+};
+
+// Three levels of JSR/RTS: 22 instructions (7 calls) per pass,
+// 256 x 256 x 16 passes
+static const unsigned char calls_prog[] = {
+    0x20, 0x40, 0x04, // $0400 JSR $0440
+    0xE8,             // $0403 INX
+    0x8A,             // $0404 TXA
+    0xC9, 0x00,       // $0405 CMP #$00
+    0xD0, 0x03,       // $0407 BNE $040C
+    0x4C, 0x00, 0x04, // $0409 JMP $0400
+    0xE6, 0x10, 0x10, // $040C INC $10
+    0xA6, 0x10,       // $040F LDA $10
+    0xC9, 0x00,       // $0411 CMP #$00
+    0xD0, 0x03,       // $0413 BNE $0418
+    0x4C, 0x00, 0x04, // $0415 JMP $0400
+    0xE6, 0x11, 0x11, // $0418 INC $11
+    0xA6, 0x11,       // $041B LDA $11
+    0xC9, 0x10,       // $041D CMP #$10
+    0xD0, 0x03,       // $041F BNE $0424
+    0x4C, 0x00, 0x04, // $0421 JMP $0400
+    0xA9, 0x00,       // $0424 LDA #$00
+    0x20, 0x2F, 0x00, // $0426 JSR EXIT
+    [0x40] = 0x20, 0x50, 0x04, // $0440 JSR $0450
+    0x20, 0x50, 0x04, // $0443 JSR $0450
+    0xC8,             // $0446 INY
+    0x60,             // $0447 RTS
+    [0x50] = 0x20, 0x58, 0x04, // $0450 JSR $0458
+    0x98,             // $0453 TYA
+    0x69, 0x01,       // $0454 ADC #$01
+    0xA8,             // $0456 TAY
+    0x60,             // $0457 RTS
+    0xC8,             // $0458 INY
+    0x60,             // $0459 RTS
+};
+
+// Console output: PUTCHAR and a 32-byte WRITE per pass, 256 x 256 x 4
+// passes (the output is discarded)
+static const unsigned char output_prog[] = {
+    0x8A,             // $0400 TXA
+    0x20, 0x25, 0x00, // $0401 JSR PUTCHAR
+    0x8D, 0x00, 0x02, // $0404 STA $0200 (save X)
+    0xA9, 0x80,       // $0407 LDA #$80
+    0xA2, 0x04,       // $0409 LDX #$04
+    0xA0, 0x20,       // $040B LDY #$20
+    0x20, 0x28, 0x00, // $040D JSR WRITE ($0480, 32 bytes)
+    0xAD, 0x00, 0x02, // $0410 LDA $0200
+    0xAA,             // $0413 TAX
+    0xE8,             // $0414 INX
+    0x8A,             // $0415 TXA
+    0xC9, 0x00,       // $0416 CMP #$00
+    0xD0, 0x03,       // $0418 BNE $041D
+    0x4C, 0x00, 0x04, // $041A JMP $0400
+    0xE6, 0x10, 0x10, // $041D INC $10
+    0xA6, 0x10,       // $0420 LDA $10
+    0xC9, 0x00,       // $0422 CMP #$00
+    0xD0, 0x03,       // $0424 BNE $0429
+    0x4C, 0x00, 0x04, // $0426 JMP $0400
+    0xE6, 0x11, 0x11, // $0429 INC $11
+    0xA6, 0x11,       // $042C LDA $11
+    0xC9, 0x04,       // $042E CMP #$04
+    0xD0, 0x03,       // $0430 BNE $0435
+    0x4C, 0x00, 0x04, // $0432 JMP $0400
+    0xA9, 0x00,       // $0435 LDA #$00
+    0x20, 0x2F, 0x00, // $0437 JSR EXIT
+    [0x80] = 'T', 'h', 'e', ' ', 'q', 'u', 'i', 'c', 'k', ' ', 'b', 'r', 'o', 'w', 'n', ' ',
+    'f', 'o', 'x', ' ', 'j', 'u', 'm', 'p', 's', ' ', 'o', 'v', 'e', 'r', '\r', '\n',
+};
+
+typedef struct {
+    const char *name;
+    const char *description;
+    const unsigned char *code;
+    unsigned int size;
+} Workload;
+
+static const Workload workloads[] = {
+    { "alu", "tight arithmetic and transfer loop", alu_prog, sizeof(alu_prog) },
+    { "copy", "page copy through (zp,X) loads and patched stores", copy_prog, sizeof(copy_prog) },
+    { "calls", "nested JSR/RTS", calls_prog, sizeof(calls_prog) },
+    { "output", "PUTCHAR and WRITE to the console", output_prog, sizeof(output_prog) },
+};
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+// Nominal NMOS 6502 cycles of each instruction (host calls count as
+// their JSR); taken branches add one
+static const unsigned char cycles[256] = {
+    [0xA9] = 2, [0x8D] = 4, [0x69] = 2, [0xAD] = 4, [0xAE] = 4, [0xA0] = 2, [0xA2] = 2, [0xA1] = 6,
+    [0xA6] = 3, [0xE8] = 2, [0xC8] = 2, [0xE6] = 5, [0x9E] = 4, [0x9D] = 4, [0xAC] = 4, [0xC9] = 2,
+    [0xD0] = 2, [0xF0] = 2, [0x4C] = 3, [0x20] = 6, [0x60] = 6, [0x9A] = 2, [0xBA] = 2, [0xAA] = 2,
+    [0x8A] = 2, [0xA8] = 2, [0x98] = 2, [0x90] = 2, [0xB0] = 2,
+};
+
+static int null_getc(Console *con) {
+    return EOF;
+}
+
+static int null_gets(Console *con, char *buf, unsigned int size) {
+    return EOF;
+}
+
+static int null_write(Console *con, const unsigned char *buf, unsigned int len) {
+    return len;
+}
+
+// Headless: no input, output dropped
+static Console console_null = { null_getc, null_gets, null_write };
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void load(const Workload *w, CPU6502 *cpu) {
+    memset(memory, 0, MEMORY_SIZE);
+    mmio_reset();
+    cpu_init(cpu);
+    hostcall_init();
+    fileio_init();
+    memcpy(&memory[0x400], w->code, w->size);
+    cpu->pc = 0x400;
+    cpu->console = &console_null;
+}
+
+// Untimed pass: instructions and cycles (the same on every run); returns
+// 0 if the workload exits cleanly
+static int profile(const Workload *w, unsigned long *instructions, unsigned long long *total) {
+    CPU6502 cpu;
+    load(w, &cpu);
+    *instructions = 0;
+    *total = 0;
+    while (cpu.stop == CPU_RUNNING) {
+        unsigned short pc = cpu.pc;
+        unsigned char opcode = cpu.mem[pc];
+        execute_instruction(&cpu);
+        (*instructions)++;
+        *total += cycles[opcode];
+        if ((opcode == 0xD0 || opcode == 0xF0 || opcode == 0x90 || opcode == 0xB0) &&
+            cpu.pc != (unsigned short)(pc + 2)) {
+            (*total)++;
+        }
+    }
+    if (cpu.stop != CPU_HALTED || cpu.a != 0) {
+        printf("%s: stopped with %d at $%04X\n", w->name, cpu.stop, cpu.pc);
+        return -1;
+    }
+    return 0;
+}
+
+static double timed_run(const Workload *w) {
+    CPU6502 cpu;
+    load(w, &cpu);
+    double start = now();
+    while (cpu.stop == CPU_RUNNING) {
+        execute_instruction(&cpu);
+    }
+    return now() - start;
+}
+
+typedef struct {
+    unsigned long instructions;
+    unsigned long long cycles;
+    double *seconds;
+    double mips;        // mean over the runs
+    double mips_stddev; // sample standard deviation
+    double mhz;         // emulated 6502 clock
+    double ns;          // host ns per instruction
+} WorkloadResult;
+
+static void write_json(FILE *out, const int *selected, const WorkloadResult *results, int repeat) {
+    fprintf(out, "{\n  \"flags\": \"%s\",\n  \"repeat\": %d,\n  \"workloads\": [", BUILD_FLAGS, repeat);
+    const char *separator = "\n";
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        if (!selected[i]) {
+            continue;
+        }
+        const WorkloadResult *r = &results[i];
+        fprintf(out, "%s    {\n      \"name\": \"%s\",\n      \"description\": \"%s\",\n", separator,
+                workloads[i].name, workloads[i].description);
+        fprintf(out, "      \"instructions\": %lu,\n      \"cycles\": %llu,\n      \"seconds\": [", r->instructions,
+                r->cycles);
+        for (int j = 0; j < repeat; j++) {
+            fprintf(out, "%s%.6f", j ? ", " : "", r->seconds[j]);
+        }
+        fprintf(out, "],\n      \"mips\": %.3f,\n      \"mips_stddev\": %.3f,\n", r->mips, r->mips_stddev);
+        fprintf(out, "      \"mhz\": %.3f,\n      \"ns_per_instruction\": %.3f\n    }", r->mhz, r->ns);
+        separator = ",\n";
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int suite_main(int argc, char **argv) {
+    int repeat = SUITE_DEFAULT_REPEAT;
+    const char *json_path = NULL;
+    int selected[WORKLOAD_COUNT] = { 0 };
+    int any = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            int found = 0;
+            for (int j = 0; j < WORKLOAD_COUNT; j++) {
+                if (strcmp(argv[i], workloads[j].name) == 0) {
+                    selected[j] = found = any = 1;
+                }
+            }
+            if (!found) {
+                printf("Unknown workload: %s\n", argv[i]);
+                return 1;
+            }
+        }
+    }
+    if (repeat < 1) {
+        repeat = 1;
+    }
+    WorkloadResult results[WORKLOAD_COUNT];
+    // The table goes to stderr when the JSON takes stdout
+    FILE *table = json_path && strcmp(json_path, "-") == 0 ? stderr : stdout;
+    fprintf(table, "Built with %s\n", BUILD_FLAGS);
+    fprintf(table, "%-8s %12s %9s %7s %10s %9s\n", "workload", "instructions", "MIPS", "+/-", "6502 MHz", "ns/instr");
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        if (any && !selected[i]) {
+            continue;
+        }
+        selected[i] = 1;
+        WorkloadResult *r = &results[i];
+        if (profile(&workloads[i], &r->instructions, &r->cycles) < 0) {
+            return 1;
+        }
+        r->seconds = malloc(repeat * sizeof(double));
+        if (r->seconds == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        double sum = 0;
+        double squares = 0;
+        double elapsed = 0;
+        for (int j = 0; j < repeat; j++) {
+            r->seconds[j] = timed_run(&workloads[i]);
+            double mips = r->instructions / r->seconds[j] / 1e6;
+            sum += mips;
+            squares += mips * mips;
+            elapsed += r->seconds[j];
+        }
+        r->mips = sum / repeat;
+        r->mips_stddev = repeat > 1 ? sqrt(fmax(0, (squares - sum * sum / repeat) / (repeat - 1))) : 0;
+        r->mhz = r->cycles / (elapsed / repeat) / 1e6;
+        r->ns = elapsed / repeat / r->instructions * 1e9;
+        fprintf(table, "%-8s %12lu %9.2f %7.2f %10.2f %9.2f\n", workloads[i].name, r->instructions, r->mips,
+                r->mips_stddev, r->mhz, r->ns);
+    }
+    if (json_path) {
+        FILE *out = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+        if (out == NULL) {
+            perror(json_path);
+            return 1;
+        }
+        write_json(out, selected, results, repeat);
+        if (out != stdout) {
+            fclose(out);
+        }
+    }
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        if (selected[i]) {
+            free(results[i].seconds);
+        }
+    }
+    return 0;
+}
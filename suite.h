@@ -0,0 +1,14 @@
+/*6502 emul - benchmark suite: standard workloads, MIPS and JSON*/
+#ifndef SUITE_H
+#define SUITE_H
+
+// Timed runs of each workload
+#define SUITE_DEFAULT_REPEAT 5
+
+// ./main --suite [--repeat N] [--json FILE] [name ...] runs the named
+// workloads (all when empty) headless and prints emulated instructions
+// and 6502 cycles per second and host ns per instruction, with the
+// spread over the repeated runs; --json also writes them to FILE
+// ("-" for stdout)
+int suite_main(int argc, char **argv);
+#endif
@@ -0,0 +1,170 @@
+/*6502 emul - raw-mode terminal console*/
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "term.h"
+
+static struct termios saved;
+static int raw = 0;
+
+// Key-to-echo latency: time from a key leaving read() to the first
+// output after it reaching write()
+static struct timespec key_time;
+static int key_pending = 0;
+static unsigned long latency_count = 0;
+static double latency_sum = 0;
+static double latency_max = 0;
+
+static unsigned char out[4096];
+static unsigned int out_len = 0;
+
+static double elapsed_since(struct timespec *start) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - start->tv_sec) + (ts.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void term_flush(void) {
+    unsigned int done = 0;
+    while (done < out_len) {
+        ssize_t n = write(1, out + done, out_len - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    out_len = 0;
+    if (key_pending) {
+        double latency = elapsed_since(&key_time);
+        key_pending = 0;
+        latency_count++;
+        latency_sum += latency;
+        if (latency > latency_max) {
+            latency_max = latency;
+        }
+    }
+}
+
+// Report on stderr at exit (snprintf is not safe in a signal handler)
+static void report_latency(void) {
+    char line[128];
+    if (latency_count == 0) {
+        return;
+    }
+    int len = snprintf(line, sizeof(line), "\nKey-to-echo latency: %lu keys, avg %.1f us, max %.1f us\n",
+                       latency_count, latency_sum / latency_count * 1e6, latency_max * 1e6);
+    write(2, line, len);
+}
+
+void term_close(void) {
+    if (!raw) {
+        return;
+    }
+    term_flush();
+    tcsetattr(0, TCSAFLUSH, &saved);
+    raw = 0;
+    report_latency();
+}
+
+// Only async-signal-safe calls: restore the terminal, end the line and
+// die of the same signal; buffered output and the report are dropped
+static void term_signal(int sig) {
+    static const char newline[] = "\n";
+    if (raw) {
+        tcsetattr(0, TCSAFLUSH, &saved);
+        raw = 0;
+        write(2, newline, sizeof(newline) - 1);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// Output waits in a buffer until the guest asks for input, except the
+// first output after a key (its echo), which goes out at once
+static int term_write(Console *con, const unsigned char *buf, unsigned int len) {
+    while (len > 0) {
+        unsigned int n = len < sizeof(out) - out_len ? len : sizeof(out) - out_len;
+        memcpy(out + out_len, buf, n);
+        out_len += n;
+        buf += n;
+        len -= n;
+        if (out_len == sizeof(out)) {
+            term_flush();
+        }
+    }
+    if (key_pending) {
+        term_flush();
+    }
+    return 0;
+}
+
+static int term_getc(Console *con) {
+    unsigned char c;
+    term_flush();
+    if (read(0, &c, 1) != 1) {
+        return EOF;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &key_time);
+    key_pending = 1;
+    return c;
+}
+
+// Minimal line editing, since the terminal no longer echoes or erases
+static int term_gets(Console *con, char *buf, unsigned int size) {
+    unsigned int len = 0;
+    while (len < size - 1) {
+        int c = term_getc(con);
+        if (c == EOF || c == 4) { // Ctrl-D
+            if (len == 0) {
+                return EOF;
+            }
+            break;
+        }
+        if (c == 127 || c == 8) { // Backspace
+            if (len > 0) {
+                len--;
+                term_write(con, (const unsigned char *)"\b \b", 3);
+            }
+            continue;
+        }
+        if (c == '\r' || c == '\n') {
+            term_write(con, (const unsigned char *)"\n", 1);
+            buf[len++] = '\n';
+            break;
+        }
+        unsigned char ch = c;
+        term_write(con, &ch, 1);
+        buf[len++] = c;
+    }
+    buf[len] = 0;
+    return len;
+}
+
+static Console console_term = { term_getc, term_gets, term_write };
+
+Console *term_open(void) {
+    static const int signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+    struct termios t;
+    if (!isatty(0) || tcgetattr(0, &saved) < 0) {
+        return NULL;
+    }
+    t = saved;
+    // Keys arrive one at a time and unechoed; Ctrl-C still interrupts
+    t.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+    t.c_iflag &= ~(IXON | ICRNL);
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    if (tcsetattr(0, TCSAFLUSH, &t) < 0) {
+        return NULL;
+    }
+    raw = 1;
+    atexit(term_close);
+    for (int i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        signal(signals[i], term_signal);
+    }
+    fflush(stdout);
+    return &console_term;
+}
@@ -0,0 +1,11 @@
+/*6502 emul - raw-mode terminal console*/
+#ifndef TERM_H
+#define TERM_H
+#include "console.h"
+// Put the terminal on stdin in raw (non-canonical, no echo) mode and
+// return a console that hands every key to the guest as it is typed.
+// The terminal is restored at exit and on fatal signals. Returns NULL
+// when stdin is not a terminal.
+Console *term_open(void);
+void term_close(void);
+#endif
@@ -0,0 +1,322 @@
+/*6502 emul - reverse execution (snapshots and deterministic re-execution)*/
+#include <stdlib.h>
+#include <string.h>
+#include "hostcall.h"
+#include "timetravel.h"
+
+static unsigned char *page_copy(const unsigned char *page) {
+    unsigned char *copy = malloc(TIMETRAVEL_PAGE_SIZE);
+    if (copy == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    memcpy(copy, page, TIMETRAVEL_PAGE_SIZE);
+    return copy;
+}
+
+static void free_undo(TimeTravel *tt, TimeSnapshot *s) {
+    for (int page = 0; page < TIMETRAVEL_PAGES; page++) {
+        if (s->undo[page]) {
+            free(s->undo[page]);
+            s->undo[page] = NULL;
+        }
+    }
+    tt->bytes -= s->undo_pages * TIMETRAVEL_PAGE_SIZE;
+    s->undo_pages = 0;
+}
+
+// Fold snapshot i + 1 into snapshot i: going back to i then restores
+// the pages either of them kept
+static void merge_next(TimeTravel *tt, int i) {
+    TimeSnapshot *s = &tt->snaps[i];
+    TimeSnapshot *next = &tt->snaps[i + 1];
+    for (int page = 0; page < TIMETRAVEL_PAGES; page++) {
+        if (next->undo[page] == NULL) {
+            continue;
+        }
+        if (s->undo[page] == NULL) {
+            s->undo[page] = next->undo[page];
+            s->undo_pages++;
+        } else {
+            free(next->undo[page]);
+            tt->bytes -= TIMETRAVEL_PAGE_SIZE;
+        }
+        next->undo[page] = NULL;
+    }
+    memmove(next, next + 1, (tt->snapshots - i - 2) * sizeof(TimeSnapshot));
+    memset(&tt->snaps[tt->snapshots - 1], 0, sizeof(TimeSnapshot));
+    tt->snapshots--;
+}
+
+// Merge pairs of snapshots among the oldest count: history further back
+// gets sparser while the recent snapshots stay interval apart
+static void thin(TimeTravel *tt, int count) {
+    for (int i = 0; i < count / 2 && i + 2 < tt->snapshots; i++) {
+        merge_next(tt, i);
+    }
+    tt->thinned++;
+}
+
+static void drop_oldest(TimeTravel *tt) {
+    free_undo(tt, &tt->snaps[0]);
+    memmove(&tt->snaps[0], &tt->snaps[1], (tt->snapshots - 1) * sizeof(TimeSnapshot));
+    memset(&tt->snaps[tt->snapshots - 1], 0, sizeof(TimeSnapshot));
+    tt->snapshots--;
+    tt->dropped++;
+}
+
+// Snapshot the machine as it is now. The pages that changed since the
+// newest snapshot go on it as undo records.
+static void take_snapshot(TimeTravel *tt) {
+    CPU6502 *cpu = tt->cpu;
+    if (tt->snapshots > 0) {
+        TimeSnapshot *prev = &tt->snaps[tt->snapshots - 1];
+        for (int page = 0; page < TIMETRAVEL_PAGES; page++) {
+            unsigned char *mem = cpu->mem + page * TIMETRAVEL_PAGE_SIZE;
+            unsigned char *shadow = tt->shadow + page * TIMETRAVEL_PAGE_SIZE;
+            if (memcmp(mem, shadow, TIMETRAVEL_PAGE_SIZE) != 0) {
+                prev->undo[page] = page_copy(shadow);
+                prev->undo_pages++;
+                tt->bytes += TIMETRAVEL_PAGE_SIZE;
+                memcpy(shadow, mem, TIMETRAVEL_PAGE_SIZE);
+            }
+        }
+    } else {
+        memcpy(tt->shadow, cpu->mem, MEMORY_SIZE);
+    }
+    if (tt->snapshots == TIMETRAVEL_MAX_SNAPSHOTS) {
+        thin(tt, tt->snapshots / 2);
+    }
+    // Over budget: snapshot half as often and merge the whole ring, or
+    // when that frees nothing (each interval dirties other pages) forget
+    // the oldest history
+    while (tt->bytes > tt->budget && tt->snapshots > 1) {
+        size_t bytes = tt->bytes;
+        if (tt->snapshots > 2) {
+            thin(tt, tt->snapshots);
+            tt->interval *= 2;
+        }
+        if (tt->bytes == bytes) {
+            drop_oldest(tt);
+        }
+    }
+    TimeSnapshot *s = &tt->snaps[tt->snapshots++];
+    s->count = tt->count;
+    s->regs = *cpu;
+    s->log_pos = replay_position(tt->log);
+    tt->next = tt->count + tt->interval;
+    tt->taken++;
+}
+
+// Back to snapshot i: memory to the newest snapshot through the shadow
+// copy, then the undo records from the newest down to i
+static void restore(TimeTravel *tt, int i) {
+    CPU6502 *cpu = tt->cpu;
+    for (int page = 0; page < TIMETRAVEL_PAGES; page++) {
+        unsigned char *mem = cpu->mem + page * TIMETRAVEL_PAGE_SIZE;
+        unsigned char *shadow = tt->shadow + page * TIMETRAVEL_PAGE_SIZE;
+        if (memcmp(mem, shadow, TIMETRAVEL_PAGE_SIZE) != 0) {
+            memcpy(mem, shadow, TIMETRAVEL_PAGE_SIZE);
+        }
+    }
+    for (int k = tt->snapshots - 2; k >= i; k--) {
+        TimeSnapshot *s = &tt->snaps[k];
+        for (int page = 0; page < TIMETRAVEL_PAGES && s->undo_pages > 0; page++) {
+            if (s->undo[page]) {
+                memcpy(cpu->mem + page * TIMETRAVEL_PAGE_SIZE, s->undo[page], TIMETRAVEL_PAGE_SIZE);
+            }
+        }
+    }
+    TimeSnapshot *s = &tt->snaps[i];
+    unsigned char *mem = cpu->mem;
+    Console *console = cpu->console;
+    unsigned char *coverage = cpu->coverage;
+    *cpu = s->regs;
+    cpu->mem = mem;
+    cpu->console = console;
+    cpu->coverage = coverage;
+    replay_seek(tt->log, s->log_pos);
+    tt->count = s->count;
+}
+
+// Newest snapshot at or before count (the oldest one if none is)
+static int snapshot_before(TimeTravel *tt, unsigned long count) {
+    int i = tt->snapshots - 1;
+    while (i > 0 && tt->snaps[i].count > count) {
+        i--;
+    }
+    return i;
+}
+
+// One instruction; returns 0 if it stopped the CPU without executing
+static inline int step(TimeTravel *tt) {
+    CPU6502 *cpu = tt->cpu;
+    execute_instruction(cpu);
+    if (cpu->stop != CPU_RUNNING && cpu->stop != CPU_HALTED) {
+        // Waiting for input that history already holds: take it now
+        if (cpu->stop == CPU_WAIT_IO && tt->count < tt->furthest) {
+            cpu->stop = CPU_RUNNING;
+        }
+        return 0;
+    }
+    tt->count++;
+    return 1;
+}
+
+unsigned long timetravel_run(TimeTravel *tt, unsigned long n) {
+    CPU6502 *cpu = tt->cpu;
+    unsigned long start = tt->count;
+    unsigned long end = tt->count + n;
+    while (cpu->stop == CPU_RUNNING && tt->count < end) {
+        // Up to the next snapshot, the end, or the end of the history
+        // already seen (whose output is not shown twice)
+        unsigned long until = end < tt->next ? end : tt->next;
+        int quiet = tt->count < tt->furthest;
+        if (quiet && tt->furthest < until) {
+            until = tt->furthest;
+        }
+        replay_quiet(tt->log, quiet);
+        unsigned long count = tt->count;
+        while (count < until) {
+            execute_instruction(cpu);
+            count++;
+            if (cpu->stop != CPU_RUNNING) {
+                break;
+            }
+        }
+        tt->count = count;
+        if (cpu->stop != CPU_RUNNING && cpu->stop != CPU_HALTED) {
+            tt->count--;
+            if (cpu->stop == CPU_WAIT_IO && quiet) {
+                cpu->stop = CPU_RUNNING;
+            }
+        }
+        if (tt->count == tt->next) {
+            take_snapshot(tt);
+        }
+        if (tt->count > tt->furthest) {
+            tt->furthest = tt->count;
+        }
+    }
+    replay_quiet(tt->log, 0);
+    return tt->count - start;
+}
+
+int timetravel_goto(TimeTravel *tt, unsigned long count) {
+    int status = 0;
+    if (count < tt->snaps[0].count) {
+        count = tt->snaps[0].count;
+        status = -1;
+    }
+    if (count < tt->count || tt->cpu->stop != CPU_RUNNING) {
+        restore(tt, snapshot_before(tt, count));
+    }
+    unsigned long from = tt->count;
+    timetravel_run(tt, count - tt->count);
+    tt->reexecuted += tt->count - from;
+    return tt->count == count ? status : -1;
+}
+
+int timetravel_step_back(TimeTravel *tt, unsigned long n) {
+    if (n > tt->count) {
+        timetravel_goto(tt, 0);
+        return -1;
+    }
+    return timetravel_goto(tt, tt->count - n);
+}
+
+// Whether the instruction at PC stores to address. The decode follows
+// execute_instruction; INC zp reads its first operand byte and writes
+// to its second.
+static int stores_to(CPU6502 *cpu, unsigned short address) {
+    unsigned char *mem = cpu->mem;
+    unsigned short pc = cpu->pc;
+    unsigned short operand = mem[(unsigned short)(pc + 1)] | (mem[(unsigned short)(pc + 2)] << 8);
+    switch (mem[pc]) {
+        case 0x8D: // STA $xxxx
+        case 0x9E: // STX $xxxx
+        case 0x9D: // STZ $xxxx
+            return operand == address;
+        case 0xE6: // INC $xx
+            return (operand >> 8) == address;
+        default:
+            return 0;
+    }
+}
+
+// Host call at PC (JSR to a trap address)
+static int at_hostcall(CPU6502 *cpu) {
+    unsigned char *mem = cpu->mem;
+    unsigned short pc = cpu->pc;
+    return mem[pc] == 0x20 &&
+           hostcall_is_trap(mem[(unsigned short)(pc + 1)] | (mem[(unsigned short)(pc + 2)] << 8));
+}
+
+long timetravel_last_write(TimeTravel *tt, unsigned short address) {
+    CPU6502 *cpu = tt->cpu;
+    unsigned long origin = tt->count;
+    unsigned long end = origin;
+    int i = snapshot_before(tt, end);
+    if (tt->snaps[i].count == end && i > 0) {
+        i--;
+    }
+    replay_quiet(tt->log, 1);
+    for (; i >= 0 && tt->snaps[i].count < end; i--) {
+        // Re-execute the interval from snapshot i, watching the stores
+        long found = -1;
+        restore(tt, i);
+        unsigned long from = tt->count;
+        while (cpu->stop == CPU_RUNNING && tt->count < end) {
+            unsigned long count = tt->count;
+            int store = stores_to(cpu, address);
+            int hostcall = !store && at_hostcall(cpu);
+            unsigned char before = cpu->mem[address];
+            if (step(tt) && (store || (hostcall && cpu->mem[address] != before))) {
+                found = count;
+            }
+        }
+        tt->reexecuted += tt->count - from;
+        if (found >= 0) {
+            timetravel_goto(tt, found);
+            return found;
+        }
+        end = tt->snaps[i].count;
+    }
+    timetravel_goto(tt, origin);
+    return -1;
+}
+
+TimeTravel *timetravel_open(CPU6502 *cpu, size_t budget) {
+    TimeTravel *tt = calloc(1, sizeof(TimeTravel));
+    if (tt == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    tt->log = replay_record(NULL);
+    if (tt->log == NULL) {
+        free(tt);
+        return NULL;
+    }
+    tt->cpu = cpu;
+    tt->console = cpu->console;
+    cpu->console = replay_console(tt->log, cpu->console);
+    tt->budget = budget;
+    tt->interval = TIMETRAVEL_DEFAULT_INTERVAL;
+    take_snapshot(tt);
+    return tt;
+}
+
+void timetravel_close(TimeTravel *tt, FILE *out) {
+    if (out) {
+        fprintf(out, "History: %lu instructions, %d snapshots %lu apart (%lu taken, %lu thinned, %lu dropped), "
+                "%zu KB of pages, %lu instructions re-executed\n",
+                tt->furthest, tt->snapshots, tt->interval, tt->taken, tt->thinned, tt->dropped, tt->bytes / 1024,
+                tt->reexecuted);
+    }
+    for (int i = 0; i < tt->snapshots; i++) {
+        free_undo(tt, &tt->snaps[i]);
+    }
+    replay_close(tt->log, NULL);
+    tt->cpu->console = tt->console;
+    free(tt);
+}
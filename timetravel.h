@@ -0,0 +1,74 @@
+/*6502 emul - reverse execution (snapshots and deterministic re-execution)*/
+#ifndef TIMETRAVEL_H
+#define TIMETRAVEL_H
+#include <stddef.h>
+#include "cpu6502.h"
+#include "replay.h"
+
+#define TIMETRAVEL_MAX_SNAPSHOTS 256
+#define TIMETRAVEL_DEFAULT_INTERVAL 100000UL
+#define TIMETRAVEL_DEFAULT_BUDGET (64UL * 1024 * 1024)
+#define TIMETRAVEL_PAGE_SIZE 256
+#define TIMETRAVEL_PAGES (MEMORY_SIZE / TIMETRAVEL_PAGE_SIZE)
+
+typedef struct {
+    unsigned long count; // instructions executed before it
+    CPU6502 regs;        // registers, return stack and stop code
+    long log_pos;        // input log offset
+    // Pages as they were here that differ at the next snapshot
+    unsigned char *undo[TIMETRAVEL_PAGES];
+    int undo_pages;
+} TimeSnapshot;
+
+// Runs a machine with its inputs logged in memory (replay.h) and
+// snapshots it every interval instructions. Only the pages that changed
+// since the previous snapshot are kept, as an undo record on it. Going
+// back restores the nearest snapshot at or before the target and
+// re-executes from there; the log feeds the same inputs again and the
+// output already shown is dropped. When the ring is full, pairs of
+// snapshots in its older half are merged, so old history thins out
+// while recent history stays dense. When the undo pages pass the budget
+// the interval doubles and the whole ring is thinned, and the oldest
+// snapshots are dropped if that is not enough.
+typedef struct {
+    CPU6502 *cpu;
+    Replay *log;
+    Console *console;       // the machine's own console
+    unsigned long count;    // instructions executed
+    unsigned long furthest; // highest count reached so far
+    unsigned long interval;
+    unsigned long next;     // count at which the next snapshot is due
+    TimeSnapshot snaps[TIMETRAVEL_MAX_SNAPSHOTS];
+    int snapshots;
+    unsigned char shadow[MEMORY_SIZE]; // memory at the newest snapshot
+    size_t budget;
+    size_t bytes; // undo pages held
+    // Counters
+    unsigned long taken;
+    unsigned long thinned;
+    unsigned long dropped;
+    unsigned long reexecuted; // instructions run again to go back
+} TimeTravel;
+
+// Record cpu's history from now on; takes over its console (and the
+// device and file inputs) to log them. budget bounds the undo pages.
+TimeTravel *timetravel_open(CPU6502 *cpu, size_t budget);
+// Run up to n instructions, stopping early when the CPU stops; returns
+// the number run. Instructions that stop the CPU without executing
+// (bad opcode, stack errors) are not counted.
+unsigned long timetravel_run(TimeTravel *tt, unsigned long n);
+// Put the machine where it was after count instructions; returns -1
+// (and goes to the oldest point kept) when history does not reach back
+// that far
+int timetravel_goto(TimeTravel *tt, unsigned long count);
+// Go back n instructions
+int timetravel_step_back(TimeTravel *tt, unsigned long n);
+// Go back to just before the last instruction that stored to address:
+// the PC is on that instruction. Host calls count when they changed the
+// byte. Returns its count, or -1 (machine left where it was) if no
+// store to address is in the history kept.
+long timetravel_last_write(TimeTravel *tt, unsigned short address);
+// Stop recording (the console goes back to the one taken over) and
+// report on out (NULL for no report)
+void timetravel_close(TimeTravel *tt, FILE *out);
+#endif
@@ -0,0 +1,667 @@
+/*6502 emul - binary instruction trace*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+// Operand formats, following execute_instruction
+enum { OP_NONE, OP_IMM, OP_ZP, OP_ABS, OP_REL, OP_INDX, OP_INC };
+
+typedef struct {
+    const char *name;
+    unsigned char format;
+} OpcodeInfo;
+
+static const OpcodeInfo opcodes[256] = {
+    [0xA9] = { "LDA", OP_IMM },  [0x8D] = { "STA", OP_ABS },  [0x69] = { "ADC", OP_IMM },
+    [0xAD] = { "LDA", OP_ABS },  [0xAE] = { "LDY", OP_ABS },  [0xA0] = { "LDY", OP_IMM },
+    [0xA2] = { "LDX", OP_IMM },  [0xA1] = { "LDA", OP_INDX }, [0xA6] = { "LDA", OP_ZP },
+    [0xE8] = { "INX", OP_NONE }, [0xC8] = { "INY", OP_NONE }, [0xE6] = { "INC", OP_INC },
+    [0x9E] = { "STX", OP_ABS },  [0x9D] = { "STZ", OP_ABS },  [0xAC] = { "LDY", OP_ABS },
+    [0xC9] = { "CMP", OP_IMM },  [0xD0] = { "BNE", OP_REL },  [0xF0] = { "BEQ", OP_REL },
+    [0x4C] = { "JMP", OP_ABS },  [0x20] = { "JSR", OP_ABS },  [0x60] = { "RTS", OP_NONE },
+    [0x9A] = { "TXS", OP_NONE }, [0xBA] = { "TSX", OP_NONE }, [0xAA] = { "TAX", OP_NONE },
+    [0x8A] = { "TXA", OP_NONE }, [0xA8] = { "TAY", OP_NONE }, [0x98] = { "TYA", OP_NONE },
+    [0x90] = { "BCC", OP_REL },  [0xB0] = { "BCS", OP_REL },
+};
+
+void trace_disassemble(char *buf, size_t size, unsigned short pc, unsigned char opcode, const unsigned char *operand) {
+    const OpcodeInfo *info = &opcodes[opcode];
+    unsigned short word = operand[0] | (operand[1] << 8);
+    if (info->name == NULL) {
+        snprintf(buf, size, ".byte $%02X", opcode);
+        return;
+    }
+    switch (info->format) {
+        case OP_IMM:
+            snprintf(buf, size, "%s #$%02X", info->name, operand[0]);
+            break;
+        case OP_ZP:
+            snprintf(buf, size, "%s $%02X", info->name, operand[0]);
+            break;
+        case OP_ABS:
+            snprintf(buf, size, "%s $%04X", info->name, word);
+            break;
+        case OP_REL: // Forward only: the offset is added unsigned
+            snprintf(buf, size, "%s $%04X", info->name, (unsigned short)(pc + 2 + operand[0]));
+            break;
+        case OP_INDX:
+            snprintf(buf, size, "%s ($%02X),X", info->name, operand[0]);
+            break;
+        case OP_INC: // Reads the first operand byte, writes the second
+            if (operand[0] == operand[1]) {
+                snprintf(buf, size, "%s $%02X", info->name, operand[0]);
+            } else {
+                snprintf(buf, size, "%s $%02X->$%02X", info->name, operand[0], operand[1]);
+            }
+            break;
+        default:
+            snprintf(buf, size, "%s", info->name);
+            break;
+    }
+}
+
+// Bytes of the instruction, for predicting the next PC (1 when unknown)
+static unsigned int instruction_length(unsigned char opcode) {
+    switch (opcodes[opcode].format) {
+        case OP_IMM:
+        case OP_ZP:
+        case OP_REL:
+        case OP_INDX:
+            return 2;
+        case OP_ABS:
+        case OP_INC:
+            return 3;
+        default:
+            return 1;
+    }
+}
+
+// Instruction bytes last seen at a PC, per block
+#define CODE_CACHE 4096
+typedef struct {
+    unsigned short pc;
+    unsigned char valid;
+    unsigned char bytes[3];
+} CodeEntry;
+
+// LZ77 over a block with 16-bit distances, like encode_page in
+// savestate.c: a control byte n < 128 is followed by n + 1 literal
+// bytes; n >= 128 copies n - 124 bytes starting d bytes back, d being
+// the next two bytes (little endian). out needs n + n / 128 + 1 bytes.
+#define MATCH_MIN 4
+#define MATCH_MAX (255 - 124)
+static unsigned int pack(const unsigned char *in, unsigned int n, unsigned char *out) {
+    int last[1 << 14]; // latest position of each 4-byte hash
+    unsigned int i = 0;
+    unsigned int len = 0;
+    unsigned int literals = 0; // pending literals end at i
+    memset(last, -1, sizeof(last));
+    while (i < n) {
+        unsigned int match = 0;
+        unsigned int distance = 0;
+        if (i + MATCH_MIN <= n) {
+            unsigned int word = in[i] | in[i + 1] << 8 | in[i + 2] << 16 | (unsigned int)in[i + 3] << 24;
+            unsigned int hash = (word * 2654435761u) >> 18;
+            int candidate = last[hash];
+            last[hash] = i;
+            if (candidate >= 0 && i - candidate <= 0xFFFF) {
+                while (i + match < n && match < MATCH_MAX && in[candidate + match] == in[i + match]) {
+                    match++;
+                }
+                distance = i - candidate;
+            }
+        }
+        if (match < MATCH_MIN) {
+            i++;
+            literals++;
+            if (literals < 128 && i < n) {
+                continue;
+            }
+            match = 0;
+        }
+        if (literals > 0) {
+            out[len++] = literals - 1;
+            memcpy(out + len, in + i - literals, literals);
+            len += literals;
+            literals = 0;
+        }
+        if (match >= MATCH_MIN) {
+            out[len++] = match + 124;
+            out[len++] = distance;
+            out[len++] = distance >> 8;
+            i += match;
+        }
+    }
+    return len;
+}
+
+// Returns 0, or -1 if the block does not unpack to exactly n bytes
+static int unpack(const unsigned char *in, unsigned int len, unsigned char *out, unsigned int n) {
+    unsigned int o = 0;
+    unsigned int i = 0;
+    while (i < len) {
+        unsigned int c = in[i++];
+        if (c >= 128) {
+            c -= 124;
+            if (i + 2 > len) {
+                return -1;
+            }
+            unsigned int distance = in[i] | in[i + 1] << 8;
+            i += 2;
+            if (distance == 0 || distance > o || o + c > n) {
+                return -1;
+            }
+            // Byte by byte: the source may overlap what is being written
+            for (unsigned int j = 0; j < c; j++, o++) {
+                out[o] = out[o - distance];
+            }
+        } else {
+            c++;
+            if (i + c > len || o + c > n) {
+                return -1;
+            }
+            memcpy(out + o, in + i, c);
+            i += c;
+            o += c;
+        }
+    }
+    return o == n ? 0 : -1;
+}
+
+// Largest record: flags, PC, three instruction bytes, six registers
+#define RAW_RECORD_MAX 12
+
+// Encode records first..first + n of the ring (at most TRACE_BLOCK) as
+// one block and append it to the file
+static int write_block(Trace *t, unsigned long first, unsigned long n) {
+    CodeEntry code[CODE_CACHE];
+    TraceRecord prev = { 0 };
+    TraceBlock *b;
+    unsigned char *raw = t->raw;
+    memset(code, 0, sizeof(code));
+    if (t->blocks == t->index_size) {
+        t->index_size = t->index_size ? t->index_size * 2 : 1024;
+        t->index = realloc(t->index, t->index_size * sizeof(TraceIndexEntry));
+        if (t->index == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    t->index[t->blocks].offset = t->offset;
+    b = &t->index[t->blocks].block;
+    memset(b, 0, sizeof(*b));
+    memcpy(b->magic, TRACE_BLOCK_MAGIC, 4);
+    b->records = n;
+    b->first = first;
+    for (unsigned long i = first; i < first + n; i++) {
+        const TraceRecord *r = &t->ring[i & t->mask];
+        CodeEntry *c = &code[r->pc & (CODE_CACHE - 1)];
+        unsigned char *flags = raw++;
+        *flags = 0;
+        if (r->pc != (unsigned short)(prev.pc + instruction_length(prev.opcode))) {
+            *flags |= TR_PC;
+            *raw++ = r->pc;
+            *raw++ = r->pc >> 8;
+        }
+        if (!c->valid || c->pc != r->pc || c->bytes[0] != r->opcode || c->bytes[1] != r->operand[0] ||
+            c->bytes[2] != r->operand[1]) {
+            *flags |= TR_CODE;
+            c->valid = 1;
+            c->pc = r->pc;
+            *raw++ = c->bytes[0] = r->opcode;
+            *raw++ = c->bytes[1] = r->operand[0];
+            *raw++ = c->bytes[2] = r->operand[1];
+        }
+        // Differences rather than values: INX and the like then give the
+        // same bytes every time round a loop
+#define DELTA(field, flag)                                 \
+        if (r->field != prev.field) {                      \
+            *flags |= flag;                                \
+            *raw++ = r->field - prev.field;                \
+        }
+        DELTA(a, TR_A)
+        DELTA(x, TR_X)
+        DELTA(y, TR_Y)
+        DELTA(sp, TR_SP)
+        DELTA(p, TR_P)
+        DELTA(depth, TR_DEPTH)
+#undef DELTA
+        b->pages[r->pc >> 11] |= 1 << (r->pc >> 8 & 7);
+        prev = *r;
+    }
+    b->raw_size = raw - t->raw;
+    b->packed_size = pack(t->raw, b->raw_size, t->packed);
+    if (fwrite(b, sizeof(*b), 1, t->file) != 1 || fwrite(t->packed, 1, b->packed_size, t->file) != b->packed_size) {
+        return -1;
+    }
+    t->offset += sizeof(*b) + b->packed_size;
+    t->blocks++;
+    return 0;
+}
+
+// Records first..first + n of the ring to the file, in blocks of
+// TRACE_BLOCK
+static int write_records(Trace *t, unsigned long first, unsigned long n) {
+    while (n > 0) {
+        unsigned long part = n < TRACE_BLOCK ? n : TRACE_BLOCK;
+        if (write_block(t, first, part) < 0) {
+            return -1;
+        }
+        first += part;
+        n -= part;
+    }
+    return 0;
+}
+
+static void *writer_thread(void *arg) {
+    Trace *t = arg;
+    // Batch scheduling: waking the writer must not preempt the run loop
+    // when both share a core
+    struct sched_param param = { 0 };
+    sched_setscheduler(0, SCHED_BATCH, &param);
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        while (t->tail == t->ready && !t->quit) {
+            pthread_cond_wait(&t->wake, &t->lock);
+        }
+        if (t->tail == t->ready) {
+            break;
+        }
+        unsigned long ready = t->ready;
+        pthread_mutex_unlock(&t->lock);
+        int status = write_records(t, t->tail, ready - t->tail);
+        pthread_mutex_lock(&t->lock);
+        if (status < 0) {
+            t->failed = 1;
+        }
+        t->tail = ready;
+        pthread_cond_signal(&t->room);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+Trace *trace_open(const char *path, unsigned long ring_size) {
+    Trace *t = calloc(1, sizeof(Trace));
+    if (t == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    t->file = fopen(path, "wb");
+    if (t->file == NULL) {
+        printf("Cannot create %s\n", path);
+        free(t);
+        return NULL;
+    }
+    t->streaming = ring_size == 0;
+    unsigned long size = TRACE_CHUNK * 2;
+    while (size < (t->streaming ? TRACE_DEFAULT_RING : ring_size)) {
+        size *= 2;
+    }
+    t->ring = malloc(size * sizeof(TraceRecord));
+    if (t->ring == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    t->mask = size - 1;
+    t->flush_at = ~0UL;
+    t->raw = malloc(TRACE_BLOCK * RAW_RECORD_MAX);
+    t->packed = malloc(TRACE_BLOCK * RAW_RECORD_MAX * 129 / 128 + 1);
+    if (t->raw == NULL || t->packed == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    if (ring_size == 0) {
+        TraceHeader h = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), TRACE_BLOCK, 0 };
+        fwrite(&h, sizeof(h), 1, t->file);
+        t->offset = sizeof(h);
+        t->flush_at = TRACE_CHUNK;
+        pthread_mutex_init(&t->lock, NULL);
+        pthread_cond_init(&t->wake, NULL);
+        pthread_cond_init(&t->room, NULL);
+        if (pthread_create(&t->writer, NULL, writer_thread, t) != 0) {
+            printf("Cannot start the trace writer\n");
+            exit(1);
+        }
+    } else {
+        t->keep = ring_size;
+    }
+    return t;
+}
+
+// The run loop waits only when the writer is a whole ring behind
+void trace_flush(Trace *t) {
+    pthread_mutex_lock(&t->lock);
+    t->ready = t->head;
+    pthread_cond_signal(&t->wake);
+    if (t->head + TRACE_CHUNK - t->tail > t->mask + 1) {
+        t->waits++;
+        while (t->head + TRACE_CHUNK - t->tail > t->mask + 1) {
+            pthread_cond_wait(&t->room, &t->lock);
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    t->flush_at = t->head + TRACE_CHUNK;
+}
+
+void trace_close(Trace *t, FILE *out) {
+    unsigned long written;
+    if (t->streaming) {
+        pthread_mutex_lock(&t->lock);
+        t->ready = t->head;
+        t->quit = 1;
+        pthread_cond_signal(&t->wake);
+        pthread_mutex_unlock(&t->lock);
+        pthread_join(t->writer, NULL);
+        pthread_mutex_destroy(&t->lock);
+        pthread_cond_destroy(&t->wake);
+        pthread_cond_destroy(&t->room);
+        written = t->head;
+    } else {
+        written = t->head < t->keep ? t->head : t->keep;
+        TraceHeader h = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), TRACE_BLOCK, t->head - written };
+        t->offset = sizeof(h);
+        if (fwrite(&h, sizeof(h), 1, t->file) != 1 || write_records(t, t->head - written, written) < 0) {
+            t->failed = 1;
+        }
+    }
+    TraceFooter footer = { t->offset, t->blocks, TRACE_INDEX_MAGIC };
+    for (unsigned long i = 0; i < t->blocks; i++) {
+        if (fwrite(&t->index[i], sizeof(TraceIndexEntry), 1, t->file) != 1) {
+            t->failed = 1;
+        }
+    }
+    if (fwrite(&footer, sizeof(footer), 1, t->file) != 1 || fclose(t->file) != 0) {
+        t->failed = 1;
+    }
+    if (out) {
+        fprintf(out, "Trace: %lu instructions, %lu written in %lu blocks (%llu KB, %.2f bytes each)%s, "
+                "run loop waited %lu times\n", t->head, written, t->blocks, t->offset >> 10,
+                written ? (double)t->offset / written : 0.0, t->failed ? ", write failed" : "", t->waits);
+    }
+    free(t->index);
+    free(t->raw);
+    free(t->packed);
+    free(t->ring);
+    free(t);
+}
+
+struct TraceReader {
+    FILE *file;
+    TraceHeader header;
+    TraceIndexEntry *index;
+    unsigned long blocks;
+    // The block decoded
+    long current;
+    TraceRecord *records;
+    unsigned int count;
+    unsigned int pos;
+    unsigned char *raw;
+    unsigned char *packed;
+};
+
+// Walk the block headers of a trace without an index (cut short)
+static int scan_blocks(TraceReader *r) {
+    unsigned long long offset = sizeof(TraceHeader);
+    unsigned long size = 0;
+    TraceBlock b;
+    fseek(r->file, offset, SEEK_SET);
+    while (fread(&b, sizeof(b), 1, r->file) == 1 && memcmp(b.magic, TRACE_BLOCK_MAGIC, 4) == 0) {
+        if (fseek(r->file, b.packed_size, SEEK_CUR) != 0) {
+            break;
+        }
+        if (r->blocks == size) {
+            size = size ? size * 2 : 1024;
+            r->index = realloc(r->index, size * sizeof(TraceIndexEntry));
+            if (r->index == NULL) {
+                printf("Out of memory\n");
+                exit(1);
+            }
+        }
+        r->index[r->blocks].offset = offset;
+        r->index[r->blocks].block = b;
+        r->blocks++;
+        offset += sizeof(b) + b.packed_size;
+    }
+    // The last block may be incomplete
+    if (r->blocks > 0) {
+        fseek(r->file, 0, SEEK_END);
+        if (ftell(r->file) < (long)offset) {
+            r->blocks--;
+        }
+    }
+    return 0;
+}
+
+TraceReader *trace_reader_open(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Cannot open %s\n", path);
+        return NULL;
+    }
+    TraceReader *r = calloc(1, sizeof(TraceReader));
+    if (r == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    r->file = f;
+    r->current = -1;
+    if (fread(&r->header, sizeof(r->header), 1, f) != 1 || memcmp(r->header.magic, TRACE_MAGIC, 4) != 0 ||
+        r->header.version != TRACE_VERSION || r->header.record_size != sizeof(TraceRecord) ||
+        r->header.block_records == 0 || r->header.block_records > TRACE_BLOCK) {
+        printf("Not a trace file: %s\n", path);
+        trace_reader_close(r);
+        return NULL;
+    }
+    TraceFooter footer;
+    if (fseek(f, -(long)sizeof(footer), SEEK_END) == 0 && fread(&footer, sizeof(footer), 1, f) == 1 &&
+        memcmp(footer.magic, TRACE_INDEX_MAGIC, 4) == 0) {
+        r->blocks = footer.blocks;
+        r->index = malloc((r->blocks ? r->blocks : 1) * sizeof(TraceIndexEntry));
+        if (r->index == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        if (fseek(f, footer.index_offset, SEEK_SET) != 0 ||
+            fread(r->index, sizeof(TraceIndexEntry), r->blocks, f) != r->blocks) {
+            printf("Damaged trace index: %s\n", path);
+            trace_reader_close(r);
+            return NULL;
+        }
+    } else {
+        scan_blocks(r);
+    }
+    r->records = malloc(TRACE_BLOCK * sizeof(TraceRecord));
+    r->raw = malloc(TRACE_BLOCK * RAW_RECORD_MAX);
+    r->packed = malloc(TRACE_BLOCK * RAW_RECORD_MAX * 129 / 128 + 1);
+    if (r->records == NULL || r->raw == NULL || r->packed == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    return r;
+}
+
+void trace_reader_close(TraceReader *r) {
+    fclose(r->file);
+    free(r->index);
+    free(r->records);
+    free(r->raw);
+    free(r->packed);
+    free(r);
+}
+
+unsigned long long trace_reader_first(TraceReader *r) {
+    return r->blocks ? r->index[0].block.first : r->header.first;
+}
+
+unsigned long long trace_reader_end(TraceReader *r) {
+    if (r->blocks == 0) {
+        return r->header.first;
+    }
+    TraceBlock *b = &r->index[r->blocks - 1].block;
+    return b->first + b->records;
+}
+
+// Decode block i into records; returns -1 if it is damaged
+static int load_block(TraceReader *r, unsigned long i) {
+    CodeEntry code[CODE_CACHE];
+    TraceBlock *b = &r->index[i].block;
+    r->current = -1;
+    if (b->records > TRACE_BLOCK || b->raw_size > TRACE_BLOCK * RAW_RECORD_MAX ||
+        b->packed_size > TRACE_BLOCK * RAW_RECORD_MAX * 129 / 128 + 1 ||
+        fseek(r->file, r->index[i].offset + sizeof(TraceBlock), SEEK_SET) != 0 ||
+        fread(r->packed, 1, b->packed_size, r->file) != b->packed_size ||
+        unpack(r->packed, b->packed_size, r->raw, b->raw_size) < 0) {
+        return -1;
+    }
+    TraceRecord prev = { 0 };
+    const unsigned char *raw = r->raw;
+    const unsigned char *end = r->raw + b->raw_size;
+    memset(code, 0, sizeof(code));
+    for (unsigned int n = 0; n < b->records; n++) {
+        TraceRecord *rec = &r->records[n];
+        if (raw >= end) {
+            return -1;
+        }
+        unsigned char flags = *raw++;
+        *rec = prev;
+        rec->pc = prev.pc + instruction_length(prev.opcode);
+        if (flags & TR_PC) {
+            rec->pc = raw[0] | raw[1] << 8;
+            raw += 2;
+        }
+        CodeEntry *c = &code[rec->pc & (CODE_CACHE - 1)];
+        if (flags & TR_CODE) {
+            c->valid = 1;
+            c->pc = rec->pc;
+            memcpy(c->bytes, raw, 3);
+            raw += 3;
+        } else if (!c->valid || c->pc != rec->pc) {
+            return -1;
+        }
+        rec->opcode = c->bytes[0];
+        rec->operand[0] = c->bytes[1];
+        rec->operand[1] = c->bytes[2];
+#define DELTA(field, flag)           \
+        if (flags & flag) {          \
+            rec->field += *raw++;    \
+        }
+        DELTA(a, TR_A)
+        DELTA(x, TR_X)
+        DELTA(y, TR_Y)
+        DELTA(sp, TR_SP)
+        DELTA(p, TR_P)
+        DELTA(depth, TR_DEPTH)
+#undef DELTA
+        if (raw > end) {
+            return -1;
+        }
+        rec->count = b->first + n;
+        prev = *rec;
+    }
+    r->current = i;
+    r->count = b->records;
+    r->pos = 0;
+    return 0;
+}
+
+int trace_reader_seek(TraceReader *r, unsigned long long count) {
+    // Last block starting at or before count
+    unsigned long lo = 0;
+    unsigned long hi = r->blocks;
+    while (hi - lo > 1) {
+        unsigned long mid = (lo + hi) / 2;
+        if (r->index[mid].block.first <= count) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    if (r->blocks == 0 || count < r->index[lo].block.first ||
+        count >= r->index[lo].block.first + r->index[lo].block.records) {
+        return -1;
+    }
+    if (r->current != (long)lo && load_block(r, lo) < 0) {
+        return -1;
+    }
+    r->pos = count - r->index[lo].block.first;
+    return 0;
+}
+
+int trace_reader_next(TraceReader *r, TraceRecord *rec, unsigned long long *count) {
+    if (r->current < 0 || r->pos == r->count) {
+        unsigned long next = r->current + 1;
+        if (next >= r->blocks) {
+            return 0;
+        }
+        if (load_block(r, next) < 0) {
+            return -1;
+        }
+    }
+    *rec = r->records[r->pos];
+    *count = r->index[r->current].block.first + r->pos;
+    r->pos++;
+    return 1;
+}
+
+int trace_reader_find(TraceReader *r, unsigned short pc, TraceRecord *rec, unsigned long long *count) {
+    for (;;) {
+        if (r->current < 0 || r->pos == r->count) {
+            unsigned long next = r->current + 1;
+            while (next < r->blocks && !(r->index[next].block.pages[pc >> 11] & 1 << (pc >> 8 & 7))) {
+                next++;
+            }
+            if (next >= r->blocks) {
+                return 0;
+            }
+            if (load_block(r, next) < 0) {
+                return -1;
+            }
+        }
+        while (r->pos < r->count) {
+            if (r->records[r->pos].pc == pc) {
+                return trace_reader_next(r, rec, count);
+            }
+            r->pos++;
+        }
+    }
+}
+
+int trace_decode(const char *path, unsigned long long from, unsigned long long count, long pc, FILE *out) {
+    TraceReader *r = trace_reader_open(path);
+    if (r == NULL) {
+        return -1;
+    }
+    if (from < trace_reader_first(r)) {
+        from = trace_reader_first(r);
+    }
+    if (from >= trace_reader_end(r)) {
+        fprintf(out, "The trace holds instructions %llu to %llu\n", trace_reader_first(r), trace_reader_end(r));
+        trace_reader_close(r);
+        return 0;
+    }
+    if (trace_reader_seek(r, from) < 0) {
+        printf("Damaged trace: %s\n", path);
+        trace_reader_close(r);
+        return -1;
+    }
+    TraceRecord rec;
+    unsigned long long number;
+    int status = 0;
+    while (count > 0 && (status = pc >= 0 ? trace_reader_find(r, pc, &rec, &number)
+                                          : trace_reader_next(r, &rec, &number)) > 0) {
+        char text[32];
+        trace_disassemble(text, sizeof(text), rec.pc, rec.opcode, rec.operand);
+        fprintf(out, "%10llu  %04X  %-16s A=%02X X=%02X Y=%02X SP=%02X P=%02X D=%u\n", number, rec.pc, text, rec.a,
+                rec.x, rec.y, rec.sp, rec.p, rec.depth);
+        count--;
+    }
+    trace_reader_close(r);
+    if (status < 0) {
+        printf("Damaged trace: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*6502 emul - binary instruction trace*/
+#ifndef TRACE_H
+#define TRACE_H
+#include <pthread.h>
+#include <stdio.h>
+#include "cpu6502.h"
+
+#define TRACE_MAGIC "E65T"
+#define TRACE_VERSION 2
+// Records in the ring when streaming, and per hand-over to the writer
+#define TRACE_DEFAULT_RING (1024 * 1024)
+#define TRACE_CHUNK (64 * 1024)
+// Records per block: a block decodes on its own, so this is the
+// keyframe interval (TRACE_CHUNK must be a multiple of it)
+#define TRACE_BLOCK (16 * 1024)
+
+// One instruction, taken before it executes: PC, the three bytes at PC,
+// the registers and the low 32 bits of the instruction number. There is
+// no cycle counter: instructions are the unit of time.
+typedef struct {
+    unsigned short pc;
+    unsigned char opcode;
+    unsigned char operand[2];
+    unsigned char a, x, y, sp, p;
+    unsigned char depth; // return stack entries in use
+    unsigned char reserved;
+    unsigned int count;
+} TraceRecord;
+
+// File: this header, then blocks of consecutive instructions, then the
+// index of the blocks and a TraceFooter. A trace cut short (no footer)
+// is read by walking the blocks.
+typedef struct {
+    char magic[4];
+    unsigned int version;
+    unsigned int record_size;
+    unsigned int block_records; // TRACE_BLOCK when written
+    unsigned long long first;   // instruction number of the first record
+} TraceHeader;
+
+// Block: this header, then packed_size bytes that unpack (LZ77, see
+// pack) to raw_size bytes of records. Each record is a byte of TR_*
+// flags followed by the fields it flags: the PC when it is not the one
+// after the previous instruction, the instruction bytes when they are
+// not those last seen at that PC in the block, and for each register
+// that changed its difference from the previous record. The first
+// record is taken against all zero, so it holds the full state.
+#define TRACE_BLOCK_MAGIC "E65B"
+typedef struct {
+    char magic[4];
+    unsigned int records;
+    unsigned int raw_size;
+    unsigned int packed_size;
+    unsigned long long first;  // instruction number of the first record
+    unsigned char pages[32];   // bit per 256-byte page any PC was in
+} TraceBlock;
+
+#define TR_PC 0x01
+#define TR_CODE 0x02
+#define TR_A 0x04
+#define TR_X 0x08
+#define TR_Y 0x10
+#define TR_SP 0x20
+#define TR_P 0x40
+#define TR_DEPTH 0x80
+
+typedef struct {
+    unsigned long long offset; // of the block header in the file
+    TraceBlock block;
+} TraceIndexEntry;
+
+#define TRACE_INDEX_MAGIC "E65X"
+typedef struct {
+    unsigned long long index_offset;
+    unsigned int blocks;
+    char magic[4];
+} TraceFooter;
+
+// Records go into a power-of-two ring. Streaming, a writer thread
+// encodes every TRACE_CHUNK records into blocks and appends them to the
+// file; the run loop only waits when the ring is full. Otherwise
+// (flight recorder) the ring keeps the last records and they are
+// encoded when the trace closes.
+//
+// Only the flight recorder keeps a run under 2x slower than untraced.
+// Encoding a record costs more than running the instruction, so on one
+// core streaming is about 3x slower; only with a spare core for the
+// writer can it come close to the flight recorder.
+typedef struct {
+    TraceRecord *ring;
+    unsigned long mask;
+    unsigned long head;     // records taken
+    unsigned long flush_at; // head at which trace_flush runs
+    FILE *file;
+    int streaming;
+    unsigned long keep;     // flight recorder: records written at close
+    // Writer
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    // more records for the writer
+    pthread_cond_t room;    // room in the ring for the run loop
+    unsigned long ready;    // records handed over
+    unsigned long tail;     // records written
+    int quit;
+    int failed;
+    // Encoder (writer thread, or trace_close for a flight recorder)
+    unsigned char *raw;
+    unsigned char *packed;
+    TraceIndexEntry *index;
+    unsigned long blocks;
+    unsigned long index_size;
+    unsigned long long offset; // file size so far
+    // Counters
+    unsigned long waits;    // times the run loop found the ring full
+} Trace;
+
+// Trace to path: every instruction (ring_size 0) or only the last
+// ring_size of them
+Trace *trace_open(const char *path, unsigned long ring_size);
+// Hand the records since the last call to the writer
+void trace_flush(Trace *t);
+// Write what is left, stop the writer and report on out (NULL for no report)
+void trace_close(Trace *t, FILE *out);
+// Reading: seek to any instruction through the index, decoding only
+// the block it is in
+typedef struct TraceReader TraceReader;
+TraceReader *trace_reader_open(const char *path);
+// Instruction numbers in the trace: first..end - 1
+unsigned long long trace_reader_first(TraceReader *r);
+unsigned long long trace_reader_end(TraceReader *r);
+// Position on instruction count; returns -1 if it is not in the trace
+int trace_reader_seek(TraceReader *r, unsigned long long count);
+// The record at the position, then advance; returns 1, 0 at the end of
+// the trace or -1 if the file is damaged. *count gets the instruction
+// number.
+int trace_reader_next(TraceReader *r, TraceRecord *rec, unsigned long long *count);
+// Same, for the next record with the given PC: blocks that never ran
+// code in its page are skipped without decoding
+int trace_reader_find(TraceReader *r, unsigned short pc, TraceRecord *rec, unsigned long long *count);
+void trace_reader_close(TraceReader *r);
+// Print up to count instructions from instruction from as text, only
+// those at pc if pc >= 0; returns 0, or -1 if the trace cannot be read
+int trace_decode(const char *path, unsigned long long from, unsigned long long count, long pc, FILE *out);
+// Assembly text of the instruction at pc (operands as recorded)
+void trace_disassemble(char *buf, size_t size, unsigned short pc, unsigned char opcode, const unsigned char *operand);
+
+// Called by the run loop before each instruction
+static inline void trace_step(Trace *t, const CPU6502 *cpu) {
+    TraceRecord *r = &t->ring[t->head & t->mask];
+    const unsigned char *mem = cpu->mem;
+    unsigned short pc = cpu->pc;
+    r->pc = pc;
+    r->opcode = mem[pc];
+    r->operand[0] = mem[(unsigned short)(pc + 1)];
+    r->operand[1] = mem[(unsigned short)(pc + 2)];
+    r->a = cpu->a;
+    r->x = cpu->x;
+    r->y = cpu->y;
+    r->sp = cpu->sp;
+    r->p = cpu->p;
+    r->depth = STACK_SIZE - 1 - cpu->stack_pointer;
+    r->count = t->head;
+    if (++t->head == t->flush_at) {
+        trace_flush(t);
+    }
+}
+#endif